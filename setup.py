@@ -3,7 +3,8 @@
 from distutils.core import setup, Extension
 
 datamodule = Extension('sudoku.data',
-                       ['sudoku/datamodule.c'])
+                       ['sudoku/datamodule.c'],
+                       libraries=['pthread'])
 
 setup(name='sudoku',
       author='Joseph Tibbertsma',
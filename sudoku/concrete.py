@@ -3,7 +3,7 @@ Concrete sudoku solver classes which use various algorithms to solve sudoku
 puzzles.
 """
 
-from .errors import Catastrophic, NoNextMoveError
+from .errors import Catastrophic, ContradictionError, NoNextMoveError
 from .solver import (BasicSolver, Solver, Elimination, HiddenSingles,
                      NakedPairs, NakedTriples, NakedQuads,
                      HiddenPairs, HiddenTriples, HiddenQuads,
@@ -92,7 +92,16 @@ class FinishCreating(BasicSolver, Elimination, Sledgehammer):
             count += 1
 
 class FastSolver(Solver, Elimination, HiddenSingles, NakedPairs, Sledgehammer):
-    """Designed to solve the widest variety of puzzles the fastest."""
+    """Designed to solve the widest variety of puzzles the fastest. The solve
+    method hands the whole puzzle to the native engine in the data module, so
+    no moves are recorded; use findnextmove/apply to step through a puzzle
+    with the algorithms instead.
+    """
+    def solve(self):
+        try:
+            self.state.solve_native()
+        except ContradictionError:
+            raise NoNextMoveError
 
 class Slowpoke(Solver, Elimination, Random):
     """Designed to be super slow and take up hella memory."""
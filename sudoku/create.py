@@ -16,16 +16,19 @@ def check_unique(grid, grconfig=None):
 
 def create_terminal_pattern(*, grconfig=None):
     """Make a randomized solved grid."""
-    state = State({}, grconfig)
-    sc = StartCreating(state)
-    sc.solve()
-    fin = FinishCreating(state)
-    try:
-        fin.solve()
-    except NoNextMoveError:
-        # Oops, sc created a puzzle with no solutions; start over
-        return create_terminal_pattern(grconfig=grconfig)
-    except Catastrophic:
-        # See docstring for errors.Catastrophic
-        return create_terminal_pattern(grconfig=grconfig)
-    return state.clues
+    state = State({}, grconfig=grconfig)
+    while True:
+        sc = StartCreating(state)
+        sc.solve()
+        fin = FinishCreating(state)
+        try:
+            fin.solve()
+        except NoNextMoveError:
+            # Oops, sc created a puzzle with no solutions; start over
+            pass
+        except Catastrophic:
+            # See docstring for errors.Catastrophic
+            pass
+        else:
+            return state.clues
+        state.reset({})
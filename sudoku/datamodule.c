@@ -1,5 +1,10 @@
 #include "Python.h"
 #include "structmember.h"
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 PyDoc_STRVAR(module_doc,
 "This module contains the implementation of the sudoku state object,\n\
@@ -7,23 +12,39 @@ which is responsible for keeping track of the puzzle state information\n\
 such as solved keys and candidates for unsolved keys.\n\
 \n\
 This module also defines several helper types. Of these, only the\n\
-CandidateSet type can be imported. The other three helper types\n\
+CandidateSet and ChangeSet types can be imported; a ChangeSet holds\n\
+the candidates a move removes, per cell. The other helper types\n\
 cannot be imported but are returned by methods or attributes\n\
 of the State object. One is an iterator type which can iterate\n\
 through the state's keys in various orders, and there are two\n\
 mappings, candidates and clues, which are used to access information\n\
-from the State object.");
+from the State object. CandidateSets are interned, so iterating over\n\
+one uses its own small iterator type.\n\
+\n\
+Anywhere the State accepts a key (x, y), the cell index x * 9 + y can be\n\
+used instead. The key iterators yield indices after a call to their\n\
+indices method, and State.house_indices lists the indices in each house.\n\
+The cell_values, cell_candidates, house_counts and position_masks\n\
+attributes are read only memoryviews over the State's own arrays, for\n\
+reading whole grids without creating keys or CandidateSets.\n\
+\n\
+The function solve_batch solves many puzzle strings at once on native\n\
+threads, without creating State objects. The function compile_config\n\
+turns a grconfig into a compiled config that States can share; States\n\
+with equal group configurations share one compiled config either way.");
 
 
 /*[clinic input]
 module data
 class data.State "SudokuStateObject *" "&SudokuState_Type"
 class data.CandidateSet "CandidateSetObject *" "&CandidateSet_Type"
+class data.ChangeSet "ChangeSetObject *" "&ChangeSet_Type"
 class data.state_candidates "SudokuMapObject *" "&state_candidates_Type"
 class data.state_clues "SudokuMapObject *" "&state_clues_Type"
 class data.state_iterator "KeyIterObject *" "&state_iterator_Type"
+class data.candidate_set_iterator "CandidateSetIterObject *" "&CandidateSetIter_Type"
 [clinic start generated code]*/
-/*[clinic end generated code: output=da39a3ee5e6b4b0d input=8c27dca51b54bba5]*/
+/*[clinic end generated code: output=da39a3ee5e6b4b0d input=b8b2124afdaeb5e6]*/
 
 /*static int num_allocs;
 static int num_deallocs;*/
@@ -36,12 +57,12 @@ static PyObject *config_module;
 /* Our custom exception indicating contradiction */
 static PyObject *ContradictionError;
 
-/* Default state attributes */
+/* Default group configuration, and the compiled config made from it */
 static PyObject *default_grconfig;
-static PyObject *default_peers;
-static PyObject *default_subgroups;
-static PyObject *default_housekeys;
-static PyObject *default_oneset;
+static PyObject *default_config;
+
+/* Compiled configs by layout; see compile_config */
+static PyObject *config_cache;
 
 /* Variable size puzzles are currently unsupported. */
 #define NUMROWS  9
@@ -50,7 +71,8 @@ static PyObject *default_oneset;
 /* Mask for candidate set */
 #define TERMS    0x01FF
 
-#define ERRORBIT 0x8000
+/* Value of an unsolved cell */
+#define UNSOLVED 0xFF
 
 /* Maximum number of rectangles in the grid; depends on NUMROWS */
 #define MAXRECT  1296
@@ -63,38 +85,89 @@ static PyObject *default_oneset;
 #define COL(i) \
     ((i) % NUMROWS)
 
-/* Macros for accessing cell_info struct. */
+/* Macros for accessing the cell arrays of a State. */
 
 /* Set a bit in a number. (set is usually a uint16_t). */
 #define SET_BIT(set, bit) \
     (set |= (1 << (bit)))
 
 /* Value aka clue for a cell. */
-#define CELL_VALUE(grid, x, y) \
-    ((grid)[INDEX((x),(y))].ci_value)
+#define CELL_VALUE(state, x, y) \
+    ((state)->ss_values[INDEX((x),(y))])
 
 /* Candidate set for a cell. */
-#define CELL_CANDS(grid, x, y) \
-    ((grid)[INDEX((x),(y))].ci_candidates)
+#define CELL_CANDS(state, x, y) \
+    ((state)->ss_cands[INDEX((x),(y))])
 
 /* Test if a cell is solved. */
-#define CELL_FILLED(grid, x, y) \
-    ((!(CELL_VALUE((grid),(x),(y)) & ERRORBIT)))
+#define CELL_FILLED(state, x, y) \
+    (CELL_VALUE((state),(x),(y)) != UNSOLVED)
 
 /* Get group house_info struct from a cell. */
 #define CELL_GROUP(state, x, y) \
-    ((state)->ss_houses[(state)->ss_grid[INDEX((x),(y))].ci_group])
+    ((state)->ss_houses[(state)->ss_layout->gl_houses[INDEX((x),(y))][0]])
+
+/* Interned keys. Every key this module returns is one of the tuples in
+ * ikeys, and their items are the ints in idigits. Both tables are filled
+ * in by PyInit_data.
+ */
+static PyObject *idigits[NUMROWS];
+static PyObject *ikeys[GRIDSIZE];
+
+/* Returns a new reference to the interned key for (x, y). */
+static PyObject *
+build_key(Py_ssize_t x, Py_ssize_t y)
+{
+    PyObject *key = ikeys[INDEX(x, y)];
+
+    Py_INCREF(key);
+    return key;
+}
+
+/* Index of o in idigits, or -1 if o isn't one of them. This only compares
+ * pointers, so it never converts o or sets an exception.
+ */
+static Py_ssize_t
+digit_index(PyObject *o)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < NUMROWS; i++) {
+        if (idigits[i] == o)
+            return i;
+    }
+    return -1;
+}
 
 /* Using the macros below to parse key tuples instead of PyArg_ParseTuple
  * is significantly faster. Using this is also good for catching errors
  * involving bad keys.
  *
- * key is supposed to be a tuple with 2 ints. error_stmt is a statement to
- * be performed on error, such as 'return NULL' or 'goto error'. Coordinates
- * are stored in variables x and y, which are declared automatically.
+ * key is supposed to be a tuple with 2 ints, or an int from 0 to 80 which
+ * is the cell index (see INDEX). A key of the wrong type raises TypeError,
+ * and one that is out of range raises KeyError. error_stmt is a statement to be performed
+ * on error, such as 'return NULL' or 'goto error'. Coordinates are stored in
+ * variables x and y, which are declared automatically.
+ *
+ * Keys built from small ints (which includes all of the interned keys) are
+ * recognized by identity, so the int conversion only happens for other keys.
  */
 #define UNPACK_KEY_NO_DECL(key, error_stmt, name)                       \
     do {                                                                \
+        if (PyLong_CheckExact(key)) {                                   \
+            x = PyLong_AsSsize_t(key);                                  \
+            if (x == -1 && PyErr_Occurred()) {                          \
+                error_stmt;                                             \
+            }                                                           \
+            if (x >= GRIDSIZE || x < 0) {                               \
+                PyErr_Format(PyExc_KeyError,                            \
+                    "%s: Invalid index: %ld", name, x);                 \
+                error_stmt;                                             \
+            }                                                           \
+            y = COL(x);                                                 \
+            x = ROW(x);                                                 \
+            break;                                                      \
+        }                                                               \
         if (!PyTuple_Check(key) ||                                      \
             PyTuple_GET_SIZE(key) != 2) {                               \
             PyErr_Format(PyExc_TypeError,                               \
@@ -104,15 +177,19 @@ static PyObject *default_oneset;
         }                                                               \
         _x = PyTuple_GET_ITEM(key, 0);                                  \
         _y = PyTuple_GET_ITEM(key, 1);                                  \
-        x = PyLong_AsSsize_t(_x);                                       \
-        y = PyLong_AsSsize_t(_y);                                       \
-        if (PyErr_Occurred()) {                                         \
-            error_stmt;                                                 \
-        }                                                               \
-        if (x >= NUMROWS || y >= NUMROWS || x < 0 || y < 0) {           \
-            PyErr_Format(PyExc_TypeError,                               \
-                "%s: Invalid key: (%ld, %ld)", name, x, y);             \
-            error_stmt;                                                 \
+        x = digit_index(_x);                                            \
+        y = digit_index(_y);                                            \
+        if (x < 0 || y < 0) {                                           \
+            x = PyLong_AsSsize_t(_x);                                   \
+            y = PyLong_AsSsize_t(_y);                                   \
+            if (PyErr_Occurred()) {                                     \
+                error_stmt;                                             \
+            }                                                           \
+            if (x >= NUMROWS || y >= NUMROWS || x < 0 || y < 0) {       \
+                PyErr_Format(PyExc_KeyError,                            \
+                    "%s: Invalid key: (%ld, %ld)", name, x, y);         \
+                error_stmt;                                             \
+            }                                                           \
         }                                                               \
     } while(0)
 
@@ -123,7 +200,9 @@ static PyObject *default_oneset;
 
 
 /* CandidateSet implementation. This object is immutable. Since a candidate
- * set can contain only 9 binary values, there are 512 possibilities.
+ * set can contain only 9 binary values, there are 512 possibilities, and
+ * each of them is created once when the module is initialized. Every
+ * CandidateSet handed out by this module is one of these shared objects.
  */
 
 static PyTypeObject CandidateSet_Type;
@@ -147,25 +226,53 @@ count_ones(int u)
 
 typedef struct {
     PyObject_HEAD
-    Py_ssize_t cs_iterpos;  /* iteration placeholder */
     uint16_t cs_set;        /* data */
 } CandidateSetObject;
 
 /* Interned sizes for each CandidateSet. */
 static Py_ssize_t isizes[512];
 
+/* Interned CandidateSets; filled in by PyInit_data. */
+static PyObject *isets[512];
+
+/* index of the lowest set bit in a candidate set */
+static Py_ssize_t
+lowest_digit(uint16_t set)
+{
+    Py_ssize_t d = 0;
+
+    while (!(set & (1 << d)))
+        d++;
+    return d;
+}
+
+/* Returns a new reference to the interned set. This can't fail, but
+ * callers check for NULL like with any other constructor.
+ */
 static PyObject *
 build_set(uint16_t set)
+{
+    PyObject *self = isets[set & TERMS];
+
+    Py_INCREF(self);
+    return self;
+}
+
+static int
+intern_sets(void)
 {
     CandidateSetObject *self;
+    Py_ssize_t i;
 
-    self = PyObject_New(CandidateSetObject, &CandidateSet_Type);
-    if (!self)
-        return NULL;
-    self->cs_set = set & TERMS;
-    self->cs_iterpos = 0;
+    for (i = 0; i < 512; i++) {
+        self = PyObject_New(CandidateSetObject, &CandidateSet_Type);
+        if (!self)
+            return -1;
+        self->cs_set = (uint16_t)i;
+        isets[i] = (PyObject *)self;
+    }
 
-    return (PyObject *)self;
+    return 0;
 }
 
 /* Public constructor */
@@ -385,111 +492,154 @@ data_CandidateSet_richcompare(CandidateSetObject *a,
     return v;
 }
 
+/* Since CandidateSets are shared, iteration state lives in a separate
+ * iterator object.
+ */
+typedef struct {
+    PyObject_HEAD
+    uint16_t csi_set;       /* bits that haven't been yielded yet */
+} CandidateSetIterObject;
+
+static PyTypeObject CandidateSetIter_Type;
+
 static PyObject *
 data_CandidateSet_iter(CandidateSetObject *self)
 {
-    /* CandidateSets are their own iterators, but don't iterate over
-     * this one. It wouldn't work if we tried to iterate over the same
-     * set in multiple threads. So make a fresh one.
-     */
-    return build_set(self->cs_set);
+    CandidateSetIterObject *it;
+
+    it = PyObject_New(CandidateSetIterObject, &CandidateSetIter_Type);
+    if (!it)
+        return NULL;
+    it->csi_set = self->cs_set;
+
+    return (PyObject *)it;
 }
 
 static PyObject *
-data_CandidateSet_iternext(CandidateSetObject *self)
+data_CandidateSetIter_iternext(CandidateSetIterObject *self)
 {
-    for (; self->cs_iterpos < 9; self->cs_iterpos++) {
-        if (self->cs_set & (1 << self->cs_iterpos)) {
-            return PyLong_FromSsize_t(self->cs_iterpos++);
-        }
-    }
+    Py_ssize_t bit = 0;
 
-    return NULL;
+    if (!self->csi_set)
+        return NULL;
+    while (!(self->csi_set & (1 << bit)))
+        bit++;
+    self->csi_set &= ~(1 << bit);
+
+    return PyLong_FromSsize_t(bit);
+}
+
+static PyObject *
+data_CandidateSetIter_length_hint(CandidateSetIterObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return PyLong_FromSsize_t(isizes[self->csi_set]);
 }
 
+static PyMethodDef CandidateSetIter_methods[] = {
+    {"__length_hint__", (PyCFunction)data_CandidateSetIter_length_hint, METH_NOARGS, NULL},
+    {NULL}  /*sentinel*/
+};
+
+static PyTypeObject CandidateSetIter_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "sudoku.data.candidate_set_iterator",/*tp_name*/
+    sizeof(CandidateSetIterObject),/*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    0,                          /*tp_dealloc*/
+    0,                          /*tp_print*/
+    0,                          /*tp_getattr*/
+    0,                          /*tp_setattr*/
+    0,                          /*tp_reserved*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    0,                          /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    PyObject_GenericGetAttr,    /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    PyObject_SelfIter,          /*tp_iter*/
+    (iternextfunc)data_CandidateSetIter_iternext,/*tp_iternext*/
+    CandidateSetIter_methods,   /*tp_methods*/
+    0,                          /*tp_members*/
+    0,                          /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    0,                          /*tp_new*/
+    PyObject_Del,               /*tp_free*/
+    0,                          /*tp_is_gc*/
+};
+
 /*[clinic input]
-data.CandidateSet.__getstate__
+data.CandidateSet.__reduce__
 
 Pickle support for CandidateSet.
 
-Returns a tuple containing two ints. The first is converted into
-bitwise set information, and the second is used as the iteration
-position.
+Unpickling calls the constructor with the elements of the set, which
+gives back the shared instance.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_CandidateSet___getstate____doc__,
-"__getstate__($self, /)\n"
+PyDoc_STRVAR(data_CandidateSet___reduce____doc__,
+"__reduce__($self, /)\n"
 "--\n"
 "\n"
 "Pickle support for CandidateSet.\n"
 "\n"
-"Returns a tuple containing two ints. The first is converted into\n"
-"bitwise set information, and the second is used as the iteration\n"
-"position.");
+"Unpickling calls the constructor with the elements of the set, which\n"
+"gives back the shared instance.");
 
-#define DATA_CANDIDATESET___GETSTATE___METHODDEF    \
-    {"__getstate__", (PyCFunction)data_CandidateSet___getstate__, METH_NOARGS, data_CandidateSet___getstate____doc__},
-
-static PyObject *
-data_CandidateSet___getstate___impl(CandidateSetObject *self);
+#define DATA_CANDIDATESET___REDUCE___METHODDEF    \
+    {"__reduce__", (PyCFunction)data_CandidateSet___reduce__, METH_NOARGS, data_CandidateSet___reduce____doc__},
 
 static PyObject *
-data_CandidateSet___getstate__(CandidateSetObject *self, PyObject *Py_UNUSED(ignored))
-{
-    return data_CandidateSet___getstate___impl(self);
-}
+data_CandidateSet___reduce___impl(CandidateSetObject *self);
 
 static PyObject *
-data_CandidateSet___getstate___impl(CandidateSetObject *self)
-/*[clinic end generated code: output=8097811e317fcd17 input=3f9c6c1add00022c]*/
+data_CandidateSet___reduce__(CandidateSetObject *self, PyObject *Py_UNUSED(ignored))
 {
-    return Py_BuildValue("(nn)", (Py_ssize_t)self->cs_set, self->cs_iterpos);
+    return data_CandidateSet___reduce___impl(self);
 }
 
-/*[clinic input]
-data.CandidateSet.__setstate__
-
-    state: object
-        This should be a tuple containing two ints.
-    /
-
-Unpickle a CandidateSet.
-[clinic start generated code]*/
-
-PyDoc_STRVAR(data_CandidateSet___setstate____doc__,
-"__setstate__($self, state, /)\n"
-"--\n"
-"\n"
-"Unpickle a CandidateSet.\n"
-"\n"
-"  state\n"
-"    This should be a tuple containing two ints.");
-
-#define DATA_CANDIDATESET___SETSTATE___METHODDEF    \
-    {"__setstate__", (PyCFunction)data_CandidateSet___setstate__, METH_O, data_CandidateSet___setstate____doc__},
-
 static PyObject *
-data_CandidateSet___setstate__(CandidateSetObject *self, PyObject *state)
-/*[clinic end generated code: output=d43bd51c59ce8736 input=d78edfbbf56a8790]*/
+data_CandidateSet___reduce___impl(CandidateSetObject *self)
+/*[clinic end generated code: output=9081eac2a36cdb0e input=3d17334eabc34867]*/
 {
-    Py_ssize_t x, y;
+    PyObject *args;
+    Py_ssize_t bit, i = 0;
 
-    if (PyArg_ParseTuple(state, "nn", &x, &y) < 0)
-        return NULL;
-    if (x >= NUMROWS || x < 0 || y < 0) {
-        PyErr_Format(PyExc_ValueError,
-            "__setstate__: Bad values (%ld, %ld)", x, y);
+    args = PyTuple_New(isizes[self->cs_set]);
+    if (!args)
         return NULL;
+    for (bit = 0; bit < 9; bit++) {
+        if (self->cs_set & (1 << bit)) {
+            PyObject *item = PyLong_FromSsize_t(bit);
+            if (!item) {
+                Py_DECREF(args);
+                return NULL;
+            }
+            PyTuple_SET_ITEM(args, i++, item);
+        }
     }
-    self->cs_iterpos = y;
-    self->cs_set = (uint16_t)x;
-    
-    Py_RETURN_NONE;
+
+    return Py_BuildValue("(ON)", (PyObject *)&CandidateSet_Type, args);
 }
 
 static PyMethodDef CandidateSet_methods[] = {
-    DATA_CANDIDATESET___GETSTATE___METHODDEF
-    DATA_CANDIDATESET___SETSTATE___METHODDEF
+    DATA_CANDIDATESET___REDUCE___METHODDEF
     {NULL}  /*sentinel*/
 };
 
@@ -521,7 +671,7 @@ static PyTypeObject CandidateSet_Type = {
     (richcmpfunc)data_CandidateSet_richcompare,/*tp_richcompare*/
     0,                          /*tp_weaklistoffset*/
     (getiterfunc)data_CandidateSet_iter,/*tp_iter*/
-    (iternextfunc)data_CandidateSet_iternext,/*tp_iternext*/
+    0,                          /*tp_iternext*/
     CandidateSet_methods,       /*tp_methods*/
     0,                          /*tp_members*/
     0,                          /*tp_getset*/
@@ -541,1253 +691,1364 @@ static PyTypeObject CandidateSet_Type = {
 
 static PyTypeObject SudokuState_Type;
 
-/* struct to store information about each cell */
-typedef struct {
-   /* Py_ssize_t ci_id;     */     /* index of the struct in the grid array */
-    Py_ssize_t ci_group;       /* offset into house_info array for this cell's group */
-    uint16_t ci_value;         /* ERRORBIT is set if cell is unsolved. */
-    uint16_t ci_candidates;    /* Bits 0-8 are set if that number is a candidate. */
-    /*Py_ssize_t not_used_yet[36];*/
-} cell_info;
-
 /* offsets into ss_houses for each type of house */
 #define ROWOFFSET (NUMROWS * 2)
 #define COLOFFSET  NUMROWS
 #define GROFFSET   0
 
-/* store information for a house */
+/* A set of cells, one bit per cell index. */
 typedef struct {
-    PyObject *hi_keyset;    /* borrowed reference to keyset from ss_grconfig.
-                               Only has meaning for groups, not rows or columns. */
-    Py_ssize_t hi_solved;   /* number of solved positions for the house */
-    Py_ssize_t hi_cand_count[NUMROWS];  /* number of each candidate remaining */
-} house_info;
+    uint64_t cm_bits[2];
+} cellmask;
 
-typedef struct {
-    PyObject_HEAD
-    Py_ssize_t ss_solved;       /* number of solved positions */
-    Py_ssize_t ss_digits[NUMROWS];/* Number of times each digit appears in the grid */
-    PyObject *ss_grconfig;      /* dict */
-    PyObject *ss_peers;         /* dict */
-    PyObject *ss_subgroups;     /* tuple; (dict, dict) */
-    PyObject *ss_movehook;      /* Move subclass object (or NULL) */
-    PyObject *ss_weakref;       /* allow weak references */
-    PyObject *ss_skeys;         /* set of solved keys */
-    PyObject *ss_housekeys;     /* Keys in each house */
-    PyObject *ss_oneset;        /* unions of peer sets */
-    PyObject *ss_dict;          /* Support for dynamic attributes */
-    house_info ss_houses[NUMROWS*3];    /* information for each house */
-    cell_info ss_grid[GRIDSIZE];/* cell information */
-} SudokuStateObject;
+#define CM_TEST(m, i) \
+    (((m).cm_bits[(i) >> 6] >> ((i) & 63)) & 1)
+#define CM_SET(m, i) \
+    ((m).cm_bits[(i) >> 6] |= (uint64_t)1 << ((i) & 63))
+#define CM_CLEAR(m, i) \
+    ((m).cm_bits[(i) >> 6] &= ~((uint64_t)1 << ((i) & 63)))
 
-static void
-data_State_dealloc(SudokuStateObject *self)
+/* number of cells in a cellmask */
+static Py_ssize_t
+cm_count(const cellmask *m)
 {
-    PyObject_ClearWeakRefs((PyObject *)self);
-    PyObject_GC_UnTrack(self);
-    Py_CLEAR(self->ss_dict);
-    Py_CLEAR(self->ss_skeys);
-    Py_CLEAR(self->ss_grconfig);
-    Py_CLEAR(self->ss_peers);
-    Py_CLEAR(self->ss_subgroups);
-    Py_CLEAR(self->ss_housekeys);
-    Py_CLEAR(self->ss_oneset);
-    Py_CLEAR(self->ss_movehook);
-    Py_TYPE(self)->tp_free((PyObject *)self);
+#if defined(__GNUC__)
+    return __builtin_popcountll(m->cm_bits[0]) +
+           __builtin_popcountll(m->cm_bits[1]);
+#else
+    Py_ssize_t k, n = 0;
+    uint64_t b;
+
+    for (k = 0; k < 2; k++) {
+        for (b = m->cm_bits[k]; b; b &= b - 1)
+            n++;
+    }
+    return n;
+#endif
 }
 
-#define State_CheckExact(s) \
-    (Py_TYPE(s) == &SudokuState_Type)
-
-static uint16_t
-find_clues_in_keyset(cell_info *grid, PyObject *keyset)
+/* lowest cell in a cellmask at or after start, or -1 if there is none */
+static Py_ssize_t
+cm_next(const cellmask *m, Py_ssize_t start)
 {
-    PyObject *key, *iter;
-    uint16_t clues = 0;
-
-    iter = PyObject_GetIter(keyset);
-    if (!iter)
-        goto done;
-
-    while ((key = PyIter_Next(iter))) {
-        UNPACK_KEY(key, goto done, "__init__");
-
-        if (CELL_FILLED(grid, x, y)) {
-            SET_BIT(clues, CELL_VALUE(grid, x, y));
+    Py_ssize_t k;
+    uint64_t b;
+
+    for (k = start >> 6; k < 2; k++) {
+        b = m->cm_bits[k];
+        if (k == start >> 6)
+            b &= ~(uint64_t)0 << (start & 63);
+        if (b) {
+#if defined(__GNUC__)
+            return (k << 6) + __builtin_ctzll(b);
+#else
+            Py_ssize_t i = 0;
+            while (!(b & 1)) {
+                b >>= 1;
+                i++;
+            }
+            return (k << 6) + i;
+#endif
         }
     }
-
-done:
-    Py_DECREF(iter);
-    if (PyErr_Occurred())
-        clues |= ERRORBIT;
-    return clues;
+    return -1;
 }
 
-static PyObject *
-do_default_build_config(void)
-{
-    _Py_IDENTIFIER(build_config);
-    PyObject *f, *args, *v = NULL;
+/* ChangeSet implementation. A ChangeSet maps cells to candidates to be
+ * removed from or added to them, the same information as the change dicts
+ * that moves pass to remove_candidates and add_candidates. It is kept as a
+ * cell mask and one candidate mask per cell, so that a State can apply it
+ * in one pass without unpacking keys or checking the type of every value.
+ * Empty masks are never stored; ch_cells has a bit for exactly the cells
+ * whose mask is nonempty.
+ */
 
-    args = PyTuple_New(0);
-    if (!args)
-        return NULL;
+static PyTypeObject ChangeSet_Type;
 
-    f = _PyDict_GetItemId(config_module, &PyId_build_config);
-    if (!f) {
-        PyErr_SetString(PyExc_AttributeError, "function not found");
-        goto done;
-    }
-    v = PyObject_Call(f, args, NULL);
+#define ChangeSet_Check(v) \
+    (Py_TYPE(v) == &ChangeSet_Type)
 
-done:
-    Py_DECREF(args);
-    return v;
-}
+typedef struct {
+    PyObject_HEAD
+    cellmask ch_cells;              /* cells with a nonempty mask */
+    uint16_t ch_masks[GRIDSIZE];    /* candidates to change in each cell */
+} ChangeSetObject;
 
-#define CALC_ATTR_FUNC(attr)                                            \
-static PyObject *                                                       \
-do_calculate_##attr(PyObject *var)                                      \
-{                                                                       \
-    _Py_IDENTIFIER(calculate_##attr);                                   \
-    PyObject *f;                                                        \
-                                                                        \
-    f = _PyDict_GetItemId(config_module, &PyId_calculate_##attr);       \
-    if (!f) {                                                           \
-        PyErr_SetString(PyExc_AttributeError, "function not found");    \
-        return NULL;                                                    \
-    }                                                                   \
-    return PyObject_CallFunction(f, "O", var);                          \
+static ChangeSetObject *
+changeset_new(void)
+{
+    return (ChangeSetObject *)PyType_GenericAlloc(&ChangeSet_Type, 0);
 }
 
-CALC_ATTR_FUNC(peers)
-CALC_ATTR_FUNC(subgroups)
-CALC_ATTR_FUNC(housekeys)
-CALC_ATTR_FUNC(oneset)
-
-static int
-set_python_calculated_attrs(SudokuStateObject *self, PyObject *grconfig)
+/* Set the mask for cell i; an empty mask removes the cell. */
+static void
+changeset_put(ChangeSetObject *self, Py_ssize_t i, uint16_t mask)
 {
-    PyObject *peers = NULL, *subgroups = NULL, *housekeys = NULL, *oneset = NULL;
-    int same;
-
-    /* If grconfig is the NULL pointer or is Py_None, use default values.
-     * Otherwise, calculate values using python functions from config_module.
-     */
-    if (!grconfig || grconfig == Py_None)
-        goto default_attrs;
-
-    /* If a grconfig was passed in, check if it's equal to default */
-    if ((same = PyObject_RichCompareBool(grconfig, default_grconfig, Py_EQ)) < 0)
-        return -1;
-    if (same)
-        goto default_attrs;
-
-    peers = do_calculate_peers(grconfig);
-    if (!peers)
-        goto fail;
-
-    subgroups = do_calculate_subgroups(peers);
-    if (!subgroups)
-        goto fail;
-
-    housekeys = do_calculate_housekeys(grconfig);
-    if (!housekeys)
-        goto fail;
-
-    oneset = do_calculate_oneset(peers);
-    if (!oneset)
-        goto fail;
-
-    self->ss_grconfig  = grconfig;
-    self->ss_peers     = peers;
-    self->ss_subgroups = subgroups;
-    self->ss_housekeys = housekeys;
-    self->ss_oneset    = oneset;
-
-    Py_INCREF(self->ss_grconfig);
-    return 0;
-
-default_attrs:
-    self->ss_grconfig  = default_grconfig;
-    self->ss_peers     = default_peers;
-    self->ss_subgroups = default_subgroups;
-    self->ss_housekeys = default_housekeys;
-    self->ss_oneset    = default_oneset;
-
-    Py_INCREF(self->ss_grconfig);
-    Py_INCREF(self->ss_peers);
-    Py_INCREF(self->ss_subgroups);
-    Py_INCREF(self->ss_housekeys);
-    Py_INCREF(self->ss_oneset);
-
-    return 0;
-
-fail:
-    Py_XDECREF(peers);
-    Py_XDECREF(subgroups);
-    Py_XDECREF(housekeys);
-    Py_XDECREF(oneset);
-    return -1;
+    mask &= TERMS;
+    self->ch_masks[i] = mask;
+    if (mask)
+        CM_SET(self->ch_cells, i);
+    else
+        CM_CLEAR(self->ch_cells, i);
 }
 
-/* init cell_info structs */
+/* Merge one key and CandidateSet of a change mapping into self. */
 static int
-set_defaults(cell_info *grid)
+changeset_merge_item(ChangeSetObject *self, PyObject *key, PyObject *value,
+    const char *name)
 {
     Py_ssize_t i;
 
-    for (i = 0; i < GRIDSIZE; i++) {
-       /* grid[i].ci_id = i;*/
-        grid[i].ci_value = ERRORBIT;
-        grid[i].ci_candidates = 0;
+    if (!CandidateSet_Check(value)) {
+        PyErr_Format(PyExc_TypeError,
+            "%s: Expected values to be "
+            "CandidateSets, not '%.100s'", name, Py_TYPE(value)->tp_name);
+        return -1;
     }
-
+    {
+        UNPACK_KEY(key, return -1, name);
+        i = INDEX(x, y);
+    }
+    changeset_put(self, i,
+        self->ch_masks[i] | ((CandidateSetObject *)value)->cs_set);
     return 0;
 }
 
-/* Set location of the group in the houses array for each cell.
- * Also set the pointer to the keyset in the house_info struct
- * for each group.
+/* True if o can be merged into a ChangeSet: a ChangeSet, a dict, or like
+ * dict.update, anything with a keys method.
  */
 static int
-set_groups_in_cells(cell_info *grid, house_info *houses, PyObject *grconfig)
+changeset_mergeable(PyObject *o)
 {
-    Py_ssize_t found = 0, i, j, k;
-    PyObject *found_vals[NUMROWS];
-    PyObject *key, *value;
-    int seen;
+    return ChangeSet_Check(o) || PyDict_Check(o) ||
+        PyObject_HasAttrString(o, "keys");
+}
 
-    for (i = 0; i < NUMROWS; i++) {
-        for (j = 0; j < NUMROWS; j++) {
-            key = Py_BuildValue("(nn)", i, j);
-            if (!key)
-                return -1;
-            value = PyDict_GetItem(grconfig, key);
-            if (!value) {
-                if (!PyErr_Occurred())
-                    _PyErr_SetKeyError(key);
-                Py_DECREF(key);
+/* Merge change into self. change is a ChangeSet, or a mapping from keys
+ * to CandidateSets.
+ */
+static int
+changeset_merge(ChangeSetObject *self, PyObject *change, const char *name)
+{
+    _Py_IDENTIFIER(keys);
+    PyObject *key, *value, *keys, *iter;
+    Py_ssize_t i, pos = 0;
+
+    if (ChangeSet_Check(change)) {
+        ChangeSetObject *other = (ChangeSetObject *)change;
+
+        for (i = 0; i < GRIDSIZE; i++)
+            self->ch_masks[i] |= other->ch_masks[i];
+        self->ch_cells.cm_bits[0] |= other->ch_cells.cm_bits[0];
+        self->ch_cells.cm_bits[1] |= other->ch_cells.cm_bits[1];
+        return 0;
+    }
+
+    if (PyDict_Check(change)) {
+        while (PyDict_Next(change, &pos, &key, &value)) {
+            if (changeset_merge_item(self, key, value, name) < 0)
                 return -1;
-            }
-            seen = 0;
-            for (k = 0; k < found; k++) {
-                if (value == found_vals[k]) {
-                    seen = 1;
-                    break;
-                }
-            }
-            grid[INDEX(i,j)].ci_group = k + GROFFSET;
-            if (!seen)
-                found_vals[found++] = value;
+        }
+        return 0;
+    }
+
+    if (!changeset_mergeable(change)) {
+        PyErr_Format(PyExc_TypeError,
+            "%s: Expected mapping or ChangeSet, not '%.100s'",
+            name, Py_TYPE(change)->tp_name);
+        return -1;
+    }
+    keys = _PyObject_CallMethodId(change, &PyId_keys, NULL);
+    if (!keys)
+        return -1;
+    iter = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    if (!iter)
+        return -1;
+    while ((key = PyIter_Next(iter))) {
+        value = PyObject_GetItem(change, key);
+        if (!value || changeset_merge_item(self, key, value, name) < 0) {
+            Py_XDECREF(value);
             Py_DECREF(key);
+            Py_DECREF(iter);
+            return -1;
         }
+        Py_DECREF(value);
+        Py_DECREF(key);
     }
+    Py_DECREF(iter);
+    return PyErr_Occurred() ? -1 : 0;
+}
 
-    for (i = 0; i < NUMROWS; i++) {
-        houses[i+GROFFSET].hi_keyset = found_vals[i];
+/* New ChangeSet reference for o, which is a ChangeSet or a change mapping
+ * as taken by update. Returns NULL without an exception set if o isn't a
+ * mapping at all, so the operators can return NotImplemented.
+ */
+static ChangeSetObject *
+changeset_coerce(PyObject *o, const char *name)
+{
+    ChangeSetObject *result;
+
+    if (ChangeSet_Check(o)) {
+        Py_INCREF(o);
+        return (ChangeSetObject *)o;
     }
+    if (!changeset_mergeable(o))
+        return NULL;
+    result = changeset_new();
+    if (result && changeset_merge(result, o, name) < 0)
+        Py_CLEAR(result);
+    return result;
+}
 
-    return 0;
+/* Cell index for key, or -1 if key isn't a key of the grid. This accepts
+ * the same keys as UNPACK_KEY, but never sets an exception.
+ */
+static Py_ssize_t
+key_lookup(PyObject *key)
+{
+    PyObject *_x, *_y;
+    Py_ssize_t x, y;
+
+    if (PyLong_CheckExact(key)) {
+        x = PyLong_AsSsize_t(key);
+        if (x == -1 && PyErr_Occurred()) {
+            PyErr_Clear();
+            return -1;
+        }
+        return x >= 0 && x < GRIDSIZE ? x : -1;
+    }
+    if (!PyTuple_Check(key) || PyTuple_GET_SIZE(key) != 2)
+        return -1;
+    _x = PyTuple_GET_ITEM(key, 0);
+    _y = PyTuple_GET_ITEM(key, 1);
+    x = digit_index(_x);
+    y = digit_index(_y);
+    if (x < 0 || y < 0) {
+        if (!PyLong_Check(_x) || !PyLong_Check(_y))
+            return -1;
+        x = PyLong_AsSsize_t(_x);
+        y = PyLong_AsSsize_t(_y);
+        if (PyErr_Occurred()) {
+            PyErr_Clear();
+            return -1;
+        }
+        if (x < 0 || x >= NUMROWS || y < 0 || y >= NUMROWS)
+            return -1;
+    }
+    return INDEX(x, y);
 }
 
-/* utility functions to incref or decref hi_solved for a given cell. */
-static void
-house_adjust_solved_up(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y)
+PyDoc_STRVAR(data_ChangeSet___new___doc,
+"ChangeSet(change=None, /)\n"
+"--\n"
+"\n"
+"Maps keys to CandidateSets of candidates to remove or add.\n"
+"\n"
+"A ChangeSet can be passed anywhere a change dict is accepted. The\n"
+"optional argument is a mapping from keys to CandidateSets, or another\n"
+"ChangeSet, to copy. Keys that map to empty sets are left out. The\n"
+"operators | and & give the union and intersection of two ChangeSets,\n"
+"cell by cell; either side may also be a mapping, which is converted as\n"
+"update does. A ChangeSet equals a mapping that converts to it.");
+
+static PyObject *
+data_ChangeSet___new__(PyTypeObject *cls, PyObject *args, PyObject *kwargs)
 {
-    self->ss_houses[x+ROWOFFSET].hi_solved++;
-    self->ss_houses[y+COLOFFSET].hi_solved++;
-    CELL_GROUP(self, x, y).hi_solved++;
+    ChangeSetObject *self;
+    PyObject *change = Py_None;
+
+    if (!_PyArg_NoKeywords("ChangeSet", kwargs))
+        return NULL;
+    if (!PyArg_UnpackTuple(args, "ChangeSet", 0, 1, &change))
+        return NULL;
+
+    self = changeset_new();
+    if (self && change != Py_None &&
+        changeset_merge(self, change, "ChangeSet") < 0)
+        Py_CLEAR(self);
+    return (PyObject *)self;
 }
 
-static void
-house_adjust_solved_down(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y)
+/* A dict from the keys of a ChangeSet to their CandidateSets */
+static PyObject *
+changeset_dict(ChangeSetObject *self)
 {
-    self->ss_houses[x+ROWOFFSET].hi_solved--;
-    self->ss_houses[y+COLOFFSET].hi_solved--;
-    CELL_GROUP(self, x, y).hi_solved--;
+    PyObject *dict, *value;
+    Py_ssize_t i = 0;
+
+    dict = PyDict_New();
+    if (!dict)
+        return NULL;
+    while ((i = cm_next(&self->ch_cells, i)) >= 0) {
+        value = isets[self->ch_masks[i]];
+        if (PyDict_SetItem(dict, ikeys[i], value) < 0) {
+            Py_DECREF(dict);
+            return NULL;
+        }
+        i++;
+    }
+    return dict;
 }
 
-/* similar functions for cand_count, but do adjustment for each item in the set */
+static PyObject *
+data_ChangeSet___repr__(ChangeSetObject *self)
+{
+    PyObject *dict, *result;
 
-static void
-house_adjust_cand_count_up(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y, uint16_t set)
+    dict = changeset_dict(self);
+    if (!dict)
+        return NULL;
+    result = PyUnicode_FromFormat("ChangeSet(%R)", dict);
+    Py_DECREF(dict);
+    return result;
+}
+
+static Py_ssize_t
+data_ChangeSet_length(ChangeSetObject *self)
+{
+    return cm_count(&self->ch_cells);
+}
+
+static PyObject *
+data_ChangeSet_subscript(ChangeSetObject *self, PyObject *key)
 {
     Py_ssize_t i;
 
-    for (i = 0; i < NUMROWS; i++) {
-        if (set & (1 << i)) {
-            self->ss_houses[x+ROWOFFSET].hi_cand_count[i]++;
-            self->ss_houses[y+COLOFFSET].hi_cand_count[i]++;
-            CELL_GROUP(self, x, y).hi_cand_count[i]++;
-        }
+    {
+        UNPACK_KEY(key, return NULL, "__getitem__");
+        i = INDEX(x, y);
     }
+    if (!self->ch_masks[i]) {
+        _PyErr_SetKeyError(key);
+        return NULL;
+    }
+    return build_set(self->ch_masks[i]);
 }
 
-static void
-house_adjust_cand_count_down(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y, uint16_t set)
+static int
+data_ChangeSet_ass_sub(ChangeSetObject *self, PyObject *key, PyObject *value)
 {
+    const char *name = value ? "__setitem__" : "__delitem__";
     Py_ssize_t i;
 
-    for (i = 0; i < NUMROWS; i++) {
-        if (set & (1 << i)) {
-            self->ss_houses[x+ROWOFFSET].hi_cand_count[i]--;
-            self->ss_houses[y+COLOFFSET].hi_cand_count[i]--;
-            CELL_GROUP(self, x, y).hi_cand_count[i]--;
+    if (value && !CandidateSet_Check(value)) {
+        PyErr_Format(PyExc_TypeError,
+            "__setitem__: Expected CandidateSet, not '%.100s'",
+            Py_TYPE(value)->tp_name);
+        return -1;
+    }
+    {
+        UNPACK_KEY(key, return -1, name);
+        i = INDEX(x, y);
+    }
+    if (!value) {
+        if (!self->ch_masks[i]) {
+            _PyErr_SetKeyError(key);
+            return -1;
         }
+        changeset_put(self, i, 0);
+    } else {
+        changeset_put(self, i, ((CandidateSetObject *)value)->cs_set);
     }
+    return 0;
 }
 
-/* fill in pencil marks based on the clues in the grid */
+static PyMappingMethods ChangeSet_as_mapping = {
+    (lenfunc)data_ChangeSet_length,         /*mp_length*/
+    (binaryfunc)data_ChangeSet_subscript,   /*mp_subscript*/
+    (objobjargproc)data_ChangeSet_ass_sub,  /*mp_ass_subscript*/
+};
+
 static int
-fill_in_pencilmarks(SudokuStateObject *self)
+data_ChangeSet_contains(ChangeSetObject *self, PyObject *key)
 {
-    Py_ssize_t n, m, z;
-    PyObject *key, *value;
+    Py_ssize_t i = key_lookup(key);
+
+    return i >= 0 && self->ch_masks[i] != 0;
+}
 
-    for (n = 0; n < NUMROWS*3; n++)
-        memset(self->ss_houses[n].hi_cand_count, 0, sizeof(Py_ssize_t));
+static PySequenceMethods ChangeSet_as_sequence = {
+    0,                                  /* sq_length */
+    0,                                  /* sq_concat */
+    0,                                  /* sq_repeat */
+    0,                                  /* sq_item */
+    0,                                  /* sq_slice */
+    0,                                  /* sq_ass_item */
+    0,                                  /* sq_ass_slice */
+    (objobjproc)data_ChangeSet_contains,/* sq_contains */
+    0,                                  /* sq_inplace_concat */
+    0,                                  /* sq_inplace_repeat */
+};
 
-    for (n = 0; n < NUMROWS; n++) {
-        for (m = 0; m < NUMROWS; m++) {
-            uint16_t notcandidates = 0, q;
-            PyObject *keyset;
+/* Convert both operands with changeset_coerce, either of which may be the
+ * change mapping. Evaluates to NotImplemented if one isn't a mapping, or
+ * NULL on error.
+ */
+#define COERCE_CHANGESETS(v, w, cv, cw, name)               \
+    do {                                                    \
+        cv = changeset_coerce(v, name);                     \
+        if (!cv) {                                          \
+            if (PyErr_Occurred())                           \
+                return NULL;                                \
+            Py_RETURN_NOTIMPLEMENTED;                       \
+        }                                                   \
+        cw = changeset_coerce(w, name);                     \
+        if (!cw) {                                          \
+            Py_DECREF(cv);                                  \
+            if (PyErr_Occurred())                           \
+                return NULL;                                \
+            Py_RETURN_NOTIMPLEMENTED;                       \
+        }                                                   \
+    } while (0)
 
-            if (CELL_FILLED(self->ss_grid, n, m))
-                continue;
+static PyObject *
+ch_num_or(PyObject *v, PyObject *w)
+{
+    ChangeSetObject *a, *b, *result;
+
+    COERCE_CHANGESETS(v, w, a, b, "__or__");
+    result = changeset_new();
+    if (result) {
+        memcpy(result->ch_masks, a->ch_masks, sizeof(a->ch_masks));
+        result->ch_cells = a->ch_cells;
+        changeset_merge(result, (PyObject *)b, "__or__");
+    }
+    Py_DECREF(a);
+    Py_DECREF(b);
+    return (PyObject *)result;
+}
 
-            /* look at peers in row */
-            for (z = 0; z < NUMROWS; z++) {
-                if (z == m || !CELL_FILLED(self->ss_grid, n, z))
-                    continue;
-                SET_BIT(notcandidates, CELL_VALUE(self->ss_grid, n, z));
-            }
+static PyObject *
+ch_num_and(PyObject *v, PyObject *w)
+{
+    ChangeSetObject *a, *b, *result;
+    Py_ssize_t i;
 
-            /* look at peers in column */
-            for (z = 0; z < NUMROWS; z++) {
-                if (z == n || !CELL_FILLED(self->ss_grid, z, m))
-                    continue;
-                SET_BIT(notcandidates, CELL_VALUE(self->ss_grid, z, m));
-            }
+    COERCE_CHANGESETS(v, w, a, b, "__and__");
+    result = changeset_new();
+    if (result) {
+        for (i = 0; i < GRIDSIZE; i++)
+            changeset_put(result, i, a->ch_masks[i] & b->ch_masks[i]);
+    }
+    Py_DECREF(a);
+    Py_DECREF(b);
+    return (PyObject *)result;
+}
 
-            /* look at peers in the current group */
-            key = Py_BuildValue("(nn)", n, m);
-            if (!key)
-                return -1;
-            value = PyDict_GetItem(self->ss_peers, key);
-            if (!value) {
-                if (!PyErr_Occurred())
-                    _PyErr_SetKeyError(key);
-                Py_DECREF(key);
-                return -1;
-            }
-            keyset = PyTuple_GetItem(value, 0);
-            if (!keyset) {
-                Py_DECREF(key);
-                return -1;
-            }
+static PyObject *
+ch_num_inplace_or(PyObject *v, PyObject *w)
+{
+    ChangeSetObject *a, *b;
+
+    if (!ChangeSet_Check(v))
+        Py_RETURN_NOTIMPLEMENTED;
+    COERCE_CHANGESETS(v, w, a, b, "__ior__");
+    changeset_merge(a, (PyObject *)b, "__ior__");
+    Py_DECREF(b);
+    return (PyObject *)a;
+}
 
-            q = find_clues_in_keyset(self->ss_grid, keyset);
-            if (q & ERRORBIT) {
-                Py_DECREF(key);
-                return -1;
-            }
-            notcandidates |= q;
+static PyObject *
+ch_num_inplace_and(PyObject *v, PyObject *w)
+{
+    ChangeSetObject *a, *b;
+    Py_ssize_t i;
 
-            CELL_CANDS(self->ss_grid, n, m) = (~notcandidates) & TERMS;
+    if (!ChangeSet_Check(v))
+        Py_RETURN_NOTIMPLEMENTED;
+    COERCE_CHANGESETS(v, w, a, b, "__iand__");
+    for (i = 0; i < GRIDSIZE; i++)
+        changeset_put(a, i, a->ch_masks[i] & b->ch_masks[i]);
+    Py_DECREF(b);
+    return (PyObject *)a;
+}
 
-            /* adjust houses */
-            house_adjust_cand_count_up(self, n, m, CELL_CANDS(self->ss_grid, n, m));
-            Py_DECREF(key);
-        }
-    }
+static int
+ch_num_bool(ChangeSetObject *a)
+{
+    return (a->ch_cells.cm_bits[0] | a->ch_cells.cm_bits[1]) != 0;
+}
 
-    return 0;
+static PyNumberMethods ChangeSet_as_number = {
+    0,                                  /* nb_add */
+    0,                                  /* nb_subtract */
+    0,                                  /* nb_multiply */
+    0,                                  /* nb_remainder */
+    0,                                  /* nb_divmod */
+    0,                                  /* nb_power */
+    0,                                  /* nb_negative */
+    0,                                  /* nb_positive */
+    0,                                  /* nb_absolute */
+    (inquiry)ch_num_bool,               /* nb_bool */
+    0,                                  /* nb_invert */
+    0,                                  /* nb_lshift */
+    0,                                  /* nb_rshift */
+    (binaryfunc)ch_num_and,             /* nb_and */
+    0,                                  /* nb_xor */
+    (binaryfunc)ch_num_or,              /* nb_or */
+    0,                                  /* nb_int */
+    0,                                  /* nb_reserved */
+    0,                                  /* nb_float */
+    0,                                  /* nb_inplace_add */
+    0,                                  /* nb_inplace_subtract */
+    0,                                  /* nb_inplace_multiply */
+    0,                                  /* nb_inplace_remainder */
+    0,                                  /* nb_inplace_power */
+    0,                                  /* nb_inplace_lshift */
+    0,                                  /* nb_inplace_rshift */
+    (binaryfunc)ch_num_inplace_and,     /* nb_inplace_and */
+    0,                                  /* nb_inplace_xor */
+    (binaryfunc)ch_num_inplace_or,      /* nb_inplace_or */
+};
+
+/* A ChangeSet compares equal to a change mapping that update would turn
+ * into the same ChangeSet. A mapping that update would reject is unequal.
+ */
+static PyObject *
+data_ChangeSet_richcompare(ChangeSetObject *a, PyObject *other, int op)
+{
+    ChangeSetObject *b;
+    int equal;
+
+    if (op != Py_EQ && op != Py_NE)
+        Py_RETURN_NOTIMPLEMENTED;
+    b = changeset_coerce(other, "__eq__");
+    if (!b) {
+        if (!PyErr_Occurred())
+            Py_RETURN_NOTIMPLEMENTED;
+        if (!PyErr_ExceptionMatches(PyExc_TypeError) &&
+            !PyErr_ExceptionMatches(PyExc_LookupError))
+            return NULL;
+        PyErr_Clear();
+        equal = 0;
+    } else {
+        equal = !memcmp(a->ch_masks, b->ch_masks, sizeof(a->ch_masks));
+        Py_DECREF(b);
+    }
+    if (equal == (op == Py_EQ))
+        Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
 }
 
-/*[clinic input]
-data.State.__init__
+/* Keys are yielded in cell index order */
+static PyObject *
+data_ChangeSet_iter(ChangeSetObject *self)
+{
+    PyObject *keys, *iter;
+    Py_ssize_t i = 0, n = 0;
 
-    clues: object
-        A dictionary that maps positions in the sudoku grid to numbers
-        in range(9).
+    keys = PyTuple_New(cm_count(&self->ch_cells));
+    if (!keys)
+        return NULL;
+    while ((i = cm_next(&self->ch_cells, i)) >= 0) {
+        Py_INCREF(ikeys[i]);
+        PyTuple_SET_ITEM(keys, n++, ikeys[i]);
+        i++;
+    }
+    iter = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iter;
+}
 
-    dofill: bool = True
-        If true, then fill in pencilmarks. If false, then each candidate set
-        will be empty.
+/*[clinic input]
+@classmethod
+data.ChangeSet.fromkeys
 
-    grconfig: object = NULL
-        A dictionary that maps each cell to a list of keys. If None, a default
-        value is used.
+    keys: object
+        An iterable of keys.
+    cands: object
+        A CandidateSet.
+    /
 
-This is the representation of the information in a sudoku puzzle.
+Make a ChangeSet that maps every key in keys to cands.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_State___init____doc__,
-"State(clues, dofill=True, grconfig=None)\n"
+PyDoc_STRVAR(data_ChangeSet_fromkeys__doc__,
+"fromkeys($type, keys, cands, /)\n"
 "--\n"
 "\n"
-"This is the representation of the information in a sudoku puzzle.\n"
+"Make a ChangeSet that maps every key in keys to cands.\n"
 "\n"
-"  clues\n"
-"    A dictionary that maps positions in the sudoku grid to numbers\n"
-"    in range(9).\n"
-"  dofill\n"
-"    If true, then fill in pencilmarks. If false, then each candidate set\n"
-"    will be empty.\n"
-"  grconfig\n"
-"    A dictionary that maps each cell to a list of keys. If None, a default\n"
-"    value is used.");
+"  keys\n"
+"    An iterable of keys.\n"
+"  cands\n"
+"    A CandidateSet.");
 
-static int
-data_State___init___impl(SudokuStateObject *self, PyObject *clues, int dofill, PyObject *grconfig);
+#define DATA_CHANGESET_FROMKEYS_METHODDEF    \
+    {"fromkeys", (PyCFunction)data_ChangeSet_fromkeys, METH_VARARGS|METH_CLASS, data_ChangeSet_fromkeys__doc__},
 
-static int
-data_State___init__(PyObject *self, PyObject *args, PyObject *kwargs)
+static PyObject *
+data_ChangeSet_fromkeys_impl(PyTypeObject *type, PyObject *keys, PyObject *cands);
+
+static PyObject *
+data_ChangeSet_fromkeys(PyTypeObject *type, PyObject *args)
 {
-    int return_value = -1;
-    static char *_keywords[] = {"clues", "dofill", "grconfig", NULL};
-    PyObject *clues;
-    int dofill = 1;
-    PyObject *grconfig = NULL;
+    PyObject *return_value = NULL;
+    PyObject *keys;
+    PyObject *cands;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
-        "O|pO:State", _keywords,
-        &clues, &dofill, &grconfig))
+    if (!PyArg_UnpackTuple(args, "fromkeys",
+        2, 2,
+        &keys, &cands))
         goto exit;
-    return_value = data_State___init___impl((SudokuStateObject *)self, clues, dofill, grconfig);
+    return_value = data_ChangeSet_fromkeys_impl(type, keys, cands);
 
 exit:
     return return_value;
 }
 
-static int
-data_State___init___impl(SudokuStateObject *self, PyObject *clues, int dofill, PyObject *grconfig)
-/*[clinic end generated code: output=cb6333ae454ac383 input=6f62a2a9cc95d39e]*/
+static PyObject *
+data_ChangeSet_fromkeys_impl(PyTypeObject *type, PyObject *keys, PyObject *cands)
+/*[clinic end generated code: output=3d5a3e1e833e776b input=41be5cecc996ee18]*/
 {
-    Py_ssize_t i = 0, cl;
-    PyObject *key, *value;
-
-    /* Since __init__ can be used to reset an object, we explicitly zero
-     * out all fields, except for dynamic attributes and weak references,
-     * which are left alone.
-     */
-    Py_CLEAR(self->ss_grconfig);
-    Py_CLEAR(self->ss_peers);
-    Py_CLEAR(self->ss_subgroups);
-    Py_CLEAR(self->ss_movehook);
-    Py_CLEAR(self->ss_skeys);
-    self->ss_solved = 0;
-    if (set_defaults(self->ss_grid) < 0)
-        return -1;
-    memset(self->ss_houses, 0, sizeof(house_info)*NUMROWS*3);
+    ChangeSetObject *self;
+    PyObject *key, *iter;
+    uint16_t mask;
 
-    /* Set various attributes */
-    if (set_python_calculated_attrs(self, grconfig) < 0)
-        return -1;
-    if ((self->ss_skeys = PySet_New(NULL)) == NULL)
-        return -1;
-    if (set_groups_in_cells(self->ss_grid, self->ss_houses, self->ss_grconfig) < 0)
-        return -1;
+    if (!CandidateSet_Check(cands)) {
+        PyErr_Format(PyExc_TypeError,
+            "fromkeys: Expected CandidateSet, not '%.100s'",
+            Py_TYPE(cands)->tp_name);
+        return NULL;
+    }
+    mask = ((CandidateSetObject *)cands)->cs_set;
 
-    /* Put givens in the grid */
-    while (PyDict_Next(clues, &i, &key, &value)) {
-        cl = PyLong_AsSsize_t(value);
-        if (cl < 0 || cl > NUMROWS) {
-            if (!PyErr_Occurred())
-                PyErr_Format(PyExc_ValueError,
-                    "__init__: Expected values from 0-%d, saw %d",
-                    NUMROWS, cl);
-            return -1;
-        }
-
-        if (PySet_Add(self->ss_skeys, key) < 0)
-            return -1;
-        UNPACK_KEY(key, return -1, "__init__");
-        CELL_VALUE(self->ss_grid, x, y) = cl;
-
-        /* Adjust houses */
-        house_adjust_solved_up(self, x, y);
-
-        /* Record clue number */
-        self->ss_digits[cl]++;
+    iter = PyObject_GetIter(keys);
+    if (!iter)
+        return NULL;
+    self = changeset_new();
+    if (!self)
+        goto done;
+    while ((key = PyIter_Next(iter))) {
+        UNPACK_KEY(key, Py_DECREF(key); Py_CLEAR(self); goto done, "fromkeys");
+        Py_DECREF(key);
+        changeset_put(self, INDEX(x, y), mask);
     }
+    if (PyErr_Occurred())
+        Py_CLEAR(self);
 
-    /* Note the number of solved cells */
-    if ((self->ss_solved = PyDict_Size(clues)) < 0)
-        return -1;
-
-    /* Calculate the candidates for the remaining positions */
-    if (dofill && fill_in_pencilmarks(self) < 0)
-        return -1;
-
-    return 0;
+done:
+    Py_DECREF(iter);
+    return (PyObject *)self;
 }
 
-/* State methods */
-
 /*[clinic input]
-data.State.candidate_in_keyset
-
-    cand: Py_ssize_t
-        Candidate to be searched for.
+data.ChangeSet.update
 
-    keyset: object
-        Set of keys to search for candidate in.
+    change: object
     /
 
-Search through a keyset for a particular candidate.
-
-Return a tuple containing each key where the candidate was found.
+Merge a ChangeSet or a mapping from keys to CandidateSets into this one.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_State_candidate_in_keyset__doc__,
-"candidate_in_keyset($self, cand, keyset, /)\n"
+PyDoc_STRVAR(data_ChangeSet_update__doc__,
+"update($self, change, /)\n"
 "--\n"
 "\n"
-"Search through a keyset for a particular candidate.\n"
-"\n"
-"  cand\n"
-"    Candidate to be searched for.\n"
-"  keyset\n"
-"    Set of keys to search for candidate in.\n"
-"\n"
-"Return a tuple containing each key where the candidate was found.");
-
-#define DATA_STATE_CANDIDATE_IN_KEYSET_METHODDEF    \
-    {"candidate_in_keyset", (PyCFunction)data_State_candidate_in_keyset, METH_VARARGS, data_State_candidate_in_keyset__doc__},
+"Merge a ChangeSet or a mapping from keys to CandidateSets into this one.");
 
-static PyObject *
-data_State_candidate_in_keyset_impl(SudokuStateObject *self, Py_ssize_t cand, PyObject *keyset);
+#define DATA_CHANGESET_UPDATE_METHODDEF    \
+    {"update", (PyCFunction)data_ChangeSet_update, METH_O, data_ChangeSet_update__doc__},
 
 static PyObject *
-data_State_candidate_in_keyset(SudokuStateObject *self, PyObject *args)
+data_ChangeSet_update(ChangeSetObject *self, PyObject *change)
+/*[clinic end generated code: output=c2bd292462da0792 input=64d878bba6d53249]*/
 {
-    PyObject *return_value = NULL;
-    Py_ssize_t cand;
-    PyObject *keyset;
-
-    if (!PyArg_ParseTuple(args,
-        "nO:candidate_in_keyset",
-        &cand, &keyset))
-        goto exit;
-    return_value = data_State_candidate_in_keyset_impl(self, cand, keyset);
-
-exit:
-    return return_value;
+    if (changeset_merge(self, change, "update") < 0)
+        return NULL;
+    Py_RETURN_NONE;
 }
 
-static PyObject *
-data_State_candidate_in_keyset_impl(SudokuStateObject *self, Py_ssize_t cand, PyObject *keyset)
-/*[clinic end generated code: output=50ecdfeee9d24908 input=d9314af58c8b337c]*/
-{
-    PyObject *temp_storage[GRIDSIZE];
-    Py_ssize_t found = 0, i;
-    PyObject *key, *found_keys = NULL, *iter;
+/*[clinic input]
+data.ChangeSet.getdict
 
-    iter = PyObject_GetIter(keyset);
-    if (!iter)
-        return NULL;
+Get a dictionary that maps the keys to CandidateSets.
+[clinic start generated code]*/
 
-    while ((key = PyIter_Next(iter))) {
-        UNPACK_KEY(key, goto done, "candidate_in_keyset");
+PyDoc_STRVAR(data_ChangeSet_getdict__doc__,
+"getdict($self, /)\n"
+"--\n"
+"\n"
+"Get a dictionary that maps the keys to CandidateSets.");
 
-        if (!CELL_FILLED(self->ss_grid, x, y)) {
-            if (CELL_CANDS(self->ss_grid, x, y) & (1 << cand)) {
-                temp_storage[found++] = key;
-            }
-        }
-    }
-    if (PyErr_Occurred())
-        goto done;
+#define DATA_CHANGESET_GETDICT_METHODDEF    \
+    {"getdict", (PyCFunction)data_ChangeSet_getdict, METH_NOARGS, data_ChangeSet_getdict__doc__},
 
-    found_keys = PyTuple_New(found);
-    if (!found_keys)
-        goto done;
+static PyObject *
+data_ChangeSet_getdict_impl(ChangeSetObject *self);
 
-    for (i = 0; i < found; i++) {
-        key = temp_storage[i];
-        Py_INCREF(key);
-        PyTuple_SET_ITEM(found_keys, i, key);
-    }
+static PyObject *
+data_ChangeSet_getdict(ChangeSetObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_ChangeSet_getdict_impl(self);
+}
 
-done:
-    Py_DECREF(iter);
-    return found_keys;
+static PyObject *
+data_ChangeSet_getdict_impl(ChangeSetObject *self)
+/*[clinic end generated code: output=41925bb06598cf41 input=f64adda628ef8dee]*/
+{
+    return changeset_dict(self);
 }
 
 /*[clinic input]
-data.State.candidates_from_keyset
-
-    keyset: object
-        Set of keys to search for candidates.
-    /
-
-Get all candidates from a keyset.
+data.ChangeSet.__reduce__
 
-Return the union of each candidate set for each of unsolved key in the
-keyset. Ignore solved positions.
+Pickle a ChangeSet as its dictionary.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_State_candidates_from_keyset__doc__,
-"candidates_from_keyset($self, keyset, /)\n"
+PyDoc_STRVAR(data_ChangeSet___reduce____doc__,
+"__reduce__($self, /)\n"
 "--\n"
 "\n"
-"Get all candidates from a keyset.\n"
-"\n"
-"  keyset\n"
-"    Set of keys to search for candidates.\n"
-"\n"
-"Return the union of each candidate set for each of unsolved key in the\n"
-"keyset. Ignore solved positions.");
+"Pickle a ChangeSet as its dictionary.");
 
-#define DATA_STATE_CANDIDATES_FROM_KEYSET_METHODDEF    \
-    {"candidates_from_keyset", (PyCFunction)data_State_candidates_from_keyset, METH_O, data_State_candidates_from_keyset__doc__},
+#define DATA_CHANGESET___REDUCE___METHODDEF    \
+    {"__reduce__", (PyCFunction)data_ChangeSet___reduce__, METH_NOARGS, data_ChangeSet___reduce____doc__},
 
 static PyObject *
-data_State_candidates_from_keyset(SudokuStateObject *self, PyObject *keyset)
-/*[clinic end generated code: output=2717161bd6408bba input=3017d3ede78897eb]*/
-{
-    uint16_t cands = 0;
-    PyObject *key, *iter;
-
-    iter = PyObject_GetIter(keyset);
-    if (!iter)
-        return NULL;
+data_ChangeSet___reduce___impl(ChangeSetObject *self);
 
-    while ((key = PyIter_Next(iter))) {
-        UNPACK_KEY(key, goto done, "candidates_from_keyset");
+static PyObject *
+data_ChangeSet___reduce__(ChangeSetObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_ChangeSet___reduce___impl(self);
+}
 
-        if (!CELL_FILLED(self->ss_grid, x, y)) {
-            cands |= CELL_CANDS(self->ss_grid, x, y);
-        }
-    }
+static PyObject *
+data_ChangeSet___reduce___impl(ChangeSetObject *self)
+/*[clinic end generated code: output=36f1b3cb287bdf41 input=f7e99699d5708714]*/
+{
+    PyObject *dict, *result;
 
-done:
-    Py_DECREF(iter);
-    if (PyErr_Occurred())
+    dict = changeset_dict(self);
+    if (!dict)
         return NULL;
-    return build_set(cands);
+    result = Py_BuildValue("O(N)", (PyObject *)Py_TYPE(self), dict);
+    return result;
 }
 
-/*[clinic input]
-data.State.add_candidates
-
-    change: object
-        Dict that maps keys (tuples) to CandidateSet objects. Each
-        CandidateSet represents the candidates to be added to its
-        key.
-    /
-
-Add candidates to a collection of candidate sets.
-
-Note that if this method ends up raising a KeyError, the grid will be in
-disarray, so be careful that only unsolved keys are in the change
-dictionary.
-[clinic start generated code]*/
+static PyMethodDef ChangeSet_methods[] = {
+    DATA_CHANGESET_FROMKEYS_METHODDEF
+    DATA_CHANGESET_UPDATE_METHODDEF
+    DATA_CHANGESET_GETDICT_METHODDEF
+    DATA_CHANGESET___REDUCE___METHODDEF
+    {NULL}  /* sentinel */
+};
 
-PyDoc_STRVAR(data_State_add_candidates__doc__,
-"add_candidates($self, change, /)\n"
-"--\n"
-"\n"
-"Add candidates to a collection of candidate sets.\n"
-"\n"
-"  change\n"
-"    Dict that maps keys (tuples) to CandidateSet objects. Each\n"
-"    CandidateSet represents the candidates to be added to its\n"
-"    key.\n"
-"\n"
-"Note that if this method ends up raising a KeyError, the grid will be in\n"
-"disarray, so be careful that only unsolved keys are in the change\n"
-"dictionary.");
+static PyTypeObject ChangeSet_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "sudoku.data.ChangeSet",    /*tp_name*/
+    sizeof(ChangeSetObject),    /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)PyObject_Del,   /*tp_dealloc*/
+    0,                          /*tp_print*/
+    0,                          /*tp_getattr*/
+    0,                          /*tp_setattr*/
+    0,                          /*tp_reserved*/
+    (reprfunc)data_ChangeSet___repr__,/*tp_repr*/
+    &ChangeSet_as_number,       /*tp_as_number*/
+    &ChangeSet_as_sequence,     /*tp_as_sequence*/
+    &ChangeSet_as_mapping,      /*tp_as_mapping*/
+    PyObject_HashNotImplemented,/*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    0,                          /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    data_ChangeSet___new___doc, /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    (richcmpfunc)data_ChangeSet_richcompare,/*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    (getiterfunc)data_ChangeSet_iter,/*tp_iter*/
+    0,                          /*tp_iternext*/
+    ChangeSet_methods,          /*tp_methods*/
+    0,                          /*tp_members*/
+    0,                          /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    data_ChangeSet___new__,     /*tp_new*/
+    PyObject_Del,               /*tp_free*/
+    0,                          /*tp_is_gc*/
+};
 
-#define DATA_STATE_ADD_CANDIDATES_METHODDEF    \
-    {"add_candidates", (PyCFunction)data_State_add_candidates, METH_O, data_State_add_candidates__doc__},
+/* A cell has 20 peers with the default groups, and up to 24 with irregular
+ * groups that only meet the cell's row and column at the cell itself.
+ */
+#define MAXPEERS 24
 
-static PyObject *
-data_State_add_candidates(SudokuStateObject *self, PyObject *change)
-/*[clinic end generated code: output=c3da7bc1cbb2c92a input=ee5ed6b11b9848cb]*/
+/* cell indices for each house, and house and peer indices for each cell */
+typedef struct {
+    uint8_t gl_cells[NUMROWS*3][NUMROWS];   /* indexed the same as ss_houses;
+                                               cells in index order */
+    uint8_t gl_order[NUMROWS*3][NUMROWS];   /* the same cells in the order of
+                                               the State's houses attribute */
+    uint8_t gl_houses[GRIDSIZE][3];         /* group, column, row */
+    uint8_t gl_pos[GRIDSIZE][3];            /* position of the cell in each
+                                               of those houses' gl_order */
+    uint8_t gl_peers[GRIDSIZE][MAXPEERS];   /* other cells that share a house */
+    uint8_t gl_npeers[GRIDSIZE];            /* number of entries in gl_peers */
+} grid_layout;
+
+/* Fill in a layout given the group house of each cell, and optionally the
+ * cells of each group in grconfig list order (a compiled config's key);
+ * without it, groups are ordered by cell index like rows and columns.
+ * Returns -1 without setting an exception if the groups are malformed.
+ */
+static int
+layout_build(grid_layout *layout, const uint8_t *groups, const uint8_t *order)
 {
-    PyObject *key, *value;
-    Py_ssize_t i = 0;
-    uint16_t add_set, old_set, intersection;
+    Py_ssize_t filled[NUMROWS*3];
+    Py_ssize_t i, k, n, h, c, found;
+    uint8_t seen[GRIDSIZE];
 
-    if (!PyDict_Check(change)) {
-        PyErr_Format(PyExc_TypeError,
-            "add_candidates: Expected dict, not '%.100s'",
-            Py_TYPE(change)->tp_name);
-        return NULL;
+    memset(filled, 0, sizeof(Py_ssize_t)*NUMROWS*3);
+    for (i = 0; i < GRIDSIZE; i++) {
+        layout->gl_houses[i][0] = groups[i];
+        layout->gl_houses[i][1] = (uint8_t)(COL(i) + COLOFFSET);
+        layout->gl_houses[i][2] = (uint8_t)(ROW(i) + ROWOFFSET);
+        for (k = 0; k < 3; k++) {
+            h = layout->gl_houses[i][k];
+            if (h >= NUMROWS*3 || filled[h] == NUMROWS)
+                return -1;
+            layout->gl_cells[h][filled[h]++] = (uint8_t)i;
+        }
     }
 
-    while (PyDict_Next(change, &i, &key, &value)) {
-        if (!CandidateSet_Check(value)) {
-            PyErr_Format(PyExc_TypeError,
-                "add_candidates: Expected values to be "
-                "CandidateSets, not '%.100s'", Py_TYPE(value)->tp_name);
-            return NULL;
+    memcpy(layout->gl_order, layout->gl_cells, sizeof(layout->gl_cells));
+    if (order) {
+        for (i = 0; i < GRIDSIZE; i++) {
+            if (groups[order[i]] != i/NUMROWS + GROFFSET)
+                return -1;
+            layout->gl_order[i/NUMROWS + GROFFSET][i%NUMROWS] = order[i];
         }
+    }
+    for (h = 0; h < NUMROWS*3; h++) {
+        k = h < COLOFFSET ? 0 : h < ROWOFFSET ? 1 : 2;
+        for (n = 0; n < NUMROWS; n++)
+            layout->gl_pos[layout->gl_order[h][n]][k] = (uint8_t)n;
+    }
 
-        UNPACK_KEY(key, return NULL, "add_candidates");
-        if (CELL_FILLED(self->ss_grid, x, y)) {
-            _PyErr_SetKeyError(key);
-            return NULL;
-        }
-        add_set = ((CandidateSetObject *)value)->cs_set;
-        old_set = CELL_CANDS(self->ss_grid, x, y);
-        intersection = add_set & old_set;
-        if (intersection) {
-            /* Make sure that we don't mess up house cand counts if we're
-               trying to add candidates that are already there. */
-            house_adjust_cand_count_down(self, x, y, intersection);
+    for (i = 0; i < GRIDSIZE; i++) {
+        memset(seen, 0, GRIDSIZE);
+        seen[i] = 1;
+        found = 0;
+        for (k = 0; k < 3; k++) {
+            for (n = 0; n < NUMROWS; n++) {
+                c = layout->gl_cells[layout->gl_houses[i][k]][n];
+                if (seen[c])
+                    continue;
+                seen[c] = 1;
+                layout->gl_peers[i][found++] = (uint8_t)c;
+            }
         }
-
-        house_adjust_cand_count_up(self, x, y, add_set);
-        CELL_CANDS(self->ss_grid, x, y) |= add_set;
+        layout->gl_npeers[i] = (uint8_t)found;
     }
 
-    Py_RETURN_NONE;
+    return 0;
 }
 
-/*[clinic input]
-data.State.remove_candidates
-
-    change: object
-        Dict that maps keys (tuples) to CandidateSet objects.Each
-        CandidateSet represents the candidates to be removed to its
-        key.
-    /
+/* layout of the default group configuration; set up in PyInit_data */
+static grid_layout default_layout;
 
-Remove candidates from a collection of candidate sets.
+/* House candidate counts are kept as one byte per digit, with each house
+ * padded to 16 bytes so that a house can be updated with a single vector
+ * add. mask_expand[set] has a 1 in byte n for each digit n in set, and is
+ * filled in by PyInit_data.
+ */
+#define COUNTROW 16
+static uint8_t mask_expand[512][COUNTROW];
 
-If a candidate set is left empty after removing the candidates,
-this method raises a ContradictionError. If you want to have the empty
-candidate set as the candidates for a cell, use set_candidates. Note
-that if this raises a ContradictionError, it will have already removed
-the candidates from the grid.
+/* Add or subtract the digits of set to a row of counts. Counts never go
+ * above NUMROWS or below zero, so the SWAR version can't carry or borrow
+ * across bytes.
+ */
+static void
+counts_add(uint8_t *counts, uint16_t set)
+{
+#if defined(__SSE2__)
+    __m128i c = _mm_loadu_si128((const __m128i *)counts);
+    __m128i e = _mm_loadu_si128((const __m128i *)mask_expand[set & TERMS]);
+    _mm_storeu_si128((__m128i *)counts, _mm_add_epi8(c, e));
+#else
+    uint64_t c[2], e[2];
+    memcpy(c, counts, COUNTROW);
+    memcpy(e, mask_expand[set & TERMS], COUNTROW);
+    c[0] += e[0];
+    c[1] += e[1];
+    memcpy(counts, c, COUNTROW);
+#endif
+}
 
-Note that if this method ends up raising a KeyError, the grid will be in
-disarray, so be careful that only unsolved keys are in the change
-dictionary.
-[clinic start generated code]*/
-
-PyDoc_STRVAR(data_State_remove_candidates__doc__,
-"remove_candidates($self, change, /)\n"
-"--\n"
-"\n"
-"Remove candidates from a collection of candidate sets.\n"
-"\n"
-"  change\n"
-"    Dict that maps keys (tuples) to CandidateSet objects.Each\n"
-"    CandidateSet represents the candidates to be removed to its\n"
-"    key.\n"
-"\n"
-"If a candidate set is left empty after removing the candidates,\n"
-"this method raises a ContradictionError. If you want to have the empty\n"
-"candidate set as the candidates for a cell, use set_candidates. Note\n"
-"that if this raises a ContradictionError, it will have already removed\n"
-"the candidates from the grid.\n"
-"\n"
-"Note that if this method ends up raising a KeyError, the grid will be in\n"
-"disarray, so be careful that only unsolved keys are in the change\n"
-"dictionary.");
-
-#define DATA_STATE_REMOVE_CANDIDATES_METHODDEF    \
-    {"remove_candidates", (PyCFunction)data_State_remove_candidates, METH_O, data_State_remove_candidates__doc__},
-
-static PyObject *
-data_State_remove_candidates(SudokuStateObject *self, PyObject *change)
-/*[clinic end generated code: output=d40a24c6f3a4c045 input=01afff6fcf51cde0]*/
+static void
+counts_sub(uint8_t *counts, uint16_t set)
 {
-    PyObject *key, *value;
-    Py_ssize_t i = 0, rx, ry;
-    uint16_t remove_set, old_set, not_subset;
-    int raise = 0;
-
-    if (!PyDict_Check(change)) {
-        PyErr_Format(PyExc_TypeError,
-            "remove_candidates: Expected dict, not '%.100s'",
-            Py_TYPE(change)->tp_name);
-        return NULL;
-    }
-
-    while (PyDict_Next(change, &i, &key, &value)) {
-        if (!CandidateSet_Check(value)) {
-            PyErr_Format(PyExc_TypeError,
-                "remove_candidates: Expected values to be "
-                "CandidateSets, not '%.100s'", Py_TYPE(value)->tp_name);
-            return NULL;
-        }
-
-        UNPACK_KEY(key, return NULL, "remove_candidates");
-        if (CELL_FILLED(self->ss_grid, x, y)) {
-            _PyErr_SetKeyError(key);
-            return NULL;
-        }
-        remove_set = ((CandidateSetObject *)value)->cs_set;
-        old_set = CELL_CANDS(self->ss_grid, x, y);
-        not_subset = remove_set & ~(remove_set & old_set);
-        if (not_subset) {
-            /* Make sure that we don't mess up house cand counts if we're
-               trying to remove candidates that are aren't there. */
-            house_adjust_cand_count_up(self, x, y, not_subset);
-        }
-
-        house_adjust_cand_count_down(self, x, y, remove_set);
-        CELL_CANDS(self->ss_grid, x, y) &= ~remove_set;
-        if (!CELL_CANDS(self->ss_grid, x, y)) {
-            raise = 1;
-            rx = x, ry = y;
-        }
-    }
-
-    if (raise) {
-        PyErr_Format(ContradictionError,
-            "Empty candidate set at (%d, %d)", rx, ry);
-        return NULL;
-    }
-
-    Py_RETURN_NONE;
+#if defined(__SSE2__)
+    __m128i c = _mm_loadu_si128((const __m128i *)counts);
+    __m128i e = _mm_loadu_si128((const __m128i *)mask_expand[set & TERMS]);
+    _mm_storeu_si128((__m128i *)counts, _mm_sub_epi8(c, e));
+#else
+    uint64_t c[2], e[2];
+    memcpy(c, counts, COUNTROW);
+    memcpy(e, mask_expand[set & TERMS], COUNTROW);
+    c[0] -= e[0];
+    c[1] -= e[1];
+    memcpy(counts, c, COUNTROW);
+#endif
 }
 
-/*[clinic input]
-data.State.candidate_in_houses
+/* store information for a house */
+typedef struct {
+    uint16_t hi_placed;     /* digits that are solved in the house */
+    uint8_t hi_solved;      /* number of solved positions for the house */
+} house_info;
 
-    key: object
-        This is the key that were checking; that is, we're checking
-        the three houses that intersect in this key.
+/* An entry in the trail; the contents of a cell before it was changed. */
+typedef struct {
+    uint8_t te_cell;
+    uint8_t te_value;
+    uint16_t te_candidates;
+} trail_entry;
+
+/* The grid is kept in small flat arrays, ordered so that the data the
+ * solver touches on every change comes first and fits in a few cache lines.
+ * The house and peer tables are shared with the compiled config, and the
+ * arrays can be exported through the buffer protocol; see grid_buffer below.
+ */
+typedef struct {
+    PyObject_HEAD
+    uint8_t ss_values[GRIDSIZE];    /* digit, or UNSOLVED */
+    uint8_t ss_digits[NUMROWS];     /* number of times each digit appears in
+                                       the grid */
+    uint8_t ss_solved;              /* number of solved positions */
+    uint16_t ss_cands[GRIDSIZE];    /* bits 0-8 are set for each candidate */
+    house_info ss_houses[NUMROWS*3];    /* information for each house */
+    uint8_t ss_counts[NUMROWS*3][COUNTROW]; /* number of each candidate
+                                               remaining in each house */
+    uint16_t ss_positions[NUMROWS*3][NUMROWS];  /* [house][digit]; bit n is
+                                                   set if the unsolved cell at
+                                                   gl_order[house][n] has
+                                                   digit as a candidate */
+    uint32_t ss_links[NUMROWS]; /* [digit]; bit h is set if the digit has
+                                   exactly two positions in house h */
+    cellmask ss_solvedmask;     /* solved cells */
+    cellmask ss_bivalue;        /* unsolved cells with exactly two candidates */
+    cellmask ss_buckets[NUMROWS+1]; /* unsolved cells by number of candidates */
+    const grid_layout *ss_layout;   /* house and peer tables; points into
+                                       ss_config, or at default_layout before
+                                       __init__ */
+    PyObject *ss_config;        /* compiled config */
+    PyObject *ss_grconfig;      /* dict */
+    PyObject *ss_peers;         /* dict */
+    PyObject *ss_subgroups;     /* tuple; (dict, dict) */
+    PyObject *ss_movehook;      /* Move subclass object (or NULL) */
+    PyObject *ss_weakref;       /* allow weak references */
+    PyObject *ss_housekeys;     /* Keys in each house */
+    PyObject *ss_oneset;        /* unions of peer sets */
+    PyObject *ss_dict;          /* Support for dynamic attributes */
+    Py_ssize_t ss_epoch;        /* bumped on every change to a cell */
+    Py_ssize_t ss_cell_epochs[GRIDSIZE];        /* epoch of last change */
+    Py_ssize_t ss_house_epochs[NUMROWS*3];      /* epoch of last change to
+                                                   any cell in the house */
+    trail_entry *ss_trail;      /* undo log; NULL while there are no marks */
+    Py_ssize_t ss_trail_len;    /* number of entries in the trail */
+    Py_ssize_t ss_trail_size;   /* number of entries allocated */
+    Py_ssize_t ss_trail_marks;  /* number of live marks in the trail */
+} SudokuStateObject;
 
-    cand: Py_ssize_t
-        The candidate to check in the houses.
-    /
+/* Free-lists. States, key iterators and the candidates and clues maps are
+ * created and dropped at a high rate by solvers and generators, so a few
+ * of each are kept for reuse instead of going back to the allocator.
+ * Only exact States go on the free-list; subclasses are freed normally.
+ */
+#define MAXFREELIST 80
 
-Check a key's houses for a particular candidate.
+static SudokuStateObject *state_freelist[MAXFREELIST];
+static int state_numfree = 0;
 
-The return value is a 3-tuple of ints telling us the candidate count for
-the group, the column, and the row, respectively.
-[clinic start generated code]*/
+static PyObject *
+data_State_alloc(PyTypeObject *type, Py_ssize_t nitems)
+{
+    SudokuStateObject *self;
 
-PyDoc_STRVAR(data_State_candidate_in_houses__doc__,
-"candidate_in_houses($self, key, cand, /)\n"
-"--\n"
-"\n"
-"Check a key\'s houses for a particular candidate.\n"
-"\n"
-"  key\n"
-"    This is the key that were checking; that is, we\'re checking\n"
-"    the three houses that intersect in this key.\n"
-"  cand\n"
-"    The candidate to check in the houses.\n"
-"\n"
-"The return value is a 3-tuple of ints telling us the candidate count for\n"
-"the group, the column, and the row, respectively.");
+    if (type != &SudokuState_Type || !state_numfree)
+        return PyType_GenericAlloc(type, nitems);
 
-#define DATA_STATE_CANDIDATE_IN_HOUSES_METHODDEF    \
-    {"candidate_in_houses", (PyCFunction)data_State_candidate_in_houses, METH_VARARGS, data_State_candidate_in_houses__doc__},
+    self = state_freelist[--state_numfree];
+    memset((char *)self + sizeof(PyObject), 0,
+           sizeof(SudokuStateObject) - sizeof(PyObject));
+    PyObject_Init((PyObject *)self, type);
+    PyObject_GC_Track(self);
+    return (PyObject *)self;
+}
 
-static PyObject *
-data_State_candidate_in_houses_impl(SudokuStateObject *self, PyObject *key, Py_ssize_t cand);
+static void
+data_State_dealloc(SudokuStateObject *self)
+{
+    PyObject_ClearWeakRefs((PyObject *)self);
+    PyObject_GC_UnTrack(self);
+    Py_CLEAR(self->ss_dict);
+    Py_CLEAR(self->ss_config);
+    Py_CLEAR(self->ss_grconfig);
+    Py_CLEAR(self->ss_peers);
+    Py_CLEAR(self->ss_subgroups);
+    Py_CLEAR(self->ss_housekeys);
+    Py_CLEAR(self->ss_oneset);
+    Py_CLEAR(self->ss_movehook);
+    PyMem_Free(self->ss_trail);
+    if (Py_TYPE(self) == &SudokuState_Type && state_numfree < MAXFREELIST)
+        state_freelist[state_numfree++] = self;
+    else
+        Py_TYPE(self)->tp_free((PyObject *)self);
+}
 
+/* Until __init__ sets a config, a State uses the default tables, so that
+ * nothing ever follows a NULL ss_layout.
+ */
 static PyObject *
-data_State_candidate_in_houses(SudokuStateObject *self, PyObject *args)
+data_State_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 {
-    PyObject *return_value = NULL;
-    PyObject *key;
-    Py_ssize_t cand;
-
-    if (!PyArg_ParseTuple(args,
-        "On:candidate_in_houses",
-        &key, &cand))
-        goto exit;
-    return_value = data_State_candidate_in_houses_impl(self, key, cand);
+    SudokuStateObject *self;
 
-exit:
-    return return_value;
+    self = (SudokuStateObject *)type->tp_alloc(type, 0);
+    if (self)
+        self->ss_layout = &default_layout;
+    return (PyObject *)self;
 }
 
+#define State_CheckExact(s) \
+    (Py_TYPE(s) == &SudokuState_Type)
+
 static PyObject *
-data_State_candidate_in_houses_impl(SudokuStateObject *self, PyObject *key, Py_ssize_t cand)
-/*[clinic end generated code: output=94cbf6e76fcc7e95 input=f2631f690a4cc850]*/
+do_default_build_config(void)
 {
-    Py_ssize_t g, c, r;
+    _Py_IDENTIFIER(build_config);
+    PyObject *f, *args, *v = NULL;
 
-    if (cand < 0 || cand >= NUMROWS) {
-        PyErr_Format(PyExc_ValueError,
-            "candidate_in_houses: Bad candidate '%d'", cand);
+    args = PyTuple_New(0);
+    if (!args)
         return NULL;
+
+    f = _PyDict_GetItemId(config_module, &PyId_build_config);
+    if (!f) {
+        PyErr_SetString(PyExc_AttributeError, "function not found");
+        goto done;
     }
+    v = PyObject_Call(f, args, NULL);
 
-    UNPACK_KEY(key, return NULL, "candidate_in_houses");
-    g = CELL_GROUP(self, x, y).hi_cand_count[cand];
-    c = self->ss_houses[y+COLOFFSET].hi_cand_count[cand];
-    r = self->ss_houses[x+ROWOFFSET].hi_cand_count[cand];
+done:
+    Py_DECREF(args);
+    return v;
+}
 
-    return Py_BuildValue("(nnn)", g, c, r);
+#define CALC_ATTR_FUNC(attr)                                            \
+static PyObject *                                                       \
+do_calculate_##attr(PyObject *var)                                      \
+{                                                                       \
+    _Py_IDENTIFIER(calculate_##attr);                                   \
+    PyObject *f;                                                        \
+                                                                        \
+    f = _PyDict_GetItemId(config_module, &PyId_calculate_##attr);       \
+    if (!f) {                                                           \
+        PyErr_SetString(PyExc_AttributeError, "function not found");    \
+        return NULL;                                                    \
+    }                                                                   \
+    return PyObject_CallFunction(f, "O", var);                          \
 }
 
-/*[clinic input]
-data.State.candidates_from_house
+CALC_ATTR_FUNC(peers)
+CALC_ATTR_FUNC(subgroups)
+CALC_ATTR_FUNC(housekeys)
+CALC_ATTR_FUNC(oneset)
 
-    house: Py_ssize_t
-        Index of the house to report the candidate counts of. This
-        index corresponds to the index of the house in the houses
-        attribute defined in state.py; 0-8 are groups, 9-17 are
-        columns, and 18-26 are rows.
-    /
+/* Compiled group configurations. A compiled config holds everything that a
+ * State derives from its grconfig; the python attributes made by the
+ * functions in config.py, and the native layout tables. Compiled configs
+ * are cached by layout, so States built from equal grconfigs share one
+ * config and only the first pays for the python calculations. A config
+ * keeps its own copy of the grconfig, with tuples for groups, and derives
+ * everything from that, so it never holds on to the caller's dict or lists.
+ */
 
-Get the candidate counts for a house.
+typedef struct {
+    PyObject_HEAD
+    PyObject *cc_grconfig;      /* dict; private copy, groups are tuples */
+    PyObject *cc_peers;         /* dict */
+    PyObject *cc_subgroups;     /* tuple; (dict, dict) */
+    PyObject *cc_housekeys;     /* tuple; (rows, cols, houses) */
+    PyObject *cc_oneset;        /* dict */
+    PyObject *cc_key;           /* bytes; key in config_cache */
+    grid_layout cc_layout;
+} CompiledConfigObject;
 
-The return value is a 9 element tuple of ints. Similarly to the
-num_clues attribute, the int at a particular index represents the
-candidate count for that house. Example:
+static PyTypeObject CompiledConfig_Type;
 
->>> state.candidates_from_house(18)[3]
+#define CompiledConfig_Check(v) (Py_TYPE(v) == &CompiledConfig_Type)
 
-gives the number of cells in the top row that can be 3.
-[clinic start generated code]*/
+/* Maximum number of compiled configs kept in config_cache */
+#define MAXCONFIGS 256
 
-PyDoc_STRVAR(data_State_candidates_from_house__doc__,
-"candidates_from_house($self, house, /)\n"
-"--\n"
-"\n"
-"Get the candidate counts for a house.\n"
-"\n"
-"  house\n"
-"    Index of the house to report the candidate counts of. This\n"
-"    index corresponds to the index of the house in the houses\n"
-"    attribute defined in state.py; 0-8 are groups, 9-17 are\n"
-"    columns, and 18-26 are rows.\n"
-"\n"
-"The return value is a 9 element tuple of ints. Similarly to the\n"
-"num_clues attribute, the int at a particular index represents the\n"
-"candidate count for that house. Example:\n"
-"\n"
-">>> state.candidates_from_house(18)[3]\n"
-"\n"
-"gives the number of cells in the top row that can be 3.");
+/* Number the group of each cell in order of first appearance, and find the
+ * group list for each number.
+ */
+static int
+config_find_groups(PyObject *grconfig, uint8_t *groups, PyObject **keysets,
+    const char *name)
+{
+    Py_ssize_t found = 0, i, k;
+    PyObject *value;
 
-#define DATA_STATE_CANDIDATES_FROM_HOUSE_METHODDEF    \
-    {"candidates_from_house", (PyCFunction)data_State_candidates_from_house, METH_VARARGS, data_State_candidates_from_house__doc__},
+    for (i = 0; i < GRIDSIZE; i++) {
+        value = PyDict_GetItem(grconfig, ikeys[i]);
+        if (!value) {
+            if (!PyErr_Occurred())
+                _PyErr_SetKeyError(ikeys[i]);
+            return -1;
+        }
+        for (k = 0; k < found; k++) {
+            if (value == keysets[k])
+                break;
+        }
+        if (k == found) {
+            if (found == NUMROWS)
+                goto malformed;
+            keysets[found++] = value;
+        }
+        groups[i] = (uint8_t)(k + GROFFSET);
+    }
+    if (found != NUMROWS)
+        goto malformed;
 
-static PyObject *
-data_State_candidates_from_house_impl(SudokuStateObject *self, Py_ssize_t house);
+    return 0;
+
+malformed:
+    PyErr_Format(PyExc_ValueError,
+        "%s: Group configuration is malformed", name);
+    return -1;
+}
 
+/* The cache key for a grconfig; the cell indices in each group list in
+ * list order. Also checks that each list holds the cells of its group.
+ */
 static PyObject *
-data_State_candidates_from_house(SudokuStateObject *self, PyObject *args)
+config_layout_key(const uint8_t *groups, PyObject **keysets, const char *name)
 {
-    PyObject *return_value = NULL;
-    Py_ssize_t house;
+    char buf[GRIDSIZE];
+    Py_ssize_t g, n;
+    PyObject *seq, *key;
 
-    if (!PyArg_ParseTuple(args,
-        "n:candidates_from_house",
-        &house))
-        goto exit;
-    return_value = data_State_candidates_from_house_impl(self, house);
+    for (g = 0; g < NUMROWS; g++) {
+        seq = PySequence_Fast(keysets[g], "group must be a sequence");
+        if (!seq)
+            return NULL;
+        if (PySequence_Fast_GET_SIZE(seq) != NUMROWS)
+            goto malformed;
+        for (n = 0; n < NUMROWS; n++) {
+            key = PySequence_Fast_GET_ITEM(seq, n);
+            UNPACK_KEY(key, goto error, name);
+            if (groups[INDEX(x, y)] != g + GROFFSET)
+                goto malformed;
+            buf[g*NUMROWS + n] = (char)INDEX(x, y);
+        }
+        Py_DECREF(seq);
+    }
 
-exit:
-    return return_value;
+    return PyBytes_FromStringAndSize(buf, GRIDSIZE);
+
+malformed:
+    PyErr_Format(PyExc_ValueError,
+        "%s: Group configuration is malformed", name);
+error:
+    Py_DECREF(seq);
+    return NULL;
 }
 
+/* Rebuild a grconfig dict from the cache key of a compiled config. Each
+ * group is a list, or a tuple if frozen is true.
+ */
 static PyObject *
-data_State_candidates_from_house_impl(SudokuStateObject *self, Py_ssize_t house)
-/*[clinic end generated code: output=fc684bd7d5663b12 input=e48123f8971ba9b8]*/
+grconfig_from_key(const unsigned char *key, int frozen, const char *name)
 {
-    PyObject *candidates, *integer;
-    Py_ssize_t *cands_count;
-    Py_ssize_t i;
+    PyObject *grconfig, *group;
+    Py_ssize_t g, n, c;
 
-    if (house < 0 || house >= 27) {
-        PyErr_Format(PyExc_ValueError,
-            "Expected a house index in range(0,27), "
-            "but got '%d'", house);
+    grconfig = PyDict_New();
+    if (!grconfig)
         return NULL;
-    }
-
-    cands_count = self->ss_houses[house].hi_cand_count;
-    candidates = PyTuple_New(NUMROWS);
-    if (!candidates)
-        return NULL;
-    for (i = 0; i < NUMROWS; i++) {
-        integer = PyLong_FromSsize_t(cands_count[i]);
-        if (!integer) {
-            Py_DECREF(candidates);
-            return NULL;
+    for (g = 0; g < NUMROWS; g++) {
+        group = frozen ? PyTuple_New(NUMROWS) : PyList_New(NUMROWS);
+        if (!group)
+            goto error;
+        for (n = 0; n < NUMROWS; n++) {
+            c = key[g*NUMROWS + n];
+            if (c >= GRIDSIZE) {
+                Py_DECREF(group);
+                PyErr_Format(PyExc_ValueError,
+                    "%s: Group configuration is malformed", name);
+                goto error;
+            }
+            Py_INCREF(ikeys[c]);
+            if (frozen)
+                PyTuple_SET_ITEM(group, n, ikeys[c]);
+            else
+                PyList_SET_ITEM(group, n, ikeys[c]);
         }
-        PyTuple_SET_ITEM(candidates, i, integer);
+        for (n = 0; n < NUMROWS; n++) {
+            if (PyDict_SetItem(grconfig, ikeys[key[g*NUMROWS + n]], group) < 0) {
+                Py_DECREF(group);
+                goto error;
+            }
+        }
+        Py_DECREF(group);
     }
 
-    return candidates;
-}
-
-/* writes rectangles found into pos, and returns num found */
-static Py_ssize_t
-find_rectangles_one_key(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y,
-    PyObject *cands, PyObject **pos);
-
-/*[clinic input]
-data.State.find_rectangles
-
-    key: object = NULL
-        If not None, then we find all rectangles that have this key as the
-        upper left corner. If this is None, then search the whole grid for
-        rectangles.
-
-    cands: object = NULL
-        If this isn't None, then it should be a CandidateSet. In this case,
-        return only rectangles where each key contains all candidates in the
-        set. Otherwise, return every rectangle that shares at least one
-        candidate.
-
-Find rectangles -- four keys in two rows and two columns that share candidates.
-
-This method returns a tuple of found rectangles. A rectangle is a two member
-tuple. The first member of is the set of shared candidates. The second item
-is a tuple of four keys; first: upper left, second: upper right, third:
-lower right, fourth: lower left.
-[clinic start generated code]*/
-
-PyDoc_STRVAR(data_State_find_rectangles__doc__,
-"find_rectangles($self, /, key=None, cands=None)\n"
-"--\n"
-"\n"
-"Find rectangles -- four keys in two rows and two columns that share candidates.\n"
-"\n"
-"  key\n"
-"    If not None, then we find all rectangles that have this key as the\n"
-"    upper left corner. If this is None, then search the whole grid for\n"
-"    rectangles.\n"
-"  cands\n"
-"    If this isn\'t None, then it should be a CandidateSet. In this case,\n"
-"    return only rectangles where each key contains all candidates in the\n"
-"    set. Otherwise, return every rectangle that shares at least one\n"
-"    candidate.\n"
-"\n"
-"This method returns a tuple of found rectangles. A rectangle is a two member\n"
-"tuple. The first member of is the set of shared candidates. The second item\n"
-"is a tuple of four keys; first: upper left, second: upper right, third:\n"
-"lower right, fourth: lower left.");
-
-#define DATA_STATE_FIND_RECTANGLES_METHODDEF    \
-    {"find_rectangles", (PyCFunction)data_State_find_rectangles, METH_VARARGS|METH_KEYWORDS, data_State_find_rectangles__doc__},
-
-static PyObject *
-data_State_find_rectangles_impl(SudokuStateObject *self, PyObject *key, PyObject *cands);
-
-static PyObject *
-data_State_find_rectangles(SudokuStateObject *self, PyObject *args, PyObject *kwargs)
-{
-    PyObject *return_value = NULL;
-    static char *_keywords[] = {"key", "cands", NULL};
-    PyObject *key = NULL;
-    PyObject *cands = NULL;
-
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
-        "|OO:find_rectangles", _keywords,
-        &key, &cands))
-        goto exit;
-    return_value = data_State_find_rectangles_impl(self, key, cands);
+    return grconfig;
 
-exit:
-    return return_value;
+error:
+    Py_DECREF(grconfig);
+    return NULL;
 }
 
+/* Compile a grconfig, or fetch it from the cache. Returns a new reference. */
 static PyObject *
-data_State_find_rectangles_impl(SudokuStateObject *self, PyObject *key, PyObject *cands)
-/*[clinic end generated code: output=0f2accc852803472 input=32b5333a6b7eb6b3]*/
+config_compile(PyObject *grconfig, const char *name)
 {
-    PyObject *temp_storage[MAXRECT];
-    Py_ssize_t found = 0, i, j, res;
-    PyObject *tuple;
+    uint8_t groups[GRIDSIZE];
+    PyObject *keysets[NUMROWS];
+    PyObject *key;
+    CompiledConfigObject *cc;
 
-    if (cands == Py_None)
-        cands = NULL;
-    if (cands && !CandidateSet_Check(cands)) {
+    if (!PyDict_Check(grconfig)) {
         PyErr_Format(PyExc_TypeError,
-            "find_rectangles: expected CandidateSet or None, not '%.100s'",
-            Py_TYPE(cands)->tp_name);
+            "%s: expected dict or compiled config, not '%.100s'",
+            name, Py_TYPE(grconfig)->tp_name);
         return NULL;
     }
+    if (config_find_groups(grconfig, groups, keysets, name) < 0)
+        return NULL;
+    key = config_layout_key(groups, keysets, name);
+    if (!key)
+        return NULL;
 
-    if (key && key != Py_None) {
-        UNPACK_KEY(key, goto error, "find_rectangles");
-        found = find_rectangles_one_key(self, x, y, cands, temp_storage);
-        if (found < 0)
-            return NULL;
-    } else {
-        for (i = 0; i < NUMROWS-1; i++) {
-            for (j = 0; j < NUMROWS-1; j++) {
-                if (!CELL_FILLED(self->ss_grid, i, j)) {
-                    res = find_rectangles_one_key(self, i, j, cands, temp_storage + found);
-                    if (res < 0)
-                        goto error;
-                    found += res;
-                }
-            }
-        }
-    }
-
-    tuple = PyTuple_New(found);
-    if (!tuple)
-        goto error;
-
-    for (i = 0; i < found; i++) {
-        PyTuple_SET_ITEM(tuple, i, temp_storage[i]);
+    cc = (CompiledConfigObject *)PyDict_GetItem(config_cache, key);
+    if (cc) {
+        Py_DECREF(key);
+        Py_INCREF(cc);
+        return (PyObject *)cc;
     }
-    return tuple;
 
-error:
-    for (i = 0; i < found; i++) {
-        Py_DECREF(temp_storage[i]);
+    cc = PyObject_New(CompiledConfigObject, &CompiledConfig_Type);
+    if (!cc) {
+        Py_DECREF(key);
+        return NULL;
     }
-    return NULL;
-}
-
-/* true if x is subset of y; see CandidateSet rich compare */
-#define SUBSET(x,y) (((x) | (y)) == (y))
-
-static Py_ssize_t
-find_rectangles_one_key(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y,
-    PyObject *cands, PyObject **pos)
-{
-    Py_ssize_t found = 0, i, j;
-    uint16_t ul_set, required, intersection, tmp;
-    PyObject *candidate_set, *next_slot;
+    cc->cc_peers = cc->cc_subgroups = cc->cc_housekeys = cc->cc_oneset = NULL;
+    cc->cc_key = key;   /* steals the reference */
+    cc->cc_grconfig = grconfig_from_key(
+        (const unsigned char *)PyBytes_AS_STRING(key), 1, name);
+    if (!cc->cc_grconfig)
+        goto fail;
 
-    if (x == NUMROWS-1 || y == NUMROWS-1) {
+    if (layout_build(&cc->cc_layout, groups,
+                     (const uint8_t *)PyBytes_AS_STRING(key)) < 0) {
         PyErr_Format(PyExc_ValueError,
-            "find_rectangles: key (%ld, %ld) cannot be the upper left "
-            "corner of a rectangle.", x, y);
-        return -1;
+            "%s: Group configuration is malformed", name);
+        goto fail;
     }
-    if (CELL_FILLED(self->ss_grid, x, y))
-        return 0;
-
-    required = cands ? ((CandidateSetObject *)cands)->cs_set : 0;
-    ul_set = CELL_CANDS(self->ss_grid, x, y);
-    if (!SUBSET(required, ul_set))
-        return 0;
+    if ((cc->cc_peers = do_calculate_peers(cc->cc_grconfig)) == NULL)
+        goto fail;
+    if ((cc->cc_subgroups = do_calculate_subgroups(cc->cc_peers)) == NULL)
+        goto fail;
+    if ((cc->cc_housekeys = do_calculate_housekeys(cc->cc_grconfig)) == NULL)
+        goto fail;
+    if ((cc->cc_oneset = do_calculate_oneset(cc->cc_peers)) == NULL)
+        goto fail;
 
-    /* At this point, we've identified a potential upper left corner for
-     * candidate rectangles. We proceed by walking to the right from this
-     * corner, looking for an upper right corner, and then if we find one,
-     * we'll walk down looking for the bottom corners.
-     */
-    for (j = y+1; j < NUMROWS; j++) {
-        intersection = ul_set;
-        if (!CELL_FILLED(self->ss_grid, x, j)) {
-            intersection &= CELL_CANDS(self->ss_grid, x, j);
-            if (intersection && SUBSET(required, intersection)) {
-                /* we found an upper right corner */
-                tmp = intersection;
-                for (i = x+1; i < NUMROWS; i++) {
-                    intersection = tmp;
-                    if (!CELL_FILLED(self->ss_grid, i, y)) {
-                        intersection &= CELL_CANDS(self->ss_grid, i, y);
-                        if (intersection && SUBSET(required, intersection)) {
-                            /* we found a lower left corner; one more to go */
-                            if (!CELL_FILLED(self->ss_grid, i, j)) {
-                                intersection &= CELL_CANDS(self->ss_grid, i, j);
-                                if (intersection && SUBSET(required, intersection)) {
-                                    /* found a complete rectangle */
-                                    candidate_set = build_set(intersection);
-                                    if (!candidate_set)
-                                        goto error;
-                                    next_slot = Py_BuildValue("(O((nn)(nn)(nn)(nn)))",
-                                        /* keys are arranged in clockwise order */
-                                        candidate_set, x,y, x,j, i,j, i,y);
-                                    Py_DECREF(candidate_set);
-                                    if (!next_slot)
-                                        goto error;
-                                    pos[found++] = next_slot;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    /* Keep the cache bounded, but never drop the default config */
+    if (PyDict_Size(config_cache) >= MAXCONFIGS) {
+        PyDict_Clear(config_cache);
+        if (default_config &&
+            PyDict_SetItem(config_cache,
+                ((CompiledConfigObject *)default_config)->cc_key,
+                default_config) < 0)
+            goto fail;
     }
+    if (PyDict_SetItem(config_cache, key, (PyObject *)cc) < 0)
+        goto fail;
+    return (PyObject *)cc;
 
-    return found;
-
-error:
-    for (i = 0; i < found; i++) {
-        Py_DECREF(pos[i]);
-    }
-    return -1;
+fail:
+    Py_DECREF(cc);
+    return NULL;
 }
 
-/* state_iterator object */
-
-static PyTypeObject state_iterator_Type;
-typedef struct _ki_ob KeyIterObject;
-
-/* keyiterfuncs return -1 on error or completion, 0 on success.
- * On success, sets the last two args to the coordinates of the key
- * to be returned by next.
+/* Find the compiled config for a grconfig argument, which may be NULL or
+ * None for the default, a compiled config, or a dict. Returns a new
+ * reference.
  */
-typedef int (*keyiterfunc)(KeyIterObject *, Py_ssize_t *, Py_ssize_t *);
-
-struct _ki_ob {
-    PyObject_VAR_HEAD
-    SudokuStateObject *ki_state;
-    PyObject *ki_weakref;
-    keyiterfunc ki_func;
-    Py_ssize_t ki_next_x;
-    Py_ssize_t ki_next_y;
-    Py_ssize_t ki_pos;
-    Py_ssize_t ki_data[1];
-};
-
-static KeyIterObject *
-new_keyiter_object(Py_ssize_t nitems, SudokuStateObject *state)
+static PyObject *
+config_lookup(PyObject *grconfig, const char *name)
 {
-    KeyIterObject *self;
-    self = PyObject_NewVar(KeyIterObject, &state_iterator_Type, nitems);
-    if (!self)
-        return NULL;
-    Py_INCREF(state);
-    self->ki_state = state;
-    self->ki_weakref = NULL;
-    return self;
+    if (!grconfig || grconfig == Py_None || grconfig == default_grconfig)
+        grconfig = default_config;
+    if (CompiledConfig_Check(grconfig)) {
+        Py_INCREF(grconfig);
+        return grconfig;
+    }
+    return config_compile(grconfig, name);
 }
 
 static void
-data_KeyIter_dealloc(KeyIterObject *self)
+data_CompiledConfig_dealloc(CompiledConfigObject *self)
 {
-    PyObject_ClearWeakRefs((PyObject *)self);
-    Py_DECREF(self->ki_state);
-    PyObject_Del((PyObject *)self);
+    Py_XDECREF(self->cc_grconfig);
+    Py_XDECREF(self->cc_peers);
+    Py_XDECREF(self->cc_subgroups);
+    Py_XDECREF(self->cc_housekeys);
+    Py_XDECREF(self->cc_oneset);
+    Py_XDECREF(self->cc_key);
+    PyObject_Del(self);
 }
 
 static PyObject *
-data_KeyIter_iternext(KeyIterObject *self)
+data_CompiledConfig_grconfig_getter(CompiledConfigObject *self)
 {
-    Py_ssize_t x, y;
-
-    if (!self->ki_func)
-        return NULL;
-    if (self->ki_func(self, &x, &y) < 0) {
-        self->ki_func = NULL;
-        return NULL;
-    }
-
-    return Py_BuildValue("(nn)", x, y);
+    return PyDictProxy_New(self->cc_grconfig);
 }
 
-static PyMemberDef KeyIter_members[] = {
-    {"state", T_OBJECT, offsetof(KeyIterObject, ki_state), READONLY},
-    {"__weakref__", T_OBJECT, offsetof(KeyIterObject, ki_weakref), READONLY},
+static PyGetSetDef CompiledConfig_getsets[] = {
+    {"grconfig", (getter)data_CompiledConfig_grconfig_getter, NULL,
+     "Read only view of the config's own copy of the grconfig."},
     {NULL}  /* sentinel */
 };
 
-static PyTypeObject state_iterator_Type = {
+static PyMemberDef CompiledConfig_members[] = {
+    {"peers",     T_OBJECT, offsetof(CompiledConfigObject, cc_peers),     READONLY},
+    {"subgroups", T_OBJECT, offsetof(CompiledConfigObject, cc_subgroups), READONLY},
+    {"housekeys", T_OBJECT, offsetof(CompiledConfigObject, cc_housekeys), READONLY},
+    {"oneset",    T_OBJECT, offsetof(CompiledConfigObject, cc_oneset),    READONLY},
+    {NULL}  /* sentinel */
+};
+
+PyDoc_STRVAR(compiled_config_doc,
+"A group configuration compiled by compile_config. It can be passed to\n\
+State in place of a grconfig dict.");
+
+static PyTypeObject CompiledConfig_Type = {
     PyVarObject_HEAD_INIT(NULL, 0)
-    "sudoku.data.state_iterator",/*tp_name*/
-    sizeof(KeyIterObject) - sizeof(Py_ssize_t),/*tp_basicsize*/
-    sizeof(Py_ssize_t),         /*tp_itemsize*/
+    "sudoku.data.compiled_config",  /*tp_name*/
+    sizeof(CompiledConfigObject),   /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
     /* methods */
-    (destructor)data_KeyIter_dealloc,/*tp_dealloc*/
+    (destructor)data_CompiledConfig_dealloc,/*tp_dealloc*/
     0,                          /*tp_print*/
     0,                          /*tp_getattr*/
     0,                          /*tp_setattr*/
@@ -1799,1145 +2060,5532 @@ static PyTypeObject state_iterator_Type = {
     0,                          /*tp_hash*/
     0,                          /*tp_call*/
     0,                          /*tp_str*/
-    0,                          /*tp_getattro*/
+    PyObject_GenericGetAttr,    /*tp_getattro*/
     0,                          /*tp_setattro*/
     0,                          /*tp_as_buffer*/
     Py_TPFLAGS_DEFAULT,         /*tp_flags*/
-    0,                          /*tp_doc*/
+    compiled_config_doc,        /*tp_doc*/
     0,                          /*tp_traverse*/
     0,                          /*tp_clear*/
     0,                          /*tp_richcompare*/
-    offsetof(KeyIterObject, ki_weakref),/*tp_weaklistoffset*/
-    PyObject_SelfIter,          /*tp_iter*/
-    (iternextfunc)data_KeyIter_iternext,/*tp_iternext*/
+    0,                          /*tp_weaklistoffset*/
+    0,                          /*tp_iter*/
+    0,                          /*tp_iternext*/
     0,                          /*tp_methods*/
-    KeyIter_members,            /*tp_members*/
+    CompiledConfig_members,     /*tp_members*/
+    CompiledConfig_getsets,     /*tp_getset*/
 };
 
-/* Iterator methods -- the methods below return a state_iterator */
-
-/* keyiterfunc for ones that calculate their iteration order at
- * construction time.
+/* Set the attributes that come from the group configuration. The grconfig
+ * attribute is the dict the State was built with; a State built from a
+ * compiled config gets a read only view of the config's copy.
  */
 static int
-precalculated_keyiterfunc(KeyIterObject *ki, Py_ssize_t *x, Py_ssize_t *y)
+set_config_attrs(SudokuStateObject *self, PyObject *grconfig)
 {
-    Py_ssize_t i;
+    CompiledConfigObject *cc;
 
-    if (ki->ki_pos == Py_SIZE(ki))
+    cc = (CompiledConfigObject *)config_lookup(grconfig, "__init__");
+    if (!cc)
         return -1;
 
-    i = ki->ki_data[ki->ki_pos++];
-    *x = ROW(i);
-    *y = COL(i);
+    if (grconfig && PyDict_Check(grconfig)) {
+        Py_INCREF(grconfig);
+        self->ss_grconfig = grconfig;
+    } else if ((PyObject *)cc == default_config) {
+        Py_INCREF(default_grconfig);
+        self->ss_grconfig = default_grconfig;
+    } else {
+        self->ss_grconfig = PyDictProxy_New(cc->cc_grconfig);
+        if (!self->ss_grconfig) {
+            Py_DECREF(cc);
+            return -1;
+        }
+    }
+    self->ss_config    = (PyObject *)cc;
+    self->ss_peers     = cc->cc_peers;
+    self->ss_subgroups = cc->cc_subgroups;
+    self->ss_housekeys = cc->cc_housekeys;
+    self->ss_oneset    = cc->cc_oneset;
+
+    Py_INCREF(self->ss_peers);
+    Py_INCREF(self->ss_subgroups);
+    Py_INCREF(self->ss_housekeys);
+    Py_INCREF(self->ss_oneset);
+
+    self->ss_layout    = &cc->cc_layout;
+
     return 0;
 }
 
-/* used to iterate in reverse order through a precalculated keyiter */
+/* init cell arrays */
 static int
-reversed_keyiterfunc(KeyIterObject *ki, Py_ssize_t *x, Py_ssize_t *y)
+set_defaults(SudokuStateObject *self)
 {
     Py_ssize_t i;
 
-    if (--ki->ki_pos == -1)
+    for (i = 0; i < GRIDSIZE; i++) {
+        self->ss_values[i] = UNSOLVED;
+        self->ss_cands[i] = 0;
+    }
+    memset(self->ss_counts, 0, sizeof(self->ss_counts));
+    memset(self->ss_positions, 0, sizeof(self->ss_positions));
+    memset(self->ss_links, 0, sizeof(self->ss_links));
+    memset(&self->ss_solvedmask, 0, sizeof(cellmask));
+    memset(&self->ss_bivalue, 0, sizeof(cellmask));
+    memset(self->ss_buckets, 0, sizeof(self->ss_buckets));
+    for (i = 0; i < GRIDSIZE; i++)
+        CM_SET(self->ss_buckets[0], i);
+
+    return 0;
+}
+
+/* utility functions to incref or decref hi_solved for a given cell. */
+static void
+house_adjust_solved_up(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y)
+{
+    self->ss_houses[x+ROWOFFSET].hi_solved++;
+    self->ss_houses[y+COLOFFSET].hi_solved++;
+    CELL_GROUP(self, x, y).hi_solved++;
+}
+
+static void
+house_adjust_solved_down(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y)
+{
+    self->ss_houses[x+ROWOFFSET].hi_solved--;
+    self->ss_houses[y+COLOFFSET].hi_solved--;
+    CELL_GROUP(self, x, y).hi_solved--;
+}
+
+/* similar functions for cand_count, but do adjustment for each item in the set */
+
+static void
+house_adjust_cand_count_up(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y, uint16_t set)
+{
+    const uint8_t *hs = self->ss_layout->gl_houses[INDEX(x, y)];
+
+    if (!set)
+        return;
+    counts_add(self->ss_counts[hs[0]], set);
+    counts_add(self->ss_counts[hs[1]], set);
+    counts_add(self->ss_counts[hs[2]], set);
+}
+
+static void
+house_adjust_cand_count_down(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y, uint16_t set)
+{
+    const uint8_t *hs = self->ss_layout->gl_houses[INDEX(x, y)];
+
+    if (!set)
+        return;
+    counts_sub(self->ss_counts[hs[0]], set);
+    counts_sub(self->ss_counts[hs[1]], set);
+    counts_sub(self->ss_counts[hs[2]], set);
+}
+
+/* Placed digit masks for the houses of cell i. Adding is just an OR, but
+ * when a solved cell changes, a peer might hold the same digit (the grid
+ * doesn't have to be valid), so the masks are recalculated.
+ */
+static void
+house_add_placed(SudokuStateObject *self, Py_ssize_t i, Py_ssize_t digit)
+{
+    const uint8_t *hs = self->ss_layout->gl_houses[i];
+
+    self->ss_houses[hs[0]].hi_placed |= 1 << digit;
+    self->ss_houses[hs[1]].hi_placed |= 1 << digit;
+    self->ss_houses[hs[2]].hi_placed |= 1 << digit;
+}
+
+static void
+house_recount_placed(SudokuStateObject *self, Py_ssize_t i)
+{
+    Py_ssize_t k, n, h, c;
+    uint16_t placed;
+
+    for (k = 0; k < 3; k++) {
+        h = self->ss_layout->gl_houses[i][k];
+        placed = 0;
+        for (n = 0; n < NUMROWS; n++) {
+            c = self->ss_layout->gl_cells[h][n];
+            if (self->ss_values[c] != UNSOLVED)
+                SET_BIT(placed, self->ss_values[c]);
+        }
+        self->ss_houses[h].hi_placed = placed;
+    }
+}
+
+/* Keep the house position masks, the strong links and the bivalue cells
+ * in step with a change of the candidates of cell i. Solved cells count as
+ * having no candidates.
+ */
+static void
+index_update(SudokuStateObject *self, Py_ssize_t i, uint16_t old, uint16_t new)
+{
+    const uint8_t *hs = self->ss_layout->gl_houses[i];
+    const uint8_t *pos = self->ss_layout->gl_pos[i];
+    uint16_t diff = (old ^ new) & TERMS;
+    uint16_t mask;
+    Py_ssize_t d, k;
+
+    for (d = 0; diff; d++, diff >>= 1) {
+        if (!(diff & 1))
+            continue;
+        for (k = 0; k < 3; k++) {
+            mask = self->ss_positions[hs[k]][d] ^= 1 << pos[k];
+            if (isizes[mask] == 2)
+                self->ss_links[d] |= (uint32_t)1 << hs[k];
+            else
+                self->ss_links[d] &= ~((uint32_t)1 << hs[k]);
+        }
+    }
+    if (isizes[new & TERMS] == 2)
+        CM_SET(self->ss_bivalue, i);
+    else
+        CM_CLEAR(self->ss_bivalue, i);
+}
+
+/* Record a change to cell i in the cell and house epochs. */
+static void
+stamp_cell(SudokuStateObject *self, Py_ssize_t i)
+{
+    const uint8_t *hs = self->ss_layout->gl_houses[i];
+    Py_ssize_t epoch = ++self->ss_epoch;
+
+    self->ss_cell_epochs[i] = epoch;
+    self->ss_house_epochs[hs[0]] = epoch;
+    self->ss_house_epochs[hs[1]] = epoch;
+    self->ss_house_epochs[hs[2]] = epoch;
+}
+
+/* Change the contents of a cell without touching the trail. Keeps the
+ * solved count, the digit counts, the house information and the solved
+ * cell mask in step with the grid. value is UNSOLVED for unsolved
+ * cells.
+ */
+static int
+cell_change(SudokuStateObject *self, Py_ssize_t i, uint8_t value, uint16_t cands)
+{
+    uint8_t old_value = self->ss_values[i];
+    uint16_t old_cands = self->ss_cands[i];
+    int was_solved = old_value != UNSOLVED;
+    int solved = value != UNSOLVED;
+    Py_ssize_t x = ROW(i), y = COL(i);
+
+    if (was_solved) {
+        self->ss_digits[old_value]--;
+        if (solved) {
+            self->ss_digits[value]++;
+        } else {
+            CM_CLEAR(self->ss_solvedmask, i);
+            house_adjust_solved_down(self, x, y);
+            house_adjust_cand_count_up(self, x, y, cands);
+            self->ss_solved--;
+        }
+    } else if (solved) {
+        CM_SET(self->ss_solvedmask, i);
+        house_adjust_solved_up(self, x, y);
+        house_adjust_cand_count_down(self, x, y, old_cands);
+        self->ss_digits[value]++;
+        self->ss_solved++;
+    } else {
+        /* Only the candidates that actually changed affect the counts */
+        house_adjust_cand_count_down(self, x, y, old_cands & ~cands);
+        house_adjust_cand_count_up(self, x, y, cands & ~old_cands);
+    }
+
+    self->ss_values[i] = value;
+    self->ss_cands[i] = cands;
+    if (was_solved)
+        house_recount_placed(self, i);
+    else if (solved)
+        house_add_placed(self, i, value);
+    index_update(self, i, was_solved ? 0 : old_cands, solved ? 0 : cands);
+    if (!was_solved)
+        CM_CLEAR(self->ss_buckets[isizes[old_cands & TERMS]], i);
+    if (!solved)
+        CM_SET(self->ss_buckets[isizes[cands & TERMS]], i);
+    stamp_cell(self, i);
+    return 0;
+}
+
+/* A trail entry with this in te_cell is a mark made by State.mark. */
+#define TRAIL_MARK 0xFF
+
+/* Make room for one more entry on an active trail, and return it without
+ * counting it in ss_trail_len.
+ */
+static trail_entry *
+trail_reserve(SudokuStateObject *self)
+{
+    trail_entry *entry;
+
+    if (self->ss_trail_len == self->ss_trail_size) {
+        entry = PyMem_Resize(self->ss_trail, trail_entry, self->ss_trail_size*2);
+        if (!entry) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        self->ss_trail = entry;
+        self->ss_trail_size *= 2;
+    }
+    return &self->ss_trail[self->ss_trail_len];
+}
+
+/* Drop the trail and stop recording; called when the last mark goes. */
+static void
+trail_clear(SudokuStateObject *self)
+{
+    PyMem_Free(self->ss_trail);
+    self->ss_trail = NULL;
+    self->ss_trail_len = self->ss_trail_size = self->ss_trail_marks = 0;
+}
+
+/* Change the contents of a cell, recording the old contents on the trail
+ * if the trail is active. Every change to the grid after initialization
+ * goes through here.
+ */
+static int
+cell_update(SudokuStateObject *self, Py_ssize_t i, uint8_t value, uint16_t cands)
+{
+    trail_entry *entry;
+
+    if (self->ss_trail) {
+        entry = trail_reserve(self);
+        if (!entry)
+            return -1;
+        entry->te_cell = (uint8_t)i;
+        entry->te_value = self->ss_values[i];
+        entry->te_candidates = self->ss_cands[i];
+    }
+
+    if (cell_change(self, i, value, cands) < 0)
         return -1;
+    if (self->ss_trail)
+        self->ss_trail_len++;
+    return 0;
+}
+
+/* Rebuild all of the house candidate counts, the candidate indexes and the
+ * candidate count buckets from the candidate masks of the unsolved cells.
+ */
+static void
+recount_houses(SudokuStateObject *self)
+{
+    Py_ssize_t h, n, c;
+
+    memset(self->ss_positions, 0, sizeof(self->ss_positions));
+    memset(self->ss_links, 0, sizeof(self->ss_links));
+    memset(&self->ss_bivalue, 0, sizeof(cellmask));
+    memset(self->ss_buckets, 0, sizeof(self->ss_buckets));
+    for (c = 0; c < GRIDSIZE; c++) {
+        if (self->ss_values[c] == UNSOLVED) {
+            index_update(self, c, 0, self->ss_cands[c]);
+            CM_SET(self->ss_buckets[isizes[self->ss_cands[c]]], c);
+        }
+    }
+
+    memset(self->ss_counts, 0, sizeof(self->ss_counts));
+    for (h = 0; h < NUMROWS*3; h++) {
+        for (n = 0; n < NUMROWS; n++) {
+            c = self->ss_layout->gl_cells[h][n];
+            if (self->ss_values[c] == UNSOLVED)
+                counts_add(self->ss_counts[h], self->ss_cands[c]);
+        }
+    }
+}
+
+/* fill in pencil marks based on the clues in the grid */
+static int
+fill_in_pencilmarks(SudokuStateObject *self)
+{
+    Py_ssize_t i;
+    uint16_t placed, cands;
+    const uint8_t *hs;
+
+    for (i = 0; i < GRIDSIZE; i++) {
+        if (self->ss_values[i] != UNSOLVED)
+            continue;
+        hs = self->ss_layout->gl_houses[i];
+        placed = self->ss_houses[hs[0]].hi_placed |
+                 self->ss_houses[hs[1]].hi_placed |
+                 self->ss_houses[hs[2]].hi_placed;
+        cands = (~placed) & TERMS;
+
+        /* Without a trail nothing needs to see the individual changes, so
+         * write the masks directly and recount the houses once at the end.
+         */
+        if (!self->ss_trail) {
+            if (self->ss_cands[i] != cands) {
+                self->ss_cands[i] = cands;
+                stamp_cell(self, i);
+            }
+        } else if (cell_update(self, i, self->ss_values[i], cands) < 0)
+            return -1;
+    }
+    if (!self->ss_trail)
+        recount_houses(self);
 
-    i = ki->ki_data[ki->ki_pos];
-    *x = ROW(i);
-    *y = COL(i);
     return 0;
 }
 
-static KeyIterObject *
-start_building_precalculated_keyiter(SudokuStateObject *self)
+/* Clear the grid and put the givens from clues in it, keeping the group
+ * configuration. This is everything __init__ does after the configuration
+ * is set, and all that State.reset does.
+ */
+static int
+load_clues(SudokuStateObject *self, PyObject *clues, int dofill, const char *name)
+{
+    Py_ssize_t i = 0, cl;
+    PyObject *key, *value;
+
+    if (!PyDict_Check(clues)) {
+        PyErr_Format(PyExc_TypeError,
+            "%s: Expected dict, not '%.100s'", name, Py_TYPE(clues)->tp_name);
+        return -1;
+    }
+
+    Py_CLEAR(self->ss_movehook);
+    self->ss_solved = 0;
+    memset(self->ss_digits, 0, sizeof(self->ss_digits));
+    if (set_defaults(self) < 0)
+        return -1;
+    memset(self->ss_houses, 0, sizeof(house_info)*NUMROWS*3);
+    trail_clear(self);
+
+    /* Put givens in the grid */
+    i = 0;
+    while (PyDict_Next(clues, &i, &key, &value)) {
+        cl = PyLong_AsSsize_t(value);
+        if (cl < 0 || cl >= NUMROWS) {
+            if (!PyErr_Occurred())
+                PyErr_Format(PyExc_ValueError,
+                    "%s: Expected values from 0-%d, saw %zd",
+                    name, NUMROWS-1, cl);
+            return -1;
+        }
+
+        UNPACK_KEY(key, return -1, name);
+        if (CM_TEST(self->ss_solvedmask, INDEX(x, y))) {
+            /* (x, y) and its cell index both name the cell */
+            PyErr_Format(PyExc_ValueError,
+                "%s: Clue for (%zd, %zd) given twice", name, x, y);
+            return -1;
+        }
+        CELL_VALUE(self, x, y) = (uint8_t)cl;
+        CM_SET(self->ss_solvedmask, INDEX(x, y));
+        self->ss_solved++;
+
+        /* Adjust houses */
+        house_adjust_solved_up(self, x, y);
+        house_add_placed(self, INDEX(x, y), cl);
+
+        /* Record clue number */
+        self->ss_digits[cl]++;
+    }
+
+    /* Calculate the candidates for the remaining positions. Givens were
+     * written directly, so the indexes need a rebuild either way.
+     */
+    if (dofill) {
+        if (fill_in_pencilmarks(self) < 0)
+            return -1;
+    } else {
+        recount_houses(self);
+    }
+
+    self->ss_epoch++;
+    for (i = 0; i < GRIDSIZE; i++)
+        self->ss_cell_epochs[i] = self->ss_epoch;
+    for (i = 0; i < NUMROWS*3; i++)
+        self->ss_house_epochs[i] = self->ss_epoch;
+
+    return 0;
+}
+
+/*[clinic input]
+data.State.__init__
+
+    clues: object
+        A dictionary that maps positions in the sudoku grid to numbers
+        in range(9).
+
+    dofill: bool = True
+        If true, then fill in pencilmarks. If false, then each candidate set
+        will be empty.
+
+    grconfig: object = NULL
+        A dictionary that maps each cell to a list of keys. If None, a default
+        value is used.
+
+This is the representation of the information in a sudoku puzzle.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State___init____doc__,
+"State(clues, dofill=True, grconfig=None)\n"
+"--\n"
+"\n"
+"This is the representation of the information in a sudoku puzzle.\n"
+"\n"
+"  clues\n"
+"    A dictionary that maps positions in the sudoku grid to numbers\n"
+"    in range(9).\n"
+"  dofill\n"
+"    If true, then fill in pencilmarks. If false, then each candidate set\n"
+"    will be empty.\n"
+"  grconfig\n"
+"    A dictionary that maps each cell to a list of keys. If None, a default\n"
+"    value is used.");
+
+static int
+data_State___init___impl(SudokuStateObject *self, PyObject *clues, int dofill, PyObject *grconfig);
+
+static int
+data_State___init__(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    int return_value = -1;
+    static char *_keywords[] = {"clues", "dofill", "grconfig", NULL};
+    PyObject *clues;
+    int dofill = 1;
+    PyObject *grconfig = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "O|pO:State", _keywords,
+        &clues, &dofill, &grconfig))
+        goto exit;
+    return_value = data_State___init___impl((SudokuStateObject *)self, clues, dofill, grconfig);
+
+exit:
+    return return_value;
+}
+
+static int
+data_State___init___impl(SudokuStateObject *self, PyObject *clues, int dofill, PyObject *grconfig)
+/*[clinic end generated code: output=cb6333ae454ac383 input=6f62a2a9cc95d39e]*/
+{
+    /* Since __init__ can be used to reset an object, we explicitly zero
+     * out all fields, except for dynamic attributes, weak references and
+     * the epoch, which are left alone. The epoch keeps counting so that
+     * tokens from before the reset see every cell as changed.
+     */
+    self->ss_layout = &default_layout;
+    Py_CLEAR(self->ss_config);
+    Py_CLEAR(self->ss_grconfig);
+    Py_CLEAR(self->ss_peers);
+    Py_CLEAR(self->ss_subgroups);
+    Py_CLEAR(self->ss_housekeys);
+    Py_CLEAR(self->ss_oneset);
+
+    /* Set various attributes */
+    if (set_config_attrs(self, grconfig) < 0)
+        return -1;
+
+    return load_clues(self, clues, dofill, "__init__");
+}
+
+/* State methods */
+
+/*[clinic input]
+data.State.candidate_in_keyset
+
+    cand: Py_ssize_t
+        Candidate to be searched for.
+
+    keyset: object
+        Set of keys to search for candidate in.
+    /
+
+Search through a keyset for a particular candidate.
+
+Return a tuple containing each key where the candidate was found.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_candidate_in_keyset__doc__,
+"candidate_in_keyset($self, cand, keyset, /)\n"
+"--\n"
+"\n"
+"Search through a keyset for a particular candidate.\n"
+"\n"
+"  cand\n"
+"    Candidate to be searched for.\n"
+"  keyset\n"
+"    Set of keys to search for candidate in.\n"
+"\n"
+"Return a tuple containing each key where the candidate was found.");
+
+#define DATA_STATE_CANDIDATE_IN_KEYSET_METHODDEF    \
+    {"candidate_in_keyset", (PyCFunction)data_State_candidate_in_keyset, METH_VARARGS, data_State_candidate_in_keyset__doc__},
+
+static PyObject *
+data_State_candidate_in_keyset_impl(SudokuStateObject *self, Py_ssize_t cand, PyObject *keyset);
+
+static PyObject *
+data_State_candidate_in_keyset(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    Py_ssize_t cand;
+    PyObject *keyset;
+
+    if (!PyArg_ParseTuple(args,
+        "nO:candidate_in_keyset",
+        &cand, &keyset))
+        goto exit;
+    return_value = data_State_candidate_in_keyset_impl(self, cand, keyset);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_candidate_in_keyset_impl(SudokuStateObject *self, Py_ssize_t cand, PyObject *keyset)
+/*[clinic end generated code: output=50ecdfeee9d24908 input=d9314af58c8b337c]*/
+{
+    PyObject *temp_storage[GRIDSIZE];
+    Py_ssize_t found = 0, i;
+    PyObject *key, *found_keys = NULL, *iter;
+
+    iter = PyObject_GetIter(keyset);
+    if (!iter)
+        return NULL;
+
+    while ((key = PyIter_Next(iter))) {
+        UNPACK_KEY(key, goto done, "candidate_in_keyset");
+
+        if (!CELL_FILLED(self, x, y)) {
+            if (CELL_CANDS(self, x, y) & (1 << cand)) {
+                temp_storage[found++] = key;
+            }
+        }
+    }
+    if (PyErr_Occurred())
+        goto done;
+
+    found_keys = PyTuple_New(found);
+    if (!found_keys)
+        goto done;
+
+    for (i = 0; i < found; i++) {
+        key = temp_storage[i];
+        Py_INCREF(key);
+        PyTuple_SET_ITEM(found_keys, i, key);
+    }
+
+done:
+    Py_DECREF(iter);
+    return found_keys;
+}
+
+/*[clinic input]
+data.State.candidates_from_keyset
+
+    keyset: object
+        Set of keys to search for candidates.
+    /
+
+Get all candidates from a keyset.
+
+Return the union of each candidate set for each of unsolved key in the
+keyset. Ignore solved positions.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_candidates_from_keyset__doc__,
+"candidates_from_keyset($self, keyset, /)\n"
+"--\n"
+"\n"
+"Get all candidates from a keyset.\n"
+"\n"
+"  keyset\n"
+"    Set of keys to search for candidates.\n"
+"\n"
+"Return the union of each candidate set for each of unsolved key in the\n"
+"keyset. Ignore solved positions.");
+
+#define DATA_STATE_CANDIDATES_FROM_KEYSET_METHODDEF    \
+    {"candidates_from_keyset", (PyCFunction)data_State_candidates_from_keyset, METH_O, data_State_candidates_from_keyset__doc__},
+
+static PyObject *
+data_State_candidates_from_keyset(SudokuStateObject *self, PyObject *keyset)
+/*[clinic end generated code: output=2717161bd6408bba input=3017d3ede78897eb]*/
+{
+    uint16_t cands = 0;
+    PyObject *key, *iter;
+
+    iter = PyObject_GetIter(keyset);
+    if (!iter)
+        return NULL;
+
+    while ((key = PyIter_Next(iter))) {
+        UNPACK_KEY(key, goto done, "candidates_from_keyset");
+
+        if (!CELL_FILLED(self, x, y)) {
+            cands |= CELL_CANDS(self, x, y);
+        }
+    }
+
+done:
+    Py_DECREF(iter);
+    if (PyErr_Occurred())
+        return NULL;
+    return build_set(cands);
+}
+
+/* Set a ContradictionError that says where the grid is dead; see errors.py.
+ * kind is "cell" for a cell with no candidates, "house" for a digit with no
+ * place left in a house, or "duplicate" for cells cell and other of a house
+ * that can only be digit. Arguments that don't apply are -1.
+ */
+static void
+set_contradiction(const char *kind, Py_ssize_t cell, Py_ssize_t other,
+    Py_ssize_t house, Py_ssize_t digit)
+{
+    PyObject *msg, *args = NULL, *kwargs = NULL, *integer, *exc;
+
+    if (other >= 0)
+        msg = PyUnicode_FromFormat(
+            "Cells (%zd, %zd) and (%zd, %zd) of house %zd can only be %zd",
+            ROW(cell), COL(cell), ROW(other), COL(other), house, digit+1);
+    else if (cell >= 0)
+        msg = PyUnicode_FromFormat("Empty candidate set at (%zd, %zd)",
+            ROW(cell), COL(cell));
+    else
+        msg = PyUnicode_FromFormat("No place for %zd in house %zd",
+            digit+1, house);
+    if (!msg)
+        return;
+    args = PyTuple_Pack(1, msg);
+    Py_DECREF(msg);
+    if (!args)
+        return;
+
+    kwargs = Py_BuildValue("{s:s}", "kind", kind);
+    if (!kwargs)
+        goto done;
+    if (cell >= 0 && PyDict_SetItemString(kwargs, "key", ikeys[cell]) < 0)
+        goto done;
+    if (digit >= 0 && PyDict_SetItemString(kwargs, "digit", idigits[digit]) < 0)
+        goto done;
+    if (house >= 0) {
+        integer = PyLong_FromSsize_t(house);
+        if (!integer)
+            goto done;
+        if (PyDict_SetItemString(kwargs, "house", integer) < 0) {
+            Py_DECREF(integer);
+            goto done;
+        }
+        Py_DECREF(integer);
+    }
+
+    exc = PyObject_Call(ContradictionError, args, kwargs);
+    if (exc) {
+        PyErr_SetObject(ContradictionError, exc);
+        Py_DECREF(exc);
+    }
+
+done:
+    Py_DECREF(args);
+    Py_XDECREF(kwargs);
+}
+
+/* Look for the dead ends that removing candidates can leave: a cell with no
+ * candidates, a digit with no place left in one of a changed cell's houses,
+ * and two cells of a house that can only be the same digit. changed holds
+ * the cells that were changed and removed[i] the candidates cell i lost.
+ * The checks run in that order, each over the cells in index order; the
+ * first dead end found sets a ContradictionError and returns -1.
+ */
+static int
+check_removals(SudokuStateObject *self, const cellmask *changed,
+    const uint16_t *removed)
+{
+    const grid_layout *layout = self->ss_layout;
+    Py_ssize_t i, k, h, d, n, c;
+    uint16_t bits, others;
+
+    for (i = 0; (i = cm_next(changed, i)) >= 0; i++) {
+        if (!self->ss_cands[i]) {
+            set_contradiction("cell", i, -1, -1, -1);
+            return -1;
+        }
+    }
+
+    /* a digit that lost its last place in a house where it isn't placed */
+    for (i = 0; (i = cm_next(changed, i)) >= 0; i++) {
+        for (k = 0; k < 3; k++) {
+            h = layout->gl_houses[i][k];
+            bits = removed[i] & ~self->ss_houses[h].hi_placed;
+            for (d = 0; bits; d++, bits >>= 1) {
+                if ((bits & 1) && !self->ss_positions[h][d]) {
+                    set_contradiction("house", -1, -1, h, d);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    /* a cell that was just left with one candidate, sharing a house with
+     * another cell that only has the same one */
+    for (i = 0; (i = cm_next(changed, i)) >= 0; i++) {
+        if (!removed[i] || isizes[self->ss_cands[i]] != 1)
+            continue;
+        d = lowest_digit(self->ss_cands[i]);
+        for (k = 0; k < 3; k++) {
+            h = layout->gl_houses[i][k];
+            others = self->ss_positions[h][d] & ~(1 << layout->gl_pos[i][k]);
+            for (n = 0; others; n++, others >>= 1) {
+                c = layout->gl_order[h][n];
+                if ((others & 1) && self->ss_cands[c] == self->ss_cands[i]) {
+                    set_contradiction("duplicate", i, c, h, d);
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* Remove or add the candidates in a ChangeSet; the fast path of
+ * remove_candidates and add_candidates. Raises the same errors as the dict
+ * path.
+ */
+static int
+apply_changeset(SudokuStateObject *self, ChangeSetObject *change, int remove)
+{
+    Py_ssize_t i = 0;
+    uint16_t cands, removed[GRIDSIZE];
+
+    while ((i = cm_next(&change->ch_cells, i)) >= 0) {
+        if (self->ss_values[i] != UNSOLVED) {
+            _PyErr_SetKeyError(ikeys[i]);
+            return -1;
+        }
+        cands = self->ss_cands[i];
+        removed[i] = cands & change->ch_masks[i];
+        cands = remove ? cands & ~change->ch_masks[i]
+                       : cands | change->ch_masks[i];
+        if (cell_update(self, i, UNSOLVED, cands) < 0)
+            return -1;
+        i++;
+    }
+
+    if (remove)
+        return check_removals(self, &change->ch_cells, removed);
+    return 0;
+}
+
+/*[clinic input]
+data.State.eliminations
+
+    keyset: object
+        Iterable of keys to look at.
+    cands: object
+        CandidateSet of candidates to eliminate.
+    /
+
+Make a ChangeSet that removes cands from the cells in keyset.
+
+Each unsolved cell in keyset that has any of cands as candidates maps to
+the ones it has; solved cells and cells without any of them are left out.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_eliminations__doc__,
+"eliminations($self, keyset, cands, /)\n"
+"--\n"
+"\n"
+"Make a ChangeSet that removes cands from the cells in keyset.\n"
+"\n"
+"  keyset\n"
+"    Iterable of keys to look at.\n"
+"  cands\n"
+"    CandidateSet of candidates to eliminate.\n"
+"\n"
+"Each unsolved cell in keyset that has any of cands as candidates maps to\n"
+"the ones it has; solved cells and cells without any of them are left out.");
+
+#define DATA_STATE_ELIMINATIONS_METHODDEF    \
+    {"eliminations", (PyCFunction)data_State_eliminations, METH_VARARGS, data_State_eliminations__doc__},
+
+static PyObject *
+data_State_eliminations_impl(SudokuStateObject *self, PyObject *keyset, PyObject *cands);
+
+static PyObject *
+data_State_eliminations(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    PyObject *keyset;
+    PyObject *cands;
+
+    if (!PyArg_UnpackTuple(args, "eliminations",
+        2, 2,
+        &keyset, &cands))
+        goto exit;
+    return_value = data_State_eliminations_impl(self, keyset, cands);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_eliminations_impl(SudokuStateObject *self, PyObject *keyset, PyObject *cands)
+/*[clinic end generated code: output=fb9f312f5d5116b8 input=aae82c40186737a4]*/
+{
+    ChangeSetObject *change;
+    PyObject *key, *iter;
+    uint16_t mask;
+
+    if (!CandidateSet_Check(cands)) {
+        PyErr_Format(PyExc_TypeError,
+            "eliminations: Expected CandidateSet, not '%.100s'",
+            Py_TYPE(cands)->tp_name);
+        return NULL;
+    }
+    mask = ((CandidateSetObject *)cands)->cs_set;
+
+    iter = PyObject_GetIter(keyset);
+    if (!iter)
+        return NULL;
+    change = changeset_new();
+    if (!change)
+        goto done;
+    while ((key = PyIter_Next(iter))) {
+        UNPACK_KEY(key, Py_DECREF(key); Py_CLEAR(change); goto done,
+                   "eliminations");
+        Py_DECREF(key);
+        if (!CELL_FILLED(self, x, y))
+            changeset_put(change, INDEX(x, y), CELL_CANDS(self, x, y) & mask);
+    }
+    if (PyErr_Occurred())
+        Py_CLEAR(change);
+
+done:
+    Py_DECREF(iter);
+    return (PyObject *)change;
+}
+
+/*[clinic input]
+data.State.add_candidates
+
+    change: object
+        ChangeSet, or dict that maps keys (tuples) to CandidateSet
+        objects. Each CandidateSet represents the candidates to be
+        added to its key.
+    /
+
+Add candidates to a collection of candidate sets.
+
+Note that if this method ends up raising a KeyError, the grid will be in
+disarray, so be careful that only unsolved keys are in the change
+dictionary.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_add_candidates__doc__,
+"add_candidates($self, change, /)\n"
+"--\n"
+"\n"
+"Add candidates to a collection of candidate sets.\n"
+"\n"
+"  change\n"
+"    ChangeSet, or dict that maps keys (tuples) to CandidateSet\n"
+"    objects. Each CandidateSet represents the candidates to be\n"
+"    added to its key.\n"
+"\n"
+"Note that if this method ends up raising a KeyError, the grid will be in\n"
+"disarray, so be careful that only unsolved keys are in the change\n"
+"dictionary.");
+
+#define DATA_STATE_ADD_CANDIDATES_METHODDEF    \
+    {"add_candidates", (PyCFunction)data_State_add_candidates, METH_O, data_State_add_candidates__doc__},
+
+static PyObject *
+data_State_add_candidates(SudokuStateObject *self, PyObject *change)
+/*[clinic end generated code: output=1531225095486dc7 input=9db67fa5898742fa]*/
+{
+    PyObject *key, *value;
+    Py_ssize_t i = 0;
+    uint16_t add_set;
+
+    if (ChangeSet_Check(change)) {
+        if (apply_changeset(self, (ChangeSetObject *)change, 0) < 0)
+            return NULL;
+        Py_RETURN_NONE;
+    }
+    if (!PyDict_Check(change)) {
+        PyErr_Format(PyExc_TypeError,
+            "add_candidates: Expected dict or ChangeSet, not '%.100s'",
+            Py_TYPE(change)->tp_name);
+        return NULL;
+    }
+
+    while (PyDict_Next(change, &i, &key, &value)) {
+        if (!CandidateSet_Check(value)) {
+            PyErr_Format(PyExc_TypeError,
+                "add_candidates: Expected values to be "
+                "CandidateSets, not '%.100s'", Py_TYPE(value)->tp_name);
+            return NULL;
+        }
+
+        UNPACK_KEY(key, return NULL, "add_candidates");
+        if (CELL_FILLED(self, x, y)) {
+            _PyErr_SetKeyError(key);
+            return NULL;
+        }
+        add_set = ((CandidateSetObject *)value)->cs_set;
+        if (cell_update(self, INDEX(x, y), CELL_VALUE(self, x, y),
+                        CELL_CANDS(self, x, y) | add_set) < 0)
+            return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/*[clinic input]
+data.State.remove_candidates
+
+    change: object
+        ChangeSet, or dict that maps keys (tuples) to CandidateSet
+        objects. Each CandidateSet represents the candidates to be
+        removed from its key.
+    /
+
+Remove candidates from a collection of candidate sets.
+
+If the removal leaves the grid dead, this method raises a
+ContradictionError: when a candidate set is left empty, when a digit
+that isn't placed in a house loses its last place there, or when a cell
+is left with one candidate that another cell of one of its houses is
+also left with. The error's kind, key, house and digit attributes say
+which (see errors.py). If you want to have the empty candidate set as
+the candidates for a cell, use set_candidates. Note that if this raises
+a ContradictionError, it will have already removed the candidates from
+the grid.
+
+Note that if this method ends up raising a KeyError, the grid will be in
+disarray, so be careful that only unsolved keys are in the change
+dictionary.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_remove_candidates__doc__,
+"remove_candidates($self, change, /)\n"
+"--\n"
+"\n"
+"Remove candidates from a collection of candidate sets.\n"
+"\n"
+"  change\n"
+"    ChangeSet, or dict that maps keys (tuples) to CandidateSet\n"
+"    objects. Each CandidateSet represents the candidates to be\n"
+"    removed from its key.\n"
+"\n"
+"If the removal leaves the grid dead, this method raises a\n"
+"ContradictionError: when a candidate set is left empty, when a digit\n"
+"that isn\'t placed in a house loses its last place there, or when a cell\n"
+"is left with one candidate that another cell of one of its houses is\n"
+"also left with. The error\'s kind, key, house and digit attributes say\n"
+"which (see errors.py). If you want to have the empty candidate set as\n"
+"the candidates for a cell, use set_candidates. Note that if this raises\n"
+"a ContradictionError, it will have already removed the candidates from\n"
+"the grid.\n"
+"\n"
+"Note that if this method ends up raising a KeyError, the grid will be in\n"
+"disarray, so be careful that only unsolved keys are in the change\n"
+"dictionary.");
+
+#define DATA_STATE_REMOVE_CANDIDATES_METHODDEF    \
+    {"remove_candidates", (PyCFunction)data_State_remove_candidates, METH_O, data_State_remove_candidates__doc__},
+
+static PyObject *
+data_State_remove_candidates(SudokuStateObject *self, PyObject *change)
+/*[clinic end generated code: output=33b97a5be3ed4497 input=34f9ccc0d723c99e]*/
+{
+    PyObject *key, *value;
+    Py_ssize_t i = 0, cell;
+    uint16_t remove_set, removed[GRIDSIZE];
+    cellmask changed;
+
+    if (ChangeSet_Check(change)) {
+        if (apply_changeset(self, (ChangeSetObject *)change, 1) < 0)
+            return NULL;
+        Py_RETURN_NONE;
+    }
+    if (!PyDict_Check(change)) {
+        PyErr_Format(PyExc_TypeError,
+            "remove_candidates: Expected dict or ChangeSet, not '%.100s'",
+            Py_TYPE(change)->tp_name);
+        return NULL;
+    }
+
+    memset(&changed, 0, sizeof(cellmask));
+    while (PyDict_Next(change, &i, &key, &value)) {
+        if (!CandidateSet_Check(value)) {
+            PyErr_Format(PyExc_TypeError,
+                "remove_candidates: Expected values to be "
+                "CandidateSets, not '%.100s'", Py_TYPE(value)->tp_name);
+            return NULL;
+        }
+
+        UNPACK_KEY(key, return NULL, "remove_candidates");
+        if (CELL_FILLED(self, x, y)) {
+            _PyErr_SetKeyError(key);
+            return NULL;
+        }
+        remove_set = ((CandidateSetObject *)value)->cs_set;
+        cell = INDEX(x, y);
+        /* the dict can name a cell twice, as a tuple and as an index */
+        if (!CM_TEST(changed, cell))
+            removed[cell] = 0;
+        removed[cell] |= CELL_CANDS(self, x, y) & remove_set;
+        CM_SET(changed, cell);
+        if (cell_update(self, INDEX(x, y), CELL_VALUE(self, x, y),
+                        CELL_CANDS(self, x, y) & ~remove_set) < 0)
+            return NULL;
+    }
+
+    if (check_removals(self, &changed, removed) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+/*[clinic input]
+data.State.candidate_in_houses
+
+    key: object
+        This is the key that were checking; that is, we're checking
+        the three houses that intersect in this key.
+
+    cand: Py_ssize_t
+        The candidate to check in the houses.
+    /
+
+Check a key's houses for a particular candidate.
+
+The return value is a 3-tuple of ints telling us the candidate count for
+the group, the column, and the row, respectively.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_candidate_in_houses__doc__,
+"candidate_in_houses($self, key, cand, /)\n"
+"--\n"
+"\n"
+"Check a key\'s houses for a particular candidate.\n"
+"\n"
+"  key\n"
+"    This is the key that were checking; that is, we\'re checking\n"
+"    the three houses that intersect in this key.\n"
+"  cand\n"
+"    The candidate to check in the houses.\n"
+"\n"
+"The return value is a 3-tuple of ints telling us the candidate count for\n"
+"the group, the column, and the row, respectively.");
+
+#define DATA_STATE_CANDIDATE_IN_HOUSES_METHODDEF    \
+    {"candidate_in_houses", (PyCFunction)data_State_candidate_in_houses, METH_VARARGS, data_State_candidate_in_houses__doc__},
+
+static PyObject *
+data_State_candidate_in_houses_impl(SudokuStateObject *self, PyObject *key, Py_ssize_t cand);
+
+static PyObject *
+data_State_candidate_in_houses(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    PyObject *key;
+    Py_ssize_t cand;
+
+    if (!PyArg_ParseTuple(args,
+        "On:candidate_in_houses",
+        &key, &cand))
+        goto exit;
+    return_value = data_State_candidate_in_houses_impl(self, key, cand);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_candidate_in_houses_impl(SudokuStateObject *self, PyObject *key, Py_ssize_t cand)
+/*[clinic end generated code: output=94cbf6e76fcc7e95 input=f2631f690a4cc850]*/
+{
+    Py_ssize_t g, c, r;
+
+    if (cand < 0 || cand >= NUMROWS) {
+        PyErr_Format(PyExc_ValueError,
+            "candidate_in_houses: Bad candidate '%d'", cand);
+        return NULL;
+    }
+
+    UNPACK_KEY(key, return NULL, "candidate_in_houses");
+    g = self->ss_counts[self->ss_layout->gl_houses[INDEX(x, y)][0]][cand];
+    c = self->ss_counts[y+COLOFFSET][cand];
+    r = self->ss_counts[x+ROWOFFSET][cand];
+
+    return Py_BuildValue("(nnn)", g, c, r);
+}
+
+/*[clinic input]
+data.State.candidates_from_house
+
+    house: Py_ssize_t
+        Index of the house to report the candidate counts of. This
+        index corresponds to the index of the house in the houses
+        attribute defined in state.py; 0-8 are groups, 9-17 are
+        columns, and 18-26 are rows.
+    /
+
+Get the candidate counts for a house.
+
+The return value is a 9 element tuple of ints. Similarly to the
+num_clues attribute, the int at a particular index represents the
+candidate count for that house. Example:
+
+>>> state.candidates_from_house(18)[3]
+
+gives the number of cells in the top row that can be 3.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_candidates_from_house__doc__,
+"candidates_from_house($self, house, /)\n"
+"--\n"
+"\n"
+"Get the candidate counts for a house.\n"
+"\n"
+"  house\n"
+"    Index of the house to report the candidate counts of. This\n"
+"    index corresponds to the index of the house in the houses\n"
+"    attribute defined in state.py; 0-8 are groups, 9-17 are\n"
+"    columns, and 18-26 are rows.\n"
+"\n"
+"The return value is a 9 element tuple of ints. Similarly to the\n"
+"num_clues attribute, the int at a particular index represents the\n"
+"candidate count for that house. Example:\n"
+"\n"
+">>> state.candidates_from_house(18)[3]\n"
+"\n"
+"gives the number of cells in the top row that can be 3.");
+
+#define DATA_STATE_CANDIDATES_FROM_HOUSE_METHODDEF    \
+    {"candidates_from_house", (PyCFunction)data_State_candidates_from_house, METH_VARARGS, data_State_candidates_from_house__doc__},
+
+static PyObject *
+data_State_candidates_from_house_impl(SudokuStateObject *self, Py_ssize_t house);
+
+static PyObject *
+data_State_candidates_from_house(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    Py_ssize_t house;
+
+    if (!PyArg_ParseTuple(args,
+        "n:candidates_from_house",
+        &house))
+        goto exit;
+    return_value = data_State_candidates_from_house_impl(self, house);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_candidates_from_house_impl(SudokuStateObject *self, Py_ssize_t house)
+/*[clinic end generated code: output=fc684bd7d5663b12 input=e48123f8971ba9b8]*/
+{
+    PyObject *candidates, *integer;
+    uint8_t *cands_count;
+    Py_ssize_t i;
+
+    if (house < 0 || house >= 27) {
+        PyErr_Format(PyExc_ValueError,
+            "Expected a house index in range(0,27), "
+            "but got '%d'", house);
+        return NULL;
+    }
+
+    cands_count = self->ss_counts[house];
+    candidates = PyTuple_New(NUMROWS);
+    if (!candidates)
+        return NULL;
+    for (i = 0; i < NUMROWS; i++) {
+        integer = PyLong_FromLong((long)cands_count[i]);
+        if (!integer) {
+            Py_DECREF(candidates);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(candidates, i, integer);
+    }
+
+    return candidates;
+}
+
+/*[clinic input]
+data.State.digit_positions
+
+    house: Py_ssize_t
+        Index of the house, ordered like the houses attribute.
+    /
+
+Get the positions of each digit in a house.
+
+The return value is a 9 element tuple of ints. Bit n of the int at
+index d is set if houses[house][n] is unsolved and has d as a
+candidate, so the number of set bits is candidates_from_house(house)[d]. Pass a mask
+to keys_at to get the keys of those cells.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_digit_positions__doc__,
+"digit_positions($self, house, /)\n"
+"--\n"
+"\n"
+"Get the positions of each digit in a house.\n"
+"\n"
+"  house\n"
+"    Index of the house, ordered like the houses attribute.\n"
+"\n"
+"The return value is a 9 element tuple of ints. Bit n of the int at\n"
+"index d is set if houses[house][n] is unsolved and has d as a\n"
+"candidate, so the number of set bits is candidates_from_house(house)[d]. Pass a mask\n"
+"to keys_at to get the keys of those cells.");
+
+#define DATA_STATE_DIGIT_POSITIONS_METHODDEF    \
+    {"digit_positions", (PyCFunction)data_State_digit_positions, METH_VARARGS, data_State_digit_positions__doc__},
+
+static PyObject *
+data_State_digit_positions_impl(SudokuStateObject *self, Py_ssize_t house);
+
+static PyObject *
+data_State_digit_positions(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    Py_ssize_t house;
+
+    if (!PyArg_ParseTuple(args,
+        "n:digit_positions",
+        &house))
+        goto exit;
+    return_value = data_State_digit_positions_impl(self, house);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_digit_positions_impl(SudokuStateObject *self, Py_ssize_t house)
+/*[clinic end generated code: output=552cda8dd9ee832e input=ea5444804d5be5f6]*/
+{
+    PyObject *positions, *integer;
+    Py_ssize_t d;
+
+    if (house < 0 || house >= 27) {
+        PyErr_Format(PyExc_ValueError,
+            "Expected a house index in range(0,27), "
+            "but got '%zd'", house);
+        return NULL;
+    }
+
+    positions = PyTuple_New(NUMROWS);
+    if (!positions)
+        return NULL;
+    for (d = 0; d < NUMROWS; d++) {
+        integer = PyLong_FromLong((long)self->ss_positions[house][d]);
+        if (!integer) {
+            Py_DECREF(positions);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(positions, d, integer);
+    }
+
+    return positions;
+}
+
+/*[clinic input]
+data.State.keys_at
+
+    house: Py_ssize_t
+        Index of the house, ordered like the houses attribute.
+    positions: Py_ssize_t
+        Mask of positions in the house, as returned by
+        digit_positions.
+    /
+
+Get the keys of the cells at some positions of a house.
+
+Returns a tuple of keys in the order of houses[house], one for each
+set bit of positions.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_keys_at__doc__,
+"keys_at($self, house, positions, /)\n"
+"--\n"
+"\n"
+"Get the keys of the cells at some positions of a house.\n"
+"\n"
+"  house\n"
+"    Index of the house, ordered like the houses attribute.\n"
+"  positions\n"
+"    Mask of positions in the house, as returned by\n"
+"    digit_positions.\n"
+"\n"
+"Returns a tuple of keys in the order of houses[house], one for each\n"
+"set bit of positions.");
+
+#define DATA_STATE_KEYS_AT_METHODDEF    \
+    {"keys_at", (PyCFunction)data_State_keys_at, METH_VARARGS, data_State_keys_at__doc__},
+
+static PyObject *
+data_State_keys_at_impl(SudokuStateObject *self, Py_ssize_t house, Py_ssize_t positions);
+
+static PyObject *
+data_State_keys_at(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    Py_ssize_t house;
+    Py_ssize_t positions;
+
+    if (!PyArg_ParseTuple(args,
+        "nn:keys_at",
+        &house, &positions))
+        goto exit;
+    return_value = data_State_keys_at_impl(self, house, positions);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_keys_at_impl(SudokuStateObject *self, Py_ssize_t house, Py_ssize_t positions)
+/*[clinic end generated code: output=f8ef5e67e2d7a74f input=cef974739277538f]*/
+{
+    PyObject *keys, *key;
+    Py_ssize_t n, k;
+
+    if (house < 0 || house >= 27) {
+        PyErr_Format(PyExc_ValueError,
+            "Expected a house index in range(0,27), "
+            "but got '%zd'", house);
+        return NULL;
+    }
+    if (positions < 0 || positions > TERMS) {
+        PyErr_Format(PyExc_ValueError,
+            "Expected a position mask in range(0,512), "
+            "but got '%zd'", positions);
+        return NULL;
+    }
+
+    keys = PyTuple_New(isizes[positions]);
+    if (!keys)
+        return NULL;
+    for (n = k = 0; positions; n++, positions >>= 1) {
+        if (positions & 1) {
+            key = ikeys[self->ss_layout->gl_order[house][n]];
+            Py_INCREF(key);
+            PyTuple_SET_ITEM(keys, k++, key);
+        }
+    }
+
+    return keys;
+}
+
+/*[clinic input]
+data.State.strong_links
+
+    digit: Py_ssize_t
+        The digit to report the strong links of, in range(9).
+    /
+
+Get the strong links of a digit.
+
+A strong link is a house in which digit is a candidate of exactly two
+unsolved cells (a conjugate pair), so one of the two cells must be
+digit. Returns a tuple of (house, key1, key2) tuples ordered by house,
+with the keys in the order of houses[house]. The State keeps an index
+of these, so the call doesn't scan the grid.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_strong_links__doc__,
+"strong_links($self, digit, /)\n"
+"--\n"
+"\n"
+"Get the strong links of a digit.\n"
+"\n"
+"  digit\n"
+"    The digit to report the strong links of, in range(9).\n"
+"\n"
+"A strong link is a house in which digit is a candidate of exactly two\n"
+"unsolved cells (a conjugate pair), so one of the two cells must be\n"
+"digit. Returns a tuple of (house, key1, key2) tuples ordered by house,\n"
+"with the keys in the order of houses[house]. The State keeps an index\n"
+"of these, so the call doesn\'t scan the grid.");
+
+#define DATA_STATE_STRONG_LINKS_METHODDEF    \
+    {"strong_links", (PyCFunction)data_State_strong_links, METH_VARARGS, data_State_strong_links__doc__},
+
+static PyObject *
+data_State_strong_links_impl(SudokuStateObject *self, Py_ssize_t digit);
+
+static PyObject *
+data_State_strong_links(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    Py_ssize_t digit;
+
+    if (!PyArg_ParseTuple(args,
+        "n:strong_links",
+        &digit))
+        goto exit;
+    return_value = data_State_strong_links_impl(self, digit);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_strong_links_impl(SudokuStateObject *self, Py_ssize_t digit)
+/*[clinic end generated code: output=a57230bc766b9d1b input=2f742d6e55f3bdf3]*/
+{
+    const grid_layout *layout = self->ss_layout;
+    PyObject *links, *link;
+    uint32_t houses;
+    uint16_t mask;
+    Py_ssize_t h, k, n;
+
+    if (digit < 0 || digit >= NUMROWS) {
+        PyErr_Format(PyExc_ValueError,
+            "strong_links: Bad digit '%zd'", digit);
+        return NULL;
+    }
+
+    houses = self->ss_links[digit];
+    links = PyTuple_New(isizes[houses & TERMS] +
+                        isizes[(houses >> NUMROWS) & TERMS] +
+                        isizes[houses >> (NUMROWS*2)]);
+    if (!links)
+        return NULL;
+    for (h = k = 0; houses; h++, houses >>= 1) {
+        if (!(houses & 1))
+            continue;
+        mask = self->ss_positions[h][digit];
+        n = lowest_digit(mask);
+        link = Py_BuildValue("(nOO)", h,
+            ikeys[layout->gl_order[h][n]],
+            ikeys[layout->gl_order[h][lowest_digit(mask & (mask - 1))]]);
+        if (!link) {
+            Py_DECREF(links);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(links, k++, link);
+    }
+
+    return links;
+}
+
+/* filters for find_rectangles */
+typedef struct {
+    uint16_t rf_required;   /* candidates every corner must have */
+    Py_ssize_t rf_digit;    /* digit every corner must have, or -1 */
+    int rf_bivalue;         /* see find_rectangles */
+    int rf_two_groups;      /* see find_rectangles */
+    int rf_xwing;           /* see find_rectangles */
+} rect_filter;
+
+/* writes rectangles found into pos, and returns num found */
+static Py_ssize_t
+find_rectangles_one_key(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y,
+    const rect_filter *f, PyObject **pos);
+
+/*[clinic input]
+data.State.find_rectangles
+
+    key: object = NULL
+        If not None, then we find all rectangles that have this key as the
+        upper left corner. If this is None, then search the whole grid for
+        rectangles.
+
+    cands: object = NULL
+        If this isn't None, then it should be a CandidateSet. In this case,
+        return only rectangles where each key contains all candidates in the
+        set. Otherwise, return every rectangle that shares at least one
+        candidate.
+
+    *
+
+    digit: object = None
+        If this isn't None, return only rectangles where each key has this
+        digit as a candidate.
+
+    bivalue: bool = False
+        If true, return only rectangles that share exactly two candidates,
+        where at least one key has no other candidates.
+
+    two_groups: bool = False
+        If true, return only rectangles whose keys are in no more than two
+        groups.
+
+    xwing: bool = False
+        If true, return only rectangles where some shared candidate has
+        exactly two places in both rows, or in both columns.
+
+Find rectangles -- four keys in two rows and two columns that share candidates.
+
+This method returns a tuple of found rectangles. A rectangle is a two member
+tuple. The first member of is the set of shared candidates. The second item
+is a tuple of four keys; first: upper left, second: upper right, third:
+lower right, fourth: lower left.
+
+The filters are applied before any tuples are built, and a digit query
+only visits the cells that have the digit.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_find_rectangles__doc__,
+"find_rectangles($self, /, key=None, cands=None, *, digit=None,\n"
+"                bivalue=False, two_groups=False, xwing=False)\n"
+"--\n"
+"\n"
+"Find rectangles -- four keys in two rows and two columns that share candidates.\n"
+"\n"
+"  key\n"
+"    If not None, then we find all rectangles that have this key as the\n"
+"    upper left corner. If this is None, then search the whole grid for\n"
+"    rectangles.\n"
+"  cands\n"
+"    If this isn\'t None, then it should be a CandidateSet. In this case,\n"
+"    return only rectangles where each key contains all candidates in the\n"
+"    set. Otherwise, return every rectangle that shares at least one\n"
+"    candidate.\n"
+"  digit\n"
+"    If this isn\'t None, return only rectangles where each key has this\n"
+"    digit as a candidate.\n"
+"  bivalue\n"
+"    If true, return only rectangles that share exactly two candidates,\n"
+"    where at least one key has no other candidates.\n"
+"  two_groups\n"
+"    If true, return only rectangles whose keys are in no more than two\n"
+"    groups.\n"
+"  xwing\n"
+"    If true, return only rectangles where some shared candidate has\n"
+"    exactly two places in both rows, or in both columns.\n"
+"\n"
+"This method returns a tuple of found rectangles. A rectangle is a two member\n"
+"tuple. The first member of is the set of shared candidates. The second item\n"
+"is a tuple of four keys; first: upper left, second: upper right, third:\n"
+"lower right, fourth: lower left.\n"
+"\n"
+"The filters are applied before any tuples are built, and a digit query\n"
+"only visits the cells that have the digit.");
+
+#define DATA_STATE_FIND_RECTANGLES_METHODDEF    \
+    {"find_rectangles", (PyCFunction)data_State_find_rectangles, METH_VARARGS|METH_KEYWORDS, data_State_find_rectangles__doc__},
+
+static PyObject *
+data_State_find_rectangles_impl(SudokuStateObject *self, PyObject *key, PyObject *cands, PyObject *digit, int bivalue, int two_groups, int xwing);
+
+static PyObject *
+data_State_find_rectangles(SudokuStateObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *return_value = NULL;
+    static char *_keywords[] = {"key", "cands", "digit", "bivalue", "two_groups", "xwing", NULL};
+    PyObject *key = NULL;
+    PyObject *cands = NULL;
+    PyObject *digit = Py_None;
+    int bivalue = 0;
+    int two_groups = 0;
+    int xwing = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "|OO$Oppp:find_rectangles", _keywords,
+        &key, &cands, &digit, &bivalue, &two_groups, &xwing))
+        goto exit;
+    return_value = data_State_find_rectangles_impl(self, key, cands, digit, bivalue, two_groups, xwing);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_find_rectangles_impl(SudokuStateObject *self, PyObject *key, PyObject *cands, PyObject *digit, int bivalue, int two_groups, int xwing)
+/*[clinic end generated code: output=5b605a4c1b7fbfa9 input=a8af5d8e3b1b85dc]*/
+{
+    PyObject *temp_storage[MAXRECT];
+    Py_ssize_t found = 0, i, j, res;
+    PyObject *tuple;
+    rect_filter f;
+
+    if (cands == Py_None)
+        cands = NULL;
+    if (cands && !CandidateSet_Check(cands)) {
+        PyErr_Format(PyExc_TypeError,
+            "find_rectangles: expected CandidateSet or None, not '%.100s'",
+            Py_TYPE(cands)->tp_name);
+        return NULL;
+    }
+    f.rf_required = cands ? ((CandidateSetObject *)cands)->cs_set : 0;
+    f.rf_digit = -1;
+    if (digit != Py_None) {
+        f.rf_digit = PyLong_AsSsize_t(digit);
+        if (f.rf_digit < 0 || f.rf_digit >= NUMROWS) {
+            if (!PyErr_Occurred())
+                PyErr_Format(PyExc_ValueError,
+                    "find_rectangles: Bad digit '%zd'", f.rf_digit);
+            return NULL;
+        }
+    }
+    f.rf_bivalue = bivalue;
+    f.rf_two_groups = two_groups;
+    f.rf_xwing = xwing;
+
+    if (key && key != Py_None) {
+        UNPACK_KEY(key, goto error, "find_rectangles");
+        found = find_rectangles_one_key(self, x, y, &f, temp_storage);
+        if (found < 0)
+            return NULL;
+    } else {
+        for (i = 0; i < NUMROWS-1; i++) {
+            for (j = 0; j < NUMROWS-1; j++) {
+                if (!CELL_FILLED(self, i, j)) {
+                    res = find_rectangles_one_key(self, i, j, &f, temp_storage + found);
+                    if (res < 0)
+                        goto error;
+                    found += res;
+                }
+            }
+        }
+    }
+
+    tuple = PyTuple_New(found);
+    if (!tuple)
+        goto error;
+
+    for (i = 0; i < found; i++) {
+        PyTuple_SET_ITEM(tuple, i, temp_storage[i]);
+    }
+    return tuple;
+
+error:
+    for (i = 0; i < found; i++) {
+        Py_DECREF(temp_storage[i]);
+    }
+    return NULL;
+}
+
+/* true if x is subset of y; see CandidateSet rich compare */
+#define SUBSET(x,y) (((x) | (y)) == (y))
+
+/* Check the bivalue, two_groups and xwing filters for a complete rectangle. */
+static int
+rectangle_wanted(SudokuStateObject *self, const rect_filter *f,
+    uint16_t shared, const Py_ssize_t *corners)
+{
+    Py_ssize_t k, n, g, groups[4], ngroups = 0;
+    uint32_t rows, cols;
+
+    if (f->rf_bivalue) {
+        if (isizes[shared] != 2)
+            return 0;
+        for (k = 0; k < 4; k++) {
+            if (CM_TEST(self->ss_bivalue, corners[k]))
+                break;
+        }
+        if (k == 4)
+            return 0;
+    }
+
+    if (f->rf_two_groups) {
+        for (k = 0; k < 4; k++) {
+            g = self->ss_layout->gl_houses[corners[k]][0];
+            for (n = 0; n < ngroups; n++) {
+                if (groups[n] == g)
+                    break;
+            }
+            if (n == ngroups)
+                groups[ngroups++] = g;
+        }
+        if (ngroups > 2)
+            return 0;
+    }
+
+    if (f->rf_xwing) {
+        /* corners[0] and corners[2] are opposite, so they name both lines */
+        rows = ((uint32_t)1 << (ROWOFFSET + ROW(corners[0]))) |
+               ((uint32_t)1 << (ROWOFFSET + ROW(corners[2])));
+        cols = ((uint32_t)1 << (COLOFFSET + COL(corners[0]))) |
+               ((uint32_t)1 << (COLOFFSET + COL(corners[2])));
+        for (k = 0; k < NUMROWS; k++) {
+            if ((shared & (1 << k)) &&
+                ((self->ss_links[k] & rows) == rows ||
+                 (self->ss_links[k] & cols) == cols))
+                break;
+        }
+        if (k == NUMROWS)
+            return 0;
+    }
+
+    return 1;
+}
+
+static Py_ssize_t
+find_rectangles_one_key(SudokuStateObject *self, Py_ssize_t x, Py_ssize_t y,
+    const rect_filter *f, PyObject **pos)
+{
+    Py_ssize_t found = 0, i, j, corners[4];
+    uint16_t ul_set, required, intersection, tmp;
+    uint16_t across = TERMS, down = TERMS;
+    PyObject *candidate_set, *next_slot;
+
+    if (x == NUMROWS-1 || y == NUMROWS-1) {
+        PyErr_Format(PyExc_ValueError,
+            "find_rectangles: key (%ld, %ld) cannot be the upper left "
+            "corner of a rectangle.", x, y);
+        return -1;
+    }
+    if (CELL_FILLED(self, x, y))
+        return 0;
+
+    required = f->rf_required;
+    if (f->rf_digit >= 0) {
+        required |= 1 << f->rf_digit;
+        /* only the columns where this row has the digit */
+        across = self->ss_positions[ROWOFFSET + x][f->rf_digit];
+    }
+    ul_set = CELL_CANDS(self, x, y);
+    if (!SUBSET(required, ul_set))
+        return 0;
+
+    /* At this point, we've identified a potential upper left corner for
+     * candidate rectangles. We proceed by walking to the right from this
+     * corner, looking for an upper right corner, and then if we find one,
+     * we'll walk down looking for the bottom corners.
+     */
+    for (j = y+1; j < NUMROWS; j++) {
+        if (!(across & (1 << j)))
+            continue;
+        intersection = ul_set;
+        if (!CELL_FILLED(self, x, j)) {
+            intersection &= CELL_CANDS(self, x, j);
+            if (intersection && SUBSET(required, intersection)) {
+                /* we found an upper right corner */
+                tmp = intersection;
+                if (f->rf_digit >= 0)
+                    down = (1 << y) | (1 << j);
+                for (i = x+1; i < NUMROWS; i++) {
+                    if (f->rf_digit >= 0 &&
+                        (self->ss_positions[ROWOFFSET + i][f->rf_digit] & down) != down)
+                        continue;
+                    intersection = tmp;
+                    if (!CELL_FILLED(self, i, y)) {
+                        intersection &= CELL_CANDS(self, i, y);
+                        if (intersection && SUBSET(required, intersection)) {
+                            /* we found a lower left corner; one more to go */
+                            if (!CELL_FILLED(self, i, j)) {
+                                intersection &= CELL_CANDS(self, i, j);
+                                if (intersection && SUBSET(required, intersection)) {
+                                    /* found a complete rectangle */
+                                    corners[0] = INDEX(x, y);
+                                    corners[1] = INDEX(x, j);
+                                    corners[2] = INDEX(i, j);
+                                    corners[3] = INDEX(i, y);
+                                    if (!rectangle_wanted(self, f, intersection, corners))
+                                        continue;
+                                    candidate_set = build_set(intersection);
+                                    if (!candidate_set)
+                                        goto error;
+                                    next_slot = Py_BuildValue("(O(OOOO))",
+                                        /* keys are arranged in clockwise order */
+                                        candidate_set, ikeys[corners[0]],
+                                        ikeys[corners[1]], ikeys[corners[2]],
+                                        ikeys[corners[3]]);
+                                    Py_DECREF(candidate_set);
+                                    if (!next_slot)
+                                        goto error;
+                                    pos[found++] = next_slot;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return found;
+
+error:
+    for (i = 0; i < found; i++) {
+        Py_DECREF(pos[i]);
+    }
+    return -1;
+}
+
+/* Native solver engine. This is a depth first search over the candidate
+ * masks which doesn't create any Python objects while it runs; the only
+ * objects built are the ones needed to write the solution back into the
+ * State. The Python Algorithm framework is still what's used for solves
+ * that need to be explained move by move.
+ */
+
+/* The search works on copies of this struct; it's small enough that copying
+ * it for each guess is cheaper than keeping an undo log.
+ */
+typedef struct {
+    uint16_t sb_cands[GRIDSIZE];    /* candidates; solved cells hold their value's bit */
+    uint16_t sb_placed[NUMROWS*3];  /* digits that are placed in each house */
+    uint8_t sb_solved[GRIDSIZE];    /* nonzero if the cell is solved */
+    Py_ssize_t sb_remaining;        /* number of unsolved cells */
+} solve_board;
+
+typedef struct {
+    Py_ssize_t se_nodes;        /* number of guesses made */
+    Py_ssize_t se_backtracks;   /* number of guesses that failed */
+} solve_stats;
+
+/* Place a digit in a cell and eliminate it from the cell's peers.
+ * Returns -1 on contradiction.
+ */
+static int
+board_place(solve_board *b, const grid_layout *layout, Py_ssize_t i, Py_ssize_t d)
+{
+    uint16_t bit = 1 << d;
+    Py_ssize_t k, n, h, c;
+
+    if (!(b->sb_cands[i] & bit))
+        return -1;
+    b->sb_cands[i] = bit;
+    b->sb_solved[i] = 1;
+    b->sb_remaining--;
+
+    for (k = 0; k < 3; k++) {
+        h = layout->gl_houses[i][k];
+        if (b->sb_placed[h] & bit)
+            return -1;
+        b->sb_placed[h] |= bit;
+        for (n = 0; n < NUMROWS; n++) {
+            c = layout->gl_cells[h][n];
+            if (b->sb_solved[c] || !(b->sb_cands[c] & bit))
+                continue;
+            b->sb_cands[c] &= ~bit;
+            if (!b->sb_cands[c])
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Apply naked singles and hidden singles until nothing changes.
+ * Returns -1 on contradiction.
+ */
+static int
+board_propagate(solve_board *b, const grid_layout *layout)
+{
+    Py_ssize_t i, h, n, c;
+    uint16_t once, twice, set, hidden;
+    int changed = 1;
+
+    while (changed && b->sb_remaining) {
+        changed = 0;
+
+        /* naked singles */
+        for (i = 0; i < GRIDSIZE; i++) {
+            if (!b->sb_solved[i] && isizes[b->sb_cands[i]] == 1) {
+                if (board_place(b, layout, i, lowest_digit(b->sb_cands[i])) < 0)
+                    return -1;
+                changed = 1;
+            }
+        }
+
+        /* hidden singles; this also catches digits with no home in a house */
+        for (h = 0; h < NUMROWS*3; h++) {
+            once = twice = 0;
+            for (n = 0; n < NUMROWS; n++) {
+                c = layout->gl_cells[h][n];
+                if (b->sb_solved[c])
+                    continue;
+                set = b->sb_cands[c];
+                twice |= once & set;
+                once |= set;
+            }
+            if ((once | b->sb_placed[h]) != TERMS)
+                return -1;
+            hidden = once & ~twice & ~b->sb_placed[h];
+            for (n = 0; hidden && n < NUMROWS; n++) {
+                c = layout->gl_cells[h][n];
+                if (b->sb_solved[c] || !(b->sb_cands[c] & hidden))
+                    continue;
+                set = b->sb_cands[c] & hidden;
+                if (isizes[set] > 1)
+                    return -1;
+                if (board_place(b, layout, c, lowest_digit(set)) < 0)
+                    return -1;
+                hidden &= ~set;
+                changed = 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Depth first search. On success, returns 0 and b holds the solution. */
+static int
+board_search(solve_board *b, const grid_layout *layout, solve_stats *stats)
+{
+    solve_board next;
+    Py_ssize_t i, best = -1, size, bestsize = NUMROWS + 1;
+    uint16_t set;
+
+    if (board_propagate(b, layout) < 0)
+        return -1;
+    if (!b->sb_remaining)
+        return 0;
+
+    /* guess in the cell with the fewest candidates */
+    for (i = 0; i < GRIDSIZE; i++) {
+        if (b->sb_solved[i])
+            continue;
+        size = isizes[b->sb_cands[i]];
+        if (size < bestsize) {
+            best = i;
+            bestsize = size;
+            if (size == 2)
+                break;
+        }
+    }
+
+    set = b->sb_cands[best];
+    while (set) {
+        Py_ssize_t d = lowest_digit(set);
+
+        set &= ~(1 << d);
+        stats->se_nodes++;
+        memcpy(&next, b, sizeof(solve_board));
+        if (board_place(&next, layout, best, d) == 0 &&
+            board_search(&next, layout, stats) == 0) {
+            memcpy(b, &next, sizeof(solve_board));
+            return 0;
+        }
+        stats->se_backtracks++;
+    }
+
+    return -1;
+}
+
+/* Build a board from the clues and pencilmarks in a state. Candidates are
+ * also restricted by the clues, in case the pencilmarks haven't been filled.
+ */
+static int
+board_from_state(SudokuStateObject *self, const grid_layout *layout, solve_board *b)
+{
+    Py_ssize_t i, k;
+    uint16_t bit, taken;
+
+    memset(b, 0, sizeof(solve_board));
+    b->sb_remaining = GRIDSIZE;
+    for (i = 0; i < GRIDSIZE; i++) {
+        if (self->ss_values[i] == UNSOLVED)
+            continue;
+        bit = 1 << self->ss_values[i];
+        b->sb_cands[i] = bit;
+        b->sb_solved[i] = 1;
+        b->sb_remaining--;
+        for (k = 0; k < 3; k++) {
+            if (b->sb_placed[layout->gl_houses[i][k]] & bit)
+                return -1;
+            b->sb_placed[layout->gl_houses[i][k]] |= bit;
+        }
+    }
+
+    for (i = 0; i < GRIDSIZE; i++) {
+        if (b->sb_solved[i])
+            continue;
+        taken = 0;
+        for (k = 0; k < 3; k++)
+            taken |= b->sb_placed[layout->gl_houses[i][k]];
+        b->sb_cands[i] = self->ss_cands[i] & ~taken & TERMS;
+        if (!b->sb_cands[i])
+            return -1;
+    }
+
+    return 0;
+}
+
+/*[clinic input]
+data.State.solve_native
+
+Solve the puzzle without going through the Python solver framework.
+
+This does constraint propagation (naked and hidden singles) plus guess
+and backtrack on the candidate sets of unsolved cells, and writes the
+solution into the grid. Solved cells are left with their own digit as
+their candidate set. If the puzzle has several solutions, one of them
+is found.
+
+Returns a 2-tuple of ints; the number of guesses made and the number of
+those guesses that were backtracked. Raises a ContradictionError if the
+puzzle has no solution, in which case the State is left unchanged.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_solve_native__doc__,
+"solve_native($self, /)\n"
+"--\n"
+"\n"
+"Solve the puzzle without going through the Python solver framework.\n"
+"\n"
+"This does constraint propagation (naked and hidden singles) plus guess\n"
+"and backtrack on the candidate sets of unsolved cells, and writes the\n"
+"solution into the grid. Solved cells are left with their own digit as\n"
+"their candidate set. If the puzzle has several solutions, one of them\n"
+"is found.\n"
+"\n"
+"Returns a 2-tuple of ints; the number of guesses made and the number of\n"
+"those guesses that were backtracked. Raises a ContradictionError if the\n"
+"puzzle has no solution, in which case the State is left unchanged.");
+
+#define DATA_STATE_SOLVE_NATIVE_METHODDEF    \
+    {"solve_native", (PyCFunction)data_State_solve_native, METH_NOARGS, data_State_solve_native__doc__},
+
+static PyObject *
+data_State_solve_native_impl(SudokuStateObject *self);
+
+static PyObject *
+data_State_solve_native(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State_solve_native_impl(self);
+}
+
+static PyObject *
+data_State_solve_native_impl(SudokuStateObject *self)
+/*[clinic end generated code: output=4e94314572139f77 input=d0cc2429fe50954e]*/
+{
+    solve_board board;
+    solve_stats stats = {0, 0};
+    Py_ssize_t i;
+
+    if (board_from_state(self, self->ss_layout, &board) < 0 ||
+        board_search(&board, self->ss_layout, &stats) < 0) {
+        PyErr_SetString(ContradictionError, "No solution");
+        return NULL;
+    }
+
+    for (i = 0; i < GRIDSIZE; i++) {
+        if (self->ss_values[i] != UNSOLVED)
+            continue;
+        if (cell_update(self, i, (uint16_t)lowest_digit(board.sb_cands[i]),
+                        board.sb_cands[i]) < 0)
+            return NULL;
+    }
+
+    return Py_BuildValue("(nn)", stats.se_nodes, stats.se_backtracks);
+}
+
+/* Solve a cell and eliminate its digit from the cell's peers, keeping house
+ * candidate counts up to date. Appends (key, digit, house) to log; house is
+ * None for naked singles. Returns -1 with an exception set on error.
+ */
+static int
+propagate_place(SudokuStateObject *self, const grid_layout *layout,
+    Py_ssize_t i, Py_ssize_t d, PyObject *house, PyObject *log)
+{
+    uint16_t bit = 1 << d;
+    Py_ssize_t n, c, empty = -1;
+    PyObject *key, *entry;
+
+    key = build_key(ROW(i), COL(i));
+    if (!key)
+        return -1;
+    entry = Py_BuildValue("(OnO)", key, d, house);
+    Py_DECREF(key);
+    if (!entry || PyList_Append(log, entry) < 0) {
+        Py_XDECREF(entry);
+        return -1;
+    }
+    Py_DECREF(entry);
+    if (cell_update(self, i, (uint16_t)d, self->ss_cands[i]) < 0)
+        return -1;
+
+    for (n = 0; n < layout->gl_npeers[i]; n++) {
+        c = layout->gl_peers[i][n];
+        if (self->ss_values[c] != UNSOLVED ||
+            !(self->ss_cands[c] & bit))
+            continue;
+        if (cell_update(self, c, self->ss_values[c],
+                        self->ss_cands[c] & ~bit) < 0)
+            return -1;
+        if (!self->ss_cands[c])
+            empty = c;
+    }
+
+    if (empty >= 0) {
+        set_contradiction("cell", empty, -1, -1, -1);
+        return -1;
+    }
+    return 0;
+}
+
+/*[clinic input]
+data.State.propagate
+
+Apply naked singles and hidden singles until nothing changes.
+
+Returns a tuple with an entry for each cell that was solved, in the
+order they were solved. Each entry is a 3-tuple (key, digit, house),
+where house is None for a naked single, or the index of the house that
+the hidden single was found in (see candidates_from_house).
+
+Raises a ContradictionError if a cell has no candidates, or
+if a digit has nowhere to go in a house. Like remove_candidates, the
+changes made before the contradiction was found are not undone.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_propagate__doc__,
+"propagate($self, /)\n"
+"--\n"
+"\n"
+"Apply naked singles and hidden singles until nothing changes.\n"
+"\n"
+"Returns a tuple with an entry for each cell that was solved, in the\n"
+"order they were solved. Each entry is a 3-tuple (key, digit, house),\n"
+"where house is None for a naked single, or the index of the house that\n"
+"the hidden single was found in (see candidates_from_house).\n"
+"\n"
+"Raises a ContradictionError if a cell has no candidates, or\n"
+"if a digit has nowhere to go in a house. Like remove_candidates, the\n"
+"changes made before the contradiction was found are not undone.");
+
+#define DATA_STATE_PROPAGATE_METHODDEF    \
+    {"propagate", (PyCFunction)data_State_propagate, METH_NOARGS, data_State_propagate__doc__},
+
+static PyObject *
+data_State_propagate_impl(SudokuStateObject *self);
+
+static PyObject *
+data_State_propagate(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State_propagate_impl(self);
+}
+
+static PyObject *
+data_State_propagate_impl(SudokuStateObject *self)
+/*[clinic end generated code: output=343f8fdc3ce3e6c4 input=04bdcc2b898215eb]*/
+{
+    const grid_layout *layout = self->ss_layout;
+    Py_ssize_t i, h, c, d;
+    uint8_t *counts;
+    uint16_t set, placed;
+    PyObject *log, *house, *result;
+    int changed = 1;
+
+    log = PyList_New(0);
+    if (!log)
+        return NULL;
+
+    while (changed && self->ss_solved < GRIDSIZE) {
+        changed = 0;
+
+        /* naked singles */
+        for (i = 0; i < GRIDSIZE; i++) {
+            set = self->ss_cands[i];
+            if (self->ss_values[i] != UNSOLVED || isizes[set] > 1)
+                continue;
+            if (!set) {
+                set_contradiction("cell", i, -1, -1, -1);
+                goto error;
+            }
+            if (propagate_place(self, layout, i, lowest_digit(set), Py_None, log) < 0)
+                goto error;
+            changed = 1;
+        }
+
+        /* hidden singles, using the house candidate counts */
+        for (h = 0; h < NUMROWS*3; h++) {
+            counts = self->ss_counts[h];
+            placed = self->ss_houses[h].hi_placed;
+
+            for (d = 0; d < NUMROWS; d++) {
+                if (placed & (1 << d))
+                    continue;
+                if (counts[d] == 0) {
+                    set_contradiction("house", -1, -1, h, d);
+                    goto error;
+                }
+                if (counts[d] != 1)
+                    continue;
+                c = layout->gl_order[h][lowest_digit(self->ss_positions[h][d])];
+                house = PyLong_FromSsize_t(h);
+                if (!house)
+                    goto error;
+                if (propagate_place(self, layout, c, d, house, log) < 0) {
+                    Py_DECREF(house);
+                    goto error;
+                }
+                Py_DECREF(house);
+                SET_BIT(placed, d);
+                changed = 1;
+            }
+        }
+    }
+
+    result = PyList_AsTuple(log);
+    Py_DECREF(log);
+    return result;
+
+error:
+    Py_DECREF(log);
+    return NULL;
+}
+
+/*[clinic input]
+data.State.mark
+
+Start a checkpoint in the trail.
+
+While any checkpoint is live, the trail records the old contents of
+every cell that is changed. Returns an int which can be passed to
+rollback to return the grid to the way it was when mark was called.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_mark__doc__,
+"mark($self, /)\n"
+"--\n"
+"\n"
+"Start a checkpoint in the trail.\n"
+"\n"
+"While any checkpoint is live, the trail records the old contents of\n"
+"every cell that is changed. Returns an int which can be passed to\n"
+"rollback to return the grid to the way it was when mark was called.");
+
+#define DATA_STATE_MARK_METHODDEF    \
+    {"mark", (PyCFunction)data_State_mark, METH_NOARGS, data_State_mark__doc__},
+
+static PyObject *
+data_State_mark_impl(SudokuStateObject *self);
+
+static PyObject *
+data_State_mark(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State_mark_impl(self);
+}
+
+/* initial number of trail entries */
+#define TRAILSIZE 256
+
+static PyObject *
+data_State_mark_impl(SudokuStateObject *self)
+/*[clinic end generated code: output=91796d8eb061234c input=c7b4ed4ca7528a1b]*/
+{
+    trail_entry *entry;
+
+    if (!self->ss_trail) {
+        self->ss_trail = PyMem_New(trail_entry, TRAILSIZE);
+        if (!self->ss_trail)
+            return PyErr_NoMemory();
+        self->ss_trail_size = TRAILSIZE;
+        self->ss_trail_len = self->ss_trail_marks = 0;
+    }
+
+    entry = trail_reserve(self);
+    if (!entry)
+        return NULL;
+    entry->te_cell = TRAIL_MARK;
+    entry->te_value = 0;
+    entry->te_candidates = 0;
+    self->ss_trail_marks++;
+    return PyLong_FromSsize_t(self->ss_trail_len++);
+}
+
+/*[clinic input]
+data.State.rollback
+
+    mark: Py_ssize_t
+        A value returned by State.mark.
+    /
+
+Undo every change made to the grid since a checkpoint.
+
+The checkpoint and any made after it are released. Once no checkpoints
+are left, the trail is freed and changes are no longer recorded.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_rollback__doc__,
+"rollback($self, mark, /)\n"
+"--\n"
+"\n"
+"Undo every change made to the grid since a checkpoint.\n"
+"\n"
+"  mark\n"
+"    A value returned by State.mark.\n"
+"\n"
+"The checkpoint and any made after it are released. Once no checkpoints\n"
+"are left, the trail is freed and changes are no longer recorded.");
+
+#define DATA_STATE_ROLLBACK_METHODDEF    \
+    {"rollback", (PyCFunction)data_State_rollback, METH_VARARGS, data_State_rollback__doc__},
+
+static PyObject *
+data_State_rollback_impl(SudokuStateObject *self, Py_ssize_t mark);
+
+static PyObject *
+data_State_rollback(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    Py_ssize_t mark;
+
+    if (!PyArg_ParseTuple(args,
+        "n:rollback",
+        &mark))
+        goto exit;
+    return_value = data_State_rollback_impl(self, mark);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_rollback_impl(SudokuStateObject *self, Py_ssize_t mark)
+/*[clinic end generated code: output=395ef8a410dffc1d input=e39f9aab9c26a808]*/
+{
+    trail_entry *entry;
+
+    if (!self->ss_trail || mark < 0 || mark >= self->ss_trail_len ||
+        self->ss_trail[mark].te_cell != TRAIL_MARK) {
+        PyErr_Format(PyExc_ValueError,
+            "rollback: Bad mark '%zd'", mark);
+        return NULL;
+    }
+
+    while (self->ss_trail_len > mark) {
+        entry = &self->ss_trail[self->ss_trail_len - 1];
+        if (entry->te_cell == TRAIL_MARK)
+            self->ss_trail_marks--;
+        else if (cell_change(self, entry->te_cell, entry->te_value,
+                             entry->te_candidates) < 0)
+            return NULL;
+        self->ss_trail_len--;
+    }
+    if (!self->ss_trail_marks)
+        trail_clear(self);
+
+    Py_RETURN_NONE;
+}
+
+/*[clinic input]
+data.State.changes_since
+
+    token: Py_ssize_t
+        A value of State.epoch.
+    /
+
+Find the houses and keys that have changed since an epoch.
+
+Returns a two member tuple. The first member is a tuple of the indices of
+every house (see State.houses) with a cell that changed after the epoch
+given, and the second member is a tuple of the changed keys. Both are in
+increasing order.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_changes_since__doc__,
+"changes_since($self, token, /)\n"
+"--\n"
+"\n"
+"Find the houses and keys that have changed since an epoch.\n"
+"\n"
+"  token\n"
+"    A value of State.epoch.\n"
+"\n"
+"Returns a two member tuple. The first member is a tuple of the indices of\n"
+"every house (see State.houses) with a cell that changed after the epoch\n"
+"given, and the second member is a tuple of the changed keys. Both are in\n"
+"increasing order.");
+
+#define DATA_STATE_CHANGES_SINCE_METHODDEF    \
+    {"changes_since", (PyCFunction)data_State_changes_since, METH_VARARGS, data_State_changes_since__doc__},
+
+static PyObject *
+data_State_changes_since_impl(SudokuStateObject *self, Py_ssize_t token);
+
+static PyObject *
+data_State_changes_since(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    Py_ssize_t token;
+
+    if (!PyArg_ParseTuple(args,
+        "n:changes_since",
+        &token))
+        goto exit;
+    return_value = data_State_changes_since_impl(self, token);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_changes_since_impl(SudokuStateObject *self, Py_ssize_t token)
+/*[clinic end generated code: output=9108dc35f9145bde input=c66e0f41d05f7a7e]*/
+{
+    PyObject *houses = NULL, *keys = NULL, *item;
+    Py_ssize_t i, n;
+
+    n = 0;
+    for (i = 0; i < NUMROWS*3; i++) {
+        if (self->ss_house_epochs[i] > token)
+            n++;
+    }
+    if ((houses = PyTuple_New(n)) == NULL)
+        goto error;
+    n = 0;
+    for (i = 0; i < NUMROWS*3; i++) {
+        if (self->ss_house_epochs[i] > token) {
+            if ((item = PyLong_FromSsize_t(i)) == NULL)
+                goto error;
+            PyTuple_SET_ITEM(houses, n++, item);
+        }
+    }
+
+    n = 0;
+    for (i = 0; i < GRIDSIZE; i++) {
+        if (self->ss_cell_epochs[i] > token)
+            n++;
+    }
+    if ((keys = PyTuple_New(n)) == NULL)
+        goto error;
+    n = 0;
+    for (i = 0; i < GRIDSIZE; i++) {
+        if (self->ss_cell_epochs[i] > token) {
+            Py_INCREF(ikeys[i]);
+            PyTuple_SET_ITEM(keys, n++, ikeys[i]);
+        }
+    }
+
+    return Py_BuildValue("(NN)", houses, keys);
+
+error:
+    Py_XDECREF(houses);
+    Py_XDECREF(keys);
+    return NULL;
+}
+
+/* state_iterator object */
+
+static PyTypeObject state_iterator_Type;
+typedef struct _ki_ob KeyIterObject;
+
+/* keyiterfuncs return -1 on error or completion, 0 on success.
+ * On success, sets the last two args to the coordinates of the key
+ * to be returned by next.
+ */
+typedef int (*keyiterfunc)(KeyIterObject *, Py_ssize_t *, Py_ssize_t *);
+
+/* Values for ki_yield */
+enum {
+    YIELD_KEYS,         /* key tuples */
+    YIELD_INDICES,      /* cell indices */
+    YIELD_CANDS,        /* CandidateSets */
+    YIELD_VALUES,       /* digits of solved cells */
+    YIELD_CAND_ITEMS,   /* (key, CandidateSet) */
+    YIELD_CLUE_ITEMS,   /* (key, digit) */
+};
+
+struct _ki_ob {
+    PyObject_VAR_HEAD
+    SudokuStateObject *ki_state;
+    PyObject *ki_weakref;
+    keyiterfunc ki_func;
+    Py_ssize_t ki_next_x;
+    Py_ssize_t ki_next_y;
+    Py_ssize_t ki_pos;
+    int ki_yield;               /* what to yield for each cell; see below */
+    PyObject *ki_result;        /* tuple reused by the items iterators */
+    Py_ssize_t ki_data[1];
+};
+
+/* Key iterators are always allocated with room for every cell, so that any
+ * of them can be reused from the free-list; the size is set to the number
+ * of items actually used.
+ */
+static KeyIterObject *keyiter_freelist[MAXFREELIST];
+static int keyiter_numfree = 0;
+
+static KeyIterObject *
+new_keyiter_object(Py_ssize_t nitems, SudokuStateObject *state)
+{
+    KeyIterObject *self;
+
+    if (keyiter_numfree) {
+        self = keyiter_freelist[--keyiter_numfree];
+        PyObject_InitVar((PyVarObject *)self, &state_iterator_Type, nitems);
+    } else {
+        self = PyObject_NewVar(KeyIterObject, &state_iterator_Type, GRIDSIZE);
+        if (!self)
+            return NULL;
+        ((PyVarObject *)self)->ob_size = nitems;
+    }
+    Py_INCREF(state);
+    self->ki_state = state;
+    self->ki_weakref = NULL;
+    self->ki_yield = YIELD_KEYS;
+    self->ki_result = NULL;
+    return self;
+}
+
+static void
+data_KeyIter_dealloc(KeyIterObject *self)
+{
+    PyObject_ClearWeakRefs((PyObject *)self);
+    Py_DECREF(self->ki_state);
+    Py_XDECREF(self->ki_result);
+    if (keyiter_numfree < MAXFREELIST)
+        keyiter_freelist[keyiter_numfree++] = self;
+    else
+        PyObject_Del((PyObject *)self);
+}
+
+/* Returns a (key, value) pair for the items iterators, stealing value. The
+ * last pair is reused if nothing else holds it, the way dict iterators do,
+ * so a loop that unpacks the pairs doesn't allocate.
+ */
+static PyObject *
+keyiter_item(KeyIterObject *self, Py_ssize_t x, Py_ssize_t y, PyObject *value)
+{
+    PyObject *result = self->ki_result;
+
+    if (result && Py_REFCNT(result) == 1) {
+        Py_INCREF(result);
+        Py_DECREF(PyTuple_GET_ITEM(result, 0));
+        Py_DECREF(PyTuple_GET_ITEM(result, 1));
+    } else {
+        result = PyTuple_New(2);
+        if (!result) {
+            Py_DECREF(value);
+            return NULL;
+        }
+        Py_XDECREF(self->ki_result);
+        self->ki_result = result;
+        Py_INCREF(result);
+    }
+    PyTuple_SET_ITEM(result, 0, build_key(x, y));
+    PyTuple_SET_ITEM(result, 1, value);
+    return result;
+}
+
+static PyObject *
+data_KeyIter_iternext(KeyIterObject *self)
+{
+    SudokuStateObject *state = self->ki_state;
+    Py_ssize_t x, y;
+    PyObject *value;
+
+    if (!self->ki_func)
+        return NULL;
+    if (self->ki_func(self, &x, &y) < 0) {
+        self->ki_func = NULL;
+        return NULL;
+    }
+
+    switch (self->ki_yield) {
+    case YIELD_INDICES:
+        return PyLong_FromSsize_t(INDEX(x, y));
+    case YIELD_CANDS:
+        return build_set(CELL_CANDS(state, x, y));
+    case YIELD_VALUES:
+        value = idigits[CELL_VALUE(state, x, y)];
+        Py_INCREF(value);
+        return value;
+    case YIELD_CAND_ITEMS:
+        return keyiter_item(self, x, y, build_set(CELL_CANDS(state, x, y)));
+    case YIELD_CLUE_ITEMS:
+        value = idigits[CELL_VALUE(state, x, y)];
+        Py_INCREF(value);
+        return keyiter_item(self, x, y, value);
+    default:
+        return build_key(x, y);
+    }
+}
+
+/*[clinic input]
+data.state_iterator.indices
+
+Yield cell indices instead of keys.
+
+The iterator is switched to yield ints from 0 to 80, where index
+x * 9 + y is the same cell as key (x, y), and is then returned. The
+ints can be used anywhere the State accepts a key.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_state_iterator_indices__doc__,
+"indices($self, /)\n"
+"--\n"
+"\n"
+"Yield cell indices instead of keys.\n"
+"\n"
+"The iterator is switched to yield ints from 0 to 80, where index\n"
+"x * 9 + y is the same cell as key (x, y), and is then returned. The\n"
+"ints can be used anywhere the State accepts a key.");
+
+#define DATA_STATE_ITERATOR_INDICES_METHODDEF    \
+    {"indices", (PyCFunction)data_state_iterator_indices, METH_NOARGS, data_state_iterator_indices__doc__},
+
+static PyObject *
+data_state_iterator_indices_impl(KeyIterObject *self);
+
+static PyObject *
+data_state_iterator_indices(KeyIterObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_state_iterator_indices_impl(self);
+}
+
+static PyObject *
+data_state_iterator_indices_impl(KeyIterObject *self)
+/*[clinic end generated code: output=cb5a61acd5f34eb8 input=181ad1688f3707e7]*/
+{
+    self->ki_yield = YIELD_INDICES;
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyMethodDef KeyIter_methods[] = {
+    DATA_STATE_ITERATOR_INDICES_METHODDEF
+    {NULL}  /* sentinel */
+};
+
+static PyMemberDef KeyIter_members[] = {
+    {"state", T_OBJECT, offsetof(KeyIterObject, ki_state), READONLY},
+    {"__weakref__", T_OBJECT, offsetof(KeyIterObject, ki_weakref), READONLY},
+    {NULL}  /* sentinel */
+};
+
+static PyTypeObject state_iterator_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "sudoku.data.state_iterator",/*tp_name*/
+    sizeof(KeyIterObject) - sizeof(Py_ssize_t),/*tp_basicsize*/
+    sizeof(Py_ssize_t),         /*tp_itemsize*/
+    /* methods */
+    (destructor)data_KeyIter_dealloc,/*tp_dealloc*/
+    0,                          /*tp_print*/
+    0,                          /*tp_getattr*/
+    0,                          /*tp_setattr*/
+    0,                          /*tp_reserved*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    0,                          /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    0,                          /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    offsetof(KeyIterObject, ki_weakref),/*tp_weaklistoffset*/
+    PyObject_SelfIter,          /*tp_iter*/
+    (iternextfunc)data_KeyIter_iternext,/*tp_iternext*/
+    KeyIter_methods,            /*tp_methods*/
+    KeyIter_members,            /*tp_members*/
+};
+
+/* Iterator methods -- the methods below return a state_iterator */
+
+/* keyiterfunc for ones that calculate their iteration order at
+ * construction time.
+ */
+static int
+precalculated_keyiterfunc(KeyIterObject *ki, Py_ssize_t *x, Py_ssize_t *y)
+{
+    Py_ssize_t i;
+
+    if (ki->ki_pos == Py_SIZE(ki))
+        return -1;
+
+    i = ki->ki_data[ki->ki_pos++];
+    *x = ROW(i);
+    *y = COL(i);
+    return 0;
+}
+
+/* used to iterate in reverse order through a precalculated keyiter */
+static int
+reversed_keyiterfunc(KeyIterObject *ki, Py_ssize_t *x, Py_ssize_t *y)
+{
+    Py_ssize_t i;
+
+    if (--ki->ki_pos == -1)
+        return -1;
+
+    i = ki->ki_data[ki->ki_pos];
+    *x = ROW(i);
+    *y = COL(i);
+    return 0;
+}
+
+static KeyIterObject *
+start_building_precalculated_keyiter(SudokuStateObject *self)
+{
+    KeyIterObject *keyiter;
+    Py_ssize_t size;
+
+    size = GRIDSIZE - self->ss_solved;
+    keyiter = new_keyiter_object(size, self);
+    if (!keyiter)
+        return NULL;
+
+    keyiter->ki_func = precalculated_keyiterfunc;
+    keyiter->ki_pos = 0;
+
+    return keyiter;
+}
+
+static int
+simple_keyiterfunc(KeyIterObject *ki, Py_ssize_t *x, Py_ssize_t *y)
+{
+    Py_ssize_t i, j;
+    SudokuStateObject *state = ki->ki_state;
+
+    for (i = ki->ki_next_x; i < NUMROWS; i++) {
+        for (j = ki->ki_next_y; j < NUMROWS; j++) {
+            if (!CELL_FILLED(state, i, j)) {
+                *x = ki->ki_next_x = i;
+                *y = j;
+                ki->ki_next_y = j + 1;
+                return 0;
+            }
+        }
+        ki->ki_next_y = 0;
+    }
+
+    return -1;
+}
+
+/*[clinic input]
+data.State.order_simple
+
+Iterates over every unsolved key in the grid in simple order.
+
+In other words, it iterates over the unsolved keys, row by row,
+column by column, starting from the upper left corner, down to
+the lower right corner.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_order_simple__doc__,
+"order_simple($self, /)\n"
+"--\n"
+"\n"
+"Iterates over every unsolved key in the grid in simple order.\n"
+"\n"
+"In other words, it iterates over the unsolved keys, row by row,\n"
+"column by column, starting from the upper left corner, down to\n"
+"the lower right corner.");
+
+#define DATA_STATE_ORDER_SIMPLE_METHODDEF    \
+    {"order_simple", (PyCFunction)data_State_order_simple, METH_NOARGS, data_State_order_simple__doc__},
+
+static PyObject *
+data_State_order_simple_impl(SudokuStateObject *self);
+
+static PyObject *
+data_State_order_simple(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State_order_simple_impl(self);
+}
+
+static PyObject *
+data_State_order_simple_impl(SudokuStateObject *self)
+/*[clinic end generated code: output=27d373786f84cfdd input=a7c7e0b5ad9b4701]*/
+{
+    KeyIterObject *keyiter;
+
+    keyiter = new_keyiter_object(0, self);
+    if (keyiter) {
+        keyiter->ki_func = simple_keyiterfunc;
+        keyiter->ki_next_x = 0;
+        keyiter->ki_next_y = 0;
+    }
+
+    return (PyObject *)keyiter;
+}
+
+/* walks the solved cell mask; ki_next_x is the next cell index */
+static int
+solved_keyiterfunc(KeyIterObject *ki, Py_ssize_t *x, Py_ssize_t *y)
+{
+    Py_ssize_t i;
+
+    if (ki->ki_next_x >= GRIDSIZE)
+        return -1;
+    i = cm_next(&ki->ki_state->ss_solvedmask, ki->ki_next_x);
+    if (i < 0)
+        return -1;
+
+    ki->ki_next_x = i + 1;
+    *x = ROW(i);
+    *y = COL(i);
+    return 0;
+}
+
+/*[clinic input]
+data.State.order_solved
+
+Iterate through all solved keys in simple order.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_order_solved__doc__,
+"order_solved($self, /)\n"
+"--\n"
+"\n"
+"Iterate through all solved keys in simple order.");
+
+#define DATA_STATE_ORDER_SOLVED_METHODDEF    \
+    {"order_solved", (PyCFunction)data_State_order_solved, METH_NOARGS, data_State_order_solved__doc__},
+
+static PyObject *
+data_State_order_solved_impl(SudokuStateObject *self);
+
+static PyObject *
+data_State_order_solved(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State_order_solved_impl(self);
+}
+
+static PyObject *
+data_State_order_solved_impl(SudokuStateObject *self)
+/*[clinic end generated code: output=c31b4dc27ab34e7c input=8d145a6787d1635c]*/
+{
+    KeyIterObject *keyiter;
+
+    keyiter = new_keyiter_object(0, self);
+    if (keyiter) {
+        keyiter->ki_func = solved_keyiterfunc;
+        keyiter->ki_next_x = 0;
+        keyiter->ki_next_y = 0;
+    }
+
+    return (PyObject *)keyiter;
+}
+
+/* walks the bucket for a candidate count; ki_next_x is the next cell index */
+static int
+exactly_n_keyiterfunc(KeyIterObject *ki, Py_ssize_t *x, Py_ssize_t *y)
+{
+    Py_ssize_t i;
+
+    if (ki->ki_next_x >= GRIDSIZE)
+        return -1;
+    i = cm_next(&ki->ki_state->ss_buckets[ki->ki_pos], ki->ki_next_x);
+    if (i < 0)
+        return -1;
+
+    ki->ki_next_x = i + 1;
+    *x = ROW(i);
+    *y = COL(i);
+    return 0;
+}
+
+/*[clinic input]
+data.State.order_exactly_n
+
+    count: Py_ssize_t
+        Yield keys with this many candidates.
+    /
+
+Yield keys that have a certain number of candidates.
+
+Raises a ValueError if an insane count is given.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_order_exactly_n__doc__,
+"order_exactly_n($self, count, /)\n"
+"--\n"
+"\n"
+"Yield keys that have a certain number of candidates.\n"
+"\n"
+"  count\n"
+"    Yield keys with this many candidates.\n"
+"\n"
+"Raises a ValueError if an insane count is given.");
+
+#define DATA_STATE_ORDER_EXACTLY_N_METHODDEF    \
+    {"order_exactly_n", (PyCFunction)data_State_order_exactly_n, METH_VARARGS, data_State_order_exactly_n__doc__},
+
+static PyObject *
+data_State_order_exactly_n_impl(SudokuStateObject *self, Py_ssize_t count);
+
+static PyObject *
+data_State_order_exactly_n(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    Py_ssize_t count;
+
+    if (!PyArg_ParseTuple(args,
+        "n:order_exactly_n",
+        &count))
+        goto exit;
+    return_value = data_State_order_exactly_n_impl(self, count);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_order_exactly_n_impl(SudokuStateObject *self, Py_ssize_t count)
+/*[clinic end generated code: output=6d3ad1cb29c50356 input=f5d4d02978352105]*/
+{
+    KeyIterObject *keyiter;
+
+    if (count < 0 || count > NUMROWS) {
+        PyErr_Format(PyExc_ValueError,
+            "order_exactly_n: Bad candidate count '%d'", count);
+        return NULL;
+    }
+
+    keyiter = new_keyiter_object(0, self);
+    if (keyiter) {
+        keyiter->ki_func = exactly_n_keyiterfunc;
+        keyiter->ki_next_x = 0;
+        keyiter->ki_next_y = 0;
+        keyiter->ki_pos = count;    /* use pos to store the bucket */
+    }
+
+    return (PyObject *)keyiter;
+}
+
+/*[clinic input]
+data.State.first_exactly_n
+
+    count: Py_ssize_t
+        Number of candidates.
+    /
+
+Return the first key that has a certain number of candidates, or None.
+
+This is the same as the first key yielded by order_exactly_n, but it
+doesn't scan the grid or build an iterator.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_first_exactly_n__doc__,
+"first_exactly_n($self, count, /)\n"
+"--\n"
+"\n"
+"Return the first key that has a certain number of candidates, or None.\n"
+"\n"
+"  count\n"
+"    Number of candidates.\n"
+"\n"
+"This is the same as the first key yielded by order_exactly_n, but it\n"
+"doesn\'t scan the grid or build an iterator.");
+
+#define DATA_STATE_FIRST_EXACTLY_N_METHODDEF    \
+    {"first_exactly_n", (PyCFunction)data_State_first_exactly_n, METH_VARARGS, data_State_first_exactly_n__doc__},
+
+static PyObject *
+data_State_first_exactly_n_impl(SudokuStateObject *self, Py_ssize_t count);
+
+static PyObject *
+data_State_first_exactly_n(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    Py_ssize_t count;
+
+    if (!PyArg_ParseTuple(args,
+        "n:first_exactly_n",
+        &count))
+        goto exit;
+    return_value = data_State_first_exactly_n_impl(self, count);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_first_exactly_n_impl(SudokuStateObject *self, Py_ssize_t count)
+/*[clinic end generated code: output=a782314bd1e5609a input=53e7bf7e1b09e28e]*/
+{
+    Py_ssize_t i;
+
+    if (count < 0 || count > NUMROWS) {
+        PyErr_Format(PyExc_ValueError,
+            "first_exactly_n: Bad candidate count '%d'", count);
+        return NULL;
+    }
+
+    i = cm_next(&self->ss_buckets[count], 0);
+    if (i < 0)
+        Py_RETURN_NONE;
+    return build_key(ROW(i), COL(i));
+}
+
+/*[clinic input]
+data.State.count_exactly_n
+
+    count: Py_ssize_t
+        Number of candidates.
+    /
+
+Return the number of keys that have a certain number of candidates.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_count_exactly_n__doc__,
+"count_exactly_n($self, count, /)\n"
+"--\n"
+"\n"
+"Return the number of keys that have a certain number of candidates.\n"
+"\n"
+"  count\n"
+"    Number of candidates.");
+
+#define DATA_STATE_COUNT_EXACTLY_N_METHODDEF    \
+    {"count_exactly_n", (PyCFunction)data_State_count_exactly_n, METH_VARARGS, data_State_count_exactly_n__doc__},
+
+static PyObject *
+data_State_count_exactly_n_impl(SudokuStateObject *self, Py_ssize_t count);
+
+static PyObject *
+data_State_count_exactly_n(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    Py_ssize_t count;
+
+    if (!PyArg_ParseTuple(args,
+        "n:count_exactly_n",
+        &count))
+        goto exit;
+    return_value = data_State_count_exactly_n_impl(self, count);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_count_exactly_n_impl(SudokuStateObject *self, Py_ssize_t count)
+/*[clinic end generated code: output=eeb3cb417b62833a input=47e491fe71990759]*/
+{
+    if (count < 0 || count > NUMROWS) {
+        PyErr_Format(PyExc_ValueError,
+            "count_exactly_n: Bad candidate count '%d'", count);
+        return NULL;
+    }
+
+    return PyLong_FromSsize_t(cm_count(&self->ss_buckets[count]));
+}
+
+/*[clinic input]
+data.State.fewest_candidates
+
+Return the unsolved key with the fewest candidates, or None.
+
+Ties are broken the same way as order_by_num_candidates, so this is the
+first key that it would yield.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_fewest_candidates__doc__,
+"fewest_candidates($self, /)\n"
+"--\n"
+"\n"
+"Return the unsolved key with the fewest candidates, or None.\n"
+"\n"
+"Ties are broken the same way as order_by_num_candidates, so this is the\n"
+"first key that it would yield.");
+
+#define DATA_STATE_FEWEST_CANDIDATES_METHODDEF    \
+    {"fewest_candidates", (PyCFunction)data_State_fewest_candidates, METH_NOARGS, data_State_fewest_candidates__doc__},
+
+static PyObject *
+data_State_fewest_candidates_impl(SudokuStateObject *self);
+
+static PyObject *
+data_State_fewest_candidates(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State_fewest_candidates_impl(self);
+}
+
+static PyObject *
+data_State_fewest_candidates_impl(SudokuStateObject *self)
+/*[clinic end generated code: output=517e2b224a194908 input=6dd9397f93080a7d]*/
+{
+    Py_ssize_t n, i;
+
+    for (n = 0; n <= NUMROWS; n++) {
+        i = cm_next(&self->ss_buckets[n], 0);
+        if (i >= 0)
+            return build_key(ROW(i), COL(i));
+    }
+    Py_RETURN_NONE;
+}
+
+/*[clinic input]
+data.State.order_random
+
+Yields unsolved keys in random order.
+
+Each unsolved key will be given exactly once.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_order_random__doc__,
+"order_random($self, /)\n"
+"--\n"
+"\n"
+"Yields unsolved keys in random order.\n"
+"\n"
+"Each unsolved key will be given exactly once.");
+
+#define DATA_STATE_ORDER_RANDOM_METHODDEF    \
+    {"order_random", (PyCFunction)data_State_order_random, METH_NOARGS, data_State_order_random__doc__},
+
+static PyObject *
+data_State_order_random_impl(SudokuStateObject *self);
+
+static PyObject *
+data_State_order_random(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State_order_random_impl(self);
+}
+
+static PyObject *
+data_State_order_random_impl(SudokuStateObject *self)
+/*[clinic end generated code: output=03fbc0486f11a6cf input=d356deba3306ee04]*/
+{
+    KeyIterObject *ki;
+    Py_ssize_t seen[GRIDSIZE];
+    Py_ssize_t numtries, i, found = 0, key = 0;
+
+    ki = start_building_precalculated_keyiter(self);
+    if (!ki)
+        return NULL;
+    if (!Py_SIZE(ki))
+        return (PyObject *)ki;
+    numtries = Py_SIZE(ki)/6 + 1;
+
+    uint8_t tries[numtries];
+
+    memset(seen, 0, sizeof(Py_ssize_t) * GRIDSIZE);
+    if (_PyOS_URandom((void *)tries, numtries) < 0)
+        return NULL;
+
+    /* First generate keys by trying a few keys randomly. Numbers are generated
+     * by operating system random, such as /dev/urandom.
+     */
+    for (i = 0; i < numtries; i++) {
+        key = (Py_ssize_t)(tries[i] % GRIDSIZE);
+
+        if (seen[key])
+            continue;
+        seen[key] = 1;
+
+        if (self->ss_values[key] != UNSOLVED)
+            continue;
+        ki->ki_data[found++] = key;
+        if (found == Py_SIZE(ki))
+            break;
+    }
+
+    /* Then visit the rest of the unsolved keys by walking the grid in a seemingly
+     * random order, inspired by the probe order of dicts.
+     */
+    while (found < Py_SIZE(ki)) {
+        key = ((key << 2) + key + 1) & 127;
+        if (key >= 81)
+            continue;
+
+        if (seen[key])
+            continue;
+        seen[key] = 1;
+
+        if (self->ss_values[key] != UNSOLVED)
+            continue;
+        ki->ki_data[found++] = key;
+    }
+
+    return (PyObject *)ki;
+}
+
+/*[clinic input]
+data.State.order_by_num_candidates
+
+Yields keys based on the size of their candidate sets.
+
+That is, keys with one candidate will be yielded, followed by keys with
+two candidates, and so on. Indices with the same number of candidates
+will be ordered the same as order_simple.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_order_by_num_candidates__doc__,
+"order_by_num_candidates($self, /)\n"
+"--\n"
+"\n"
+"Yields keys based on the size of their candidate sets.\n"
+"\n"
+"That is, keys with one candidate will be yielded, followed by keys with\n"
+"two candidates, and so on. Indices with the same number of candidates\n"
+"will be ordered the same as order_simple.");
+
+#define DATA_STATE_ORDER_BY_NUM_CANDIDATES_METHODDEF    \
+    {"order_by_num_candidates", (PyCFunction)data_State_order_by_num_candidates, METH_NOARGS, data_State_order_by_num_candidates__doc__},
+
+static PyObject *
+data_State_order_by_num_candidates_impl(SudokuStateObject *self);
+
+static PyObject *
+data_State_order_by_num_candidates(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State_order_by_num_candidates_impl(self);
+}
+
+static PyObject *
+data_State_order_by_num_candidates_impl(SudokuStateObject *self)
+/*[clinic end generated code: output=69277346c6c15a8a input=f9364d2884949c99]*/
+{
+    KeyIterObject *ki;
+    Py_ssize_t n, i, found = 0;
+
+    ki = start_building_precalculated_keyiter(self);
+    if (!ki)
+        return NULL;
+
+    /* The buckets are already sorted by cell index, so just concatenate them */
+    for (n = 0; n <= NUMROWS; n++) {
+        for (i = cm_next(&self->ss_buckets[n], 0); i >= 0;
+             i = cm_next(&self->ss_buckets[n], i + 1)) {
+            ki->ki_data[found++] = i;
+        }
+    }
+
+    return (PyObject *)ki;
+}
+
+/*[clinic input]
+data.State.order_by_num_candidates_rev
+
+Same as order_by_num_candidates but in reverse order.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_order_by_num_candidates_rev__doc__,
+"order_by_num_candidates_rev($self, /)\n"
+"--\n"
+"\n"
+"Same as order_by_num_candidates but in reverse order.");
+
+#define DATA_STATE_ORDER_BY_NUM_CANDIDATES_REV_METHODDEF    \
+    {"order_by_num_candidates_rev", (PyCFunction)data_State_order_by_num_candidates_rev, METH_NOARGS, data_State_order_by_num_candidates_rev__doc__},
+
+static PyObject *
+data_State_order_by_num_candidates_rev_impl(SudokuStateObject *self);
+
+static PyObject *
+data_State_order_by_num_candidates_rev(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State_order_by_num_candidates_rev_impl(self);
+}
+
+static PyObject *
+data_State_order_by_num_candidates_rev_impl(SudokuStateObject *self)
+/*[clinic end generated code: output=fca4277364ba9fb5 input=1a0cffd6bf5d4d36]*/
+{
+    KeyIterObject *ki
+        = (KeyIterObject *)data_State_order_by_num_candidates_impl(self);
+    if (!ki)
+        return NULL;
+    ki->ki_func = reversed_keyiterfunc;
+    ki->ki_pos = Py_SIZE(ki);
+    return (PyObject *)ki;
+}
+
+/* pickle support */
+
+/* Create a dictionary containing either clues or candidates; used by pickle functions
+ * and candidates/clues types. 
+ */
+typedef enum { CLUES, CANDS, } whichdict;
+
+static PyObject *
+build_dict(SudokuStateObject *state, whichdict wd, int hidden)
+{
+    Py_ssize_t i, j;
+    PyObject *dict, *key = NULL, *value = NULL;
+
+    dict = PyDict_New();
+    if (!dict)
+        return NULL;
+
+    for (i = 0; i < NUMROWS; i++) {
+        for (j = 0; j < NUMROWS; j++) {
+            key = build_key(i, j);
+            if (!key)
+                goto error;
+
+            switch (wd) {
+            case CLUES:
+                if (CELL_FILLED(state, i, j)) {
+                    value = PyLong_FromLong((long)CELL_VALUE(state, i, j));
+                    break;
+                }
+                goto decref;
+            case CANDS:
+                if (!CELL_FILLED(state, i ,j) ||
+                    (hidden && CELL_CANDS(state, i, j) > 0)) {
+                    value = build_set(CELL_CANDS(state, i, j));
+                    break;
+                }
+                goto decref;
+            default:
+                PyErr_Format(PyExc_SystemError,
+                    "Bad arg to build_dict: '%d'", wd);
+                goto error;
+            }
+
+            if (!value) {
+                Py_DECREF(key);
+                goto error;
+            }
+
+            if (PyDict_SetItem(dict, key, value) < 0) {
+                Py_DECREF(key);
+                Py_DECREF(value);
+                goto error;
+            }
+
+            Py_DECREF(value);
+        decref:
+            Py_DECREF(key);
+        }
+    }
+
+    return dict;
+
+error:
+    Py_DECREF(dict);
+    return NULL;
+}
+
+/*[clinic input]
+data.State.__setstate__
+
+    state: object
+        A tuple; the first item is a dictionary that contains
+        CandidateSets for keys with candidate data. The second
+        item is the movehook from the pickled State object. The
+        third is the object's dict in case dynamic attributes were
+        assigned.
+    /
+
+Unpickle a State.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State___setstate____doc__,
+"__setstate__($self, state, /)\n"
+"--\n"
+"\n"
+"Unpickle a State.\n"
+"\n"
+"  state\n"
+"    A tuple; the first item is a dictionary that contains\n"
+"    CandidateSets for keys with candidate data. The second\n"
+"    item is the movehook from the pickled State object. The\n"
+"    third is the object\'s dict in case dynamic attributes were\n"
+"    assigned.");
+
+#define DATA_STATE___SETSTATE___METHODDEF    \
+    {"__setstate__", (PyCFunction)data_State___setstate__, METH_O, data_State___setstate____doc__},
+
+static PyObject *
+data_State___setstate__(SudokuStateObject *self, PyObject *state)
+/*[clinic end generated code: output=fa2f67e79e613542 input=d79485c6f1f74158]*/
+{
+    PyObject *cands, *key, *value, *hook, *dict;
+    Py_ssize_t i = 0;
+    uint16_t set;
+
+    if (!PyTuple_Check(state) || PyTuple_GET_SIZE(state) != 3) {
+        PyErr_Format(PyExc_TypeError,
+            "__setstate__: Expected tuple, not '%.100s'",
+            Py_TYPE(state)->tp_name);
+        return NULL;
+    }
+    cands = PyTuple_GET_ITEM(state, 0);
+    if (!PyDict_Check(cands)) {
+        PyErr_Format(PyExc_TypeError,
+            "__setstate__: Expected first item to be dict, not '%.100s'",
+            Py_TYPE(cands)->tp_name);
+        return NULL;
+    }
+
+    while (PyDict_Next(cands, &i, &key, &value)) {
+        if (!CandidateSet_Check(value)) {
+            PyErr_Format(PyExc_TypeError,
+                "__setstate__: Expected value to be CandidateSet, not '%.100s'",
+                Py_TYPE(value)->tp_name);
+            return NULL;
+        }
+        set = ((CandidateSetObject *)value)->cs_set;
+
+        UNPACK_KEY(key, return NULL, "__setstate__");
+        if (cell_update(self, INDEX(x, y), CELL_VALUE(self, x, y), set) < 0)
+            return NULL;
+    }
+
+    dict = PyTuple_GET_ITEM(state, 2);
+    if (dict != Py_None) {
+        if (!PyDict_Check(dict)) {
+            PyErr_Format(PyExc_TypeError,
+            "__setstate__: Expected third item to be dict, not '%.100s'",
+            Py_TYPE(dict)->tp_name);
+            return NULL;
+        }
+        self->ss_dict = PyDict_New();
+        if (!self->ss_dict)
+            return NULL;
+        i = 0;
+        while (PyDict_Next(dict, &i, &key, &value)) {
+            if (PyDict_SetItem(self->ss_dict, key, value) < 0)
+                return NULL;
+        }
+    }
+
+    hook = PyTuple_GET_ITEM(state, 1);
+    if (hook != Py_None) {
+        Py_INCREF(hook);
+        self->ss_movehook = hook;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/*[clinic input]
+data.State.__reduce__
+
+Pickle support for State objects.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State___reduce____doc__,
+"__reduce__($self, /)\n"
+"--\n"
+"\n"
+"Pickle support for State objects.");
+
+#define DATA_STATE___REDUCE___METHODDEF    \
+    {"__reduce__", (PyCFunction)data_State___reduce__, METH_NOARGS, data_State___reduce____doc__},
+
+static PyObject *
+data_State___reduce___impl(SudokuStateObject *self);
+
+static PyObject *
+data_State___reduce__(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State___reduce___impl(self);
+}
+
+static PyObject *
+data_State___reduce___impl(SudokuStateObject *self)
+/*[clinic end generated code: output=45f0bbd5e088a3b2 input=738d173648e54c86]*/
+{
+    PyObject *clues, *cands, *reduction;
+    Py_ssize_t len = self->ss_dict ? PyDict_Size(self->ss_dict) : 0;
+    if (len < 0)
+        return NULL;
+
+    clues = build_dict(self, CLUES, 0);
+    if (!clues)
+        return NULL;
+    cands = build_dict(self, CANDS, 1);
+    if (!cands) {
+        Py_DECREF(clues);
+        return NULL;
+    }
+
+    reduction = Py_BuildValue("(O(OOO)(OOO))",
+        Py_TYPE(self),
+        clues,
+        Py_False,   /* causes __init__ to not fill in pencilmarks */
+        self->ss_config == default_config ? Py_None :
+            PyDict_Check(self->ss_grconfig) ? self->ss_grconfig :
+            ((CompiledConfigObject *)self->ss_config)->cc_grconfig,
+        cands,
+        self->ss_movehook ? self->ss_movehook : Py_None,
+        len > 0 ? self->ss_dict : Py_None);
+    Py_DECREF(clues);
+    Py_DECREF(cands);
+
+    return reduction;
+}
+
+/*[clinic input]
+data.State.reset
+
+    clues: object
+        A dictionary that maps positions in the sudoku grid to numbers
+        in range(9).
+
+    dofill: bool = True
+        If true, then fill in pencilmarks.
+
+Reuse the State for a new puzzle with the same group configuration.
+
+This is the same as calling __init__ again with the same grconfig, except
+that the configuration isn't looked up again.
+The trail and the movehook are cleared; dynamic attributes are kept.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_reset__doc__,
+"reset($self, /, clues, dofill=True)\n"
+"--\n"
+"\n"
+"Reuse the State for a new puzzle with the same group configuration.\n"
+"\n"
+"  clues\n"
+"    A dictionary that maps positions in the sudoku grid to numbers\n"
+"    in range(9).\n"
+"  dofill\n"
+"    If true, then fill in pencilmarks.\n"
+"\n"
+"This is the same as calling __init__ again with the same grconfig, except\n"
+"that the configuration isn\'t looked up again.\n"
+"The trail and the movehook are cleared; dynamic attributes are kept.");
+
+#define DATA_STATE_RESET_METHODDEF    \
+    {"reset", (PyCFunction)data_State_reset, METH_VARARGS|METH_KEYWORDS, data_State_reset__doc__},
+
+static PyObject *
+data_State_reset_impl(SudokuStateObject *self, PyObject *clues, int dofill);
+
+static PyObject *
+data_State_reset(SudokuStateObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *return_value = NULL;
+    static char *_keywords[] = {"clues", "dofill", NULL};
+    PyObject *clues;
+    int dofill = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "O|p:reset", _keywords,
+        &clues, &dofill))
+        goto exit;
+    return_value = data_State_reset_impl(self, clues, dofill);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_reset_impl(SudokuStateObject *self, PyObject *clues, int dofill)
+/*[clinic end generated code: output=2222de244fd9080e input=3f13c84d33add1f9]*/
+{
+    if (!self->ss_config) {
+        PyErr_SetString(PyExc_ValueError, "reset: State is not initialized");
+        return NULL;
+    }
+    if (load_clues(self, clues, dofill, "reset") < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+/*[clinic input]
+data.State.clone
+
+Return a copy of the State.
+
+The grid is copied directly, and the copy shares the group configuration
+with the original. Dynamic attributes are copied shallowly. The trail and
+the movehook are not copied, since they belong to whoever is driving the
+original State. Also available as __copy__.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_clone__doc__,
+"clone($self, /)\n"
+"--\n"
+"\n"
+"Return a copy of the State.\n"
+"\n"
+"The grid is copied directly, and the copy shares the group configuration\n"
+"with the original. Dynamic attributes are copied shallowly. The trail and\n"
+"the movehook are not copied, since they belong to whoever is driving the\n"
+"original State. Also available as __copy__.");
+
+#define DATA_STATE_CLONE_METHODDEF    \
+    {"clone", (PyCFunction)data_State_clone, METH_NOARGS, data_State_clone__doc__},
+
+static PyObject *
+data_State_clone_impl(SudokuStateObject *self);
+
+static PyObject *
+data_State_clone(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State_clone_impl(self);
+}
+
+static PyObject *
+data_State_clone_impl(SudokuStateObject *self)
+/*[clinic end generated code: output=e347b379657d6ae4 input=543f3a769d62ab45]*/
+{
+    SudokuStateObject *copy;
+
+    if (!self->ss_config) {
+        PyErr_SetString(PyExc_ValueError, "clone: State is not initialized");
+        return NULL;
+    }
+
+    copy = (SudokuStateObject *)Py_TYPE(self)->tp_alloc(Py_TYPE(self), 0);
+    if (!copy)
+        return NULL;
+
+    /* Everything after the object header is plain data or a reference that
+     * is fixed up below.
+     */
+    memcpy((char *)copy + sizeof(PyObject), (char *)self + sizeof(PyObject),
+           sizeof(SudokuStateObject) - sizeof(PyObject));
+    copy->ss_movehook = NULL;
+    copy->ss_weakref = NULL;
+    copy->ss_dict = NULL;
+    copy->ss_trail = NULL;
+    copy->ss_trail_len = copy->ss_trail_size = copy->ss_trail_marks = 0;
+
+    Py_INCREF(copy->ss_config);
+    Py_INCREF(copy->ss_grconfig);
+    Py_INCREF(copy->ss_peers);
+    Py_INCREF(copy->ss_subgroups);
+    Py_INCREF(copy->ss_housekeys);
+    Py_INCREF(copy->ss_oneset);
+
+    if (self->ss_dict && PyDict_Size(self->ss_dict) > 0) {
+        if ((copy->ss_dict = PyDict_Copy(self->ss_dict)) == NULL)
+            goto error;
+    }
+
+    return (PyObject *)copy;
+
+error:
+    Py_DECREF(copy);
+    return NULL;
+}
+
+/* Binary format used by to_bytes and from_bytes. A header of two magic
+ * bytes, a version and flags, then one byte per cell holding the value or
+ * BIN_UNSOLVED, then the candidate mask of each cell as two little endian
+ * bytes. If BIN_HASCONFIG is set in the flags, the cache key of the
+ * compiled config follows, which is enough to rebuild the grconfig.
+ */
+#define BIN_MAGIC0      'S'
+#define BIN_MAGIC1      'd'
+#define BIN_VERSION     1
+#define BIN_HASCONFIG   0x01
+#define BIN_UNSOLVED    UNSOLVED
+#define BIN_HEADER      4
+#define BIN_VALUES      BIN_HEADER
+#define BIN_CANDS       (BIN_VALUES + GRIDSIZE)
+#define BIN_CONFIG      (BIN_CANDS + GRIDSIZE*2)
+#define BIN_SIZE        BIN_CONFIG
+
+/* Index of a house that has some digit placed twice, or -1 if there is
+ * none. Each house counts its solved cells and ORs together their digits,
+ * so the two only disagree when a digit repeats.
+ */
+static Py_ssize_t
+house_placed_twice(SudokuStateObject *self)
+{
+    Py_ssize_t h;
+
+    for (h = 0; h < NUMROWS*3; h++) {
+        if (isizes[self->ss_houses[h].hi_placed] != self->ss_houses[h].hi_solved)
+            return h;
+    }
+    return -1;
+}
+
+/* True if to_bytes holds the grid exactly: no digit is placed twice in a
+ * house, and no solved cell has any candidate other than its own digit.
+ */
+static int
+bytes_hold_grid(SudokuStateObject *self)
+{
+    Py_ssize_t i;
+    uint8_t value;
+
+    for (i = 0; i < GRIDSIZE; i++) {
+        value = self->ss_values[i];
+        if (value != UNSOLVED && (self->ss_cands[i] & ~(1 << value)))
+            return 0;
+    }
+    return house_placed_twice(self) < 0;
+}
+
+/*[clinic input]
+data.State.to_bytes
+
+Return the grid in a compact binary form.
+
+The result holds the value and candidates of every cell, and the group
+configuration if it isn't the default; about 250 bytes for the default
+configuration. Use State.from_bytes to get the State back. Dynamic
+attributes, the movehook and the trail are not included, and a solved
+cell keeps no candidates other than its own digit. Raises ValueError
+if a digit is placed twice in a house.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_to_bytes__doc__,
+"to_bytes($self, /)\n"
+"--\n"
+"\n"
+"Return the grid in a compact binary form.\n"
+"\n"
+"The result holds the value and candidates of every cell, and the group\n"
+"configuration if it isn\'t the default; about 250 bytes for the default\n"
+"configuration. Use State.from_bytes to get the State back. Dynamic\n"
+"attributes, the movehook and the trail are not included, and a solved\n"
+"cell keeps no candidates other than its own digit. Raises ValueError\n"
+"if a digit is placed twice in a house.");
+
+#define DATA_STATE_TO_BYTES_METHODDEF    \
+    {"to_bytes", (PyCFunction)data_State_to_bytes, METH_NOARGS, data_State_to_bytes__doc__},
+
+static PyObject *
+data_State_to_bytes_impl(SudokuStateObject *self);
+
+static PyObject *
+data_State_to_bytes(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_State_to_bytes_impl(self);
+}
+
+static PyObject *
+data_State_to_bytes_impl(SudokuStateObject *self)
+/*[clinic end generated code: output=8faf76f7d48d9c1d input=fb574a7e380ccd15]*/
+{
+    PyObject *result;
+    Py_ssize_t i, h, size = BIN_SIZE;
+    int hasconfig;
+    uint16_t cands;
+    char *buf;
+
+    if (!self->ss_config) {
+        PyErr_SetString(PyExc_ValueError, "to_bytes: State is not initialized");
+        return NULL;
+    }
+    if ((h = house_placed_twice(self)) >= 0) {
+        PyErr_Format(PyExc_ValueError,
+            "to_bytes: A digit is placed twice in house %zd", h);
+        return NULL;
+    }
+    hasconfig = self->ss_config != default_config;
+    if (hasconfig)
+        size += GRIDSIZE;
+
+    result = PyBytes_FromStringAndSize(NULL, size);
+    if (!result)
+        return NULL;
+    buf = PyBytes_AS_STRING(result);
+
+    buf[0] = BIN_MAGIC0;
+    buf[1] = BIN_MAGIC1;
+    buf[2] = BIN_VERSION;
+    buf[3] = hasconfig ? BIN_HASCONFIG : 0;
+    for (i = 0; i < GRIDSIZE; i++) {
+        cands = self->ss_cands[i];
+        if (self->ss_values[i] != UNSOLVED)
+            cands &= 1 << self->ss_values[i];
+        buf[BIN_VALUES + i] = (char)self->ss_values[i];
+        buf[BIN_CANDS + 2*i] = (char)(cands & 0xFF);
+        buf[BIN_CANDS + 2*i + 1] = (char)(cands >> 8);
+    }
+    if (hasconfig) {
+        memcpy(buf + BIN_CONFIG,
+               PyBytes_AS_STRING(((CompiledConfigObject *)self->ss_config)->cc_key),
+               GRIDSIZE);
+    }
+
+    return result;
+}
+
+/*[clinic input]
+@classmethod
+data.State.from_bytes
+
+    data: object
+        A bytes-like object returned by State.to_bytes.
+    /
+
+Build a State from the output of State.to_bytes.
+
+Raises ValueError if data is malformed, if a solved cell has a candidate
+other than its own digit, or if a digit is placed twice in a house.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_from_bytes__doc__,
+"from_bytes($type, data, /)\n"
+"--\n"
+"\n"
+"Build a State from the output of State.to_bytes.\n"
+"\n"
+"  data\n"
+"    A bytes-like object returned by State.to_bytes.\n"
+"\n"
+"Raises ValueError if data is malformed, if a solved cell has a candidate\n"
+"other than its own digit, or if a digit is placed twice in a house.");
+
+#define DATA_STATE_FROM_BYTES_METHODDEF    \
+    {"from_bytes", (PyCFunction)data_State_from_bytes, METH_O|METH_CLASS, data_State_from_bytes__doc__},
+
+static PyObject *
+data_State_from_bytes(PyTypeObject *type, PyObject *data)
+/*[clinic end generated code: output=e3cd9c9af8232302 input=d57dc28237397b27]*/
+{
+    Py_buffer view;
+    const unsigned char *buf;
+    PyObject *clues = NULL, *config = NULL;
+    SudokuStateObject *self = NULL;
+    Py_ssize_t i;
+    uint16_t value, cands;
+    uint8_t c, seen[GRIDSIZE];
+
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) < 0)
+        return NULL;
+    buf = (const unsigned char *)view.buf;
+
+    if (view.len < BIN_SIZE || buf[0] != BIN_MAGIC0 || buf[1] != BIN_MAGIC1) {
+        PyErr_SetString(PyExc_ValueError, "from_bytes: Not a State");
+        goto done;
+    }
+    if (buf[2] != BIN_VERSION) {
+        PyErr_Format(PyExc_ValueError,
+            "from_bytes: Unsupported version %d", (int)buf[2]);
+        goto done;
+    }
+    if (view.len != (buf[3] & BIN_HASCONFIG ? BIN_SIZE + GRIDSIZE : BIN_SIZE)) {
+        PyErr_SetString(PyExc_ValueError, "from_bytes: Bad length");
+        goto done;
+    }
+
+    if (buf[3] & BIN_HASCONFIG) {
+        /* Nine groups of nine cells, listing every cell exactly once */
+        memset(seen, 0, sizeof(seen));
+        for (i = 0; i < GRIDSIZE; i++) {
+            c = buf[BIN_CONFIG + i];
+            if (c >= GRIDSIZE || seen[c]++) {
+                PyErr_SetString(PyExc_ValueError,
+                    "from_bytes: Group configuration is malformed");
+                goto done;
+            }
+        }
+        config = grconfig_from_key(buf + BIN_CONFIG, 0, "from_bytes");
+        if (!config)
+            goto done;
+    } else {
+        config = default_config;
+        Py_INCREF(config);
+    }
+
+    if ((clues = PyDict_New()) == NULL)
+        goto done;
+    self = (SudokuStateObject *)PyObject_CallFunction((PyObject *)type,
+        "OOO", clues, Py_False, config);
+    if (!self)
+        goto done;
+
+    for (i = 0; i < GRIDSIZE; i++) {
+        value = buf[BIN_VALUES + i];
+        cands = (uint16_t)(buf[BIN_CANDS + 2*i] | (buf[BIN_CANDS + 2*i + 1] << 8));
+        if ((value >= NUMROWS && value != BIN_UNSOLVED) || (cands & ~TERMS) ||
+            (value != BIN_UNSOLVED && (cands & ~(1 << value)))) {
+            PyErr_Format(PyExc_ValueError,
+                "from_bytes: Bad data for cell %zd", i);
+            Py_CLEAR(self);
+            goto done;
+        }
+        if (cell_change(self, i, value, cands) < 0) {
+            Py_CLEAR(self);
+            goto done;
+        }
+    }
+    if ((i = house_placed_twice(self)) >= 0) {
+        PyErr_Format(PyExc_ValueError,
+            "from_bytes: A digit is placed twice in house %zd", i);
+        Py_CLEAR(self);
+    }
+
+done:
+    Py_XDECREF(clues);
+    Py_XDECREF(config);
+    PyBuffer_Release(&view);
+    return (PyObject *)self;
+}
+
+/*[clinic input]
+data.State.__reduce_ex__
+
+    protocol: int
+    /
+
+Pickle support for State objects.
+
+With protocol 2 or higher, the grid is pickled in the form given by
+State.to_bytes if that holds it exactly. Otherwise this is the same as
+__reduce__.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State___reduce_ex____doc__,
+"__reduce_ex__($self, protocol, /)\n"
+"--\n"
+"\n"
+"Pickle support for State objects.\n"
+"\n"
+"With protocol 2 or higher, the grid is pickled in the form given by\n"
+"State.to_bytes if that holds it exactly. Otherwise this is the same as\n"
+"__reduce__.");
+
+#define DATA_STATE___REDUCE_EX___METHODDEF    \
+    {"__reduce_ex__", (PyCFunction)data_State___reduce_ex__, METH_VARARGS, data_State___reduce_ex____doc__},
+
+static PyObject *
+data_State___reduce_ex___impl(SudokuStateObject *self, int protocol);
+
+static PyObject *
+data_State___reduce_ex__(SudokuStateObject *self, PyObject *args)
+{
+    PyObject *return_value = NULL;
+    int protocol;
+
+    if (!PyArg_ParseTuple(args,
+        "i:__reduce_ex__",
+        &protocol))
+        goto exit;
+    return_value = data_State___reduce_ex___impl(self, protocol);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State___reduce_ex___impl(SudokuStateObject *self, int protocol)
+/*[clinic end generated code: output=c93debc4fb8d6ecf input=2251b1baf5a5bf40]*/
+{
+    _Py_IDENTIFIER(from_bytes);
+    PyObject *constructor, *data, *empty, *reduction;
+    Py_ssize_t len;
+
+    if (protocol < 2 || !bytes_hold_grid(self))
+        return data_State___reduce___impl(self);
+
+    len = self->ss_dict ? PyDict_Size(self->ss_dict) : 0;
+    if (len < 0)
+        return NULL;
+    constructor = _PyObject_GetAttrId((PyObject *)Py_TYPE(self), &PyId_from_bytes);
+    if (!constructor)
+        return NULL;
+    data = data_State_to_bytes_impl(self);
+    if (!data) {
+        Py_DECREF(constructor);
+        return NULL;
+    }
+    empty = PyDict_New();
+    if (!empty) {
+        Py_DECREF(constructor);
+        Py_DECREF(data);
+        return NULL;
+    }
+
+    /* The candidates are already in the bytes, so __setstate__ only gets
+     * the movehook and the dynamic attributes.
+     */
+    reduction = Py_BuildValue("(N(N)(NOO))",
+        constructor,
+        data,
+        empty,
+        self->ss_movehook ? self->ss_movehook : Py_None,
+        len > 0 ? self->ss_dict : Py_None);
+
+    return reduction;
+}
+
+/* puzzle line parsing; defined with solve_batch below */
+static int
+parse_puzzle(const char *line, Py_ssize_t len, uint8_t *values, Py_ssize_t n);
+static Py_ssize_t
+parse_puzzle_lines(const char *buf, Py_ssize_t size, uint8_t **values);
+
+/* Build a State of the given type from values as parsed by parse_puzzle,
+ * where 0 is a blank and 1-9 are digits. The givens are placed directly
+ * instead of going through a clues dict.
+ */
+static PyObject *
+state_from_values(PyTypeObject *type, const uint8_t *values, PyObject *config)
+{
+    SudokuStateObject *self;
+    PyObject *clues;
+    Py_ssize_t i;
+
+    clues = PyDict_New();
+    if (!clues)
+        return NULL;
+    self = (SudokuStateObject *)PyObject_CallFunction((PyObject *)type,
+        "OOO", clues, Py_False, config);
+    Py_DECREF(clues);
+    if (!self)
+        return NULL;
+
+    for (i = 0; i < GRIDSIZE; i++) {
+        if (values[i] && cell_change(self, i, values[i] - 1, 0) < 0)
+            goto error;
+    }
+    if (fill_in_pencilmarks(self) < 0)
+        goto error;
+
+    return (PyObject *)self;
+
+error:
+    Py_DECREF(self);
+    return NULL;
+}
+
+/* Get the characters of a str or bytes-like object. view is filled in
+ * for bytes-like objects, and must be released by the caller if
+ * view->obj is set.
+ */
+static const char *
+puzzle_chars(PyObject *string, Py_buffer *view, Py_ssize_t *len, const char *name)
+{
+    const char *chars;
+
+    view->obj = NULL;
+    if (PyUnicode_Check(string))
+        return PyUnicode_AsUTF8AndSize(string, len);
+    if (PyObject_GetBuffer(string, view, PyBUF_SIMPLE) < 0) {
+        PyErr_Format(PyExc_TypeError,
+            "%s: Expected str or bytes, not '%.100s'",
+            name, Py_TYPE(string)->tp_name);
+        return NULL;
+    }
+    chars = (const char *)view->buf;
+    *len = view->len;
+    return chars;
+}
+
+/*[clinic input]
+@classmethod
+data.State.from_string
+
+    string: object
+        A puzzle in the one line format of puzzles.txt, as str or bytes.
+
+    grconfig: object = NULL
+        As for State.
+
+Build a State from a puzzle string.
+
+The string has 81 characters, with '1'-'9' for givens and '.' or '0' for
+blanks; a trailing newline is ignored. Pencilmarks are filled in.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_from_string__doc__,
+"from_string($type, /, string, grconfig=None)\n"
+"--\n"
+"\n"
+"Build a State from a puzzle string.\n"
+"\n"
+"  string\n"
+"    A puzzle in the one line format of puzzles.txt, as str or bytes.\n"
+"  grconfig\n"
+"    As for State.\n"
+"\n"
+"The string has 81 characters, with \'1\'-\'9\' for givens and \'.\' or \'0\' for\n"
+"blanks; a trailing newline is ignored. Pencilmarks are filled in.");
+
+#define DATA_STATE_FROM_STRING_METHODDEF    \
+    {"from_string", (PyCFunction)data_State_from_string, METH_VARARGS|METH_KEYWORDS|METH_CLASS, data_State_from_string__doc__},
+
+static PyObject *
+data_State_from_string_impl(PyTypeObject *type, PyObject *string, PyObject *grconfig);
+
+static PyObject *
+data_State_from_string(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    PyObject *return_value = NULL;
+    static char *_keywords[] = {"string", "grconfig", NULL};
+    PyObject *string;
+    PyObject *grconfig = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "O|O:from_string", _keywords,
+        &string, &grconfig))
+        goto exit;
+    return_value = data_State_from_string_impl(type, string, grconfig);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_from_string_impl(PyTypeObject *type, PyObject *string, PyObject *grconfig)
+/*[clinic end generated code: output=af5b4f5d3e3cd240 input=92227bd192ece091]*/
+{
+    Py_buffer view;
+    const char *chars;
+    Py_ssize_t len;
+    uint8_t values[GRIDSIZE];
+    PyObject *config, *result = NULL;
+
+    chars = puzzle_chars(string, &view, &len, "from_string");
+    if (!chars)
+        return NULL;
+    if (len && chars[len - 1] == '\n')
+        len--;
+    if (len && chars[len - 1] == '\r')
+        len--;
+    if (parse_puzzle(chars, len, values, 0) < 0)
+        goto done;
+
+    config = config_lookup(grconfig, "from_string");
+    if (!config)
+        goto done;
+    result = state_from_values(type, values, config);
+    Py_DECREF(config);
+
+done:
+    if (view.obj)
+        PyBuffer_Release(&view);
+    return result;
+}
+
+/*[clinic input]
+@classmethod
+data.State.from_lines
+
+    lines: object
+        Puzzles in the one line format of puzzles.txt, separated by
+        newlines, as str or bytes. Blank lines are skipped.
+
+    grconfig: object = NULL
+        As for State. Every puzzle gets the same configuration.
+
+Build a list of States from puzzle lines, such as the contents of puzzles.txt.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_State_from_lines__doc__,
+"from_lines($type, /, lines, grconfig=None)\n"
+"--\n"
+"\n"
+"Build a list of States from puzzle lines, such as the contents of puzzles.txt.\n"
+"\n"
+"  lines\n"
+"    Puzzles in the one line format of puzzles.txt, separated by\n"
+"    newlines, as str or bytes. Blank lines are skipped.\n"
+"  grconfig\n"
+"    As for State. Every puzzle gets the same configuration.");
+
+#define DATA_STATE_FROM_LINES_METHODDEF    \
+    {"from_lines", (PyCFunction)data_State_from_lines, METH_VARARGS|METH_KEYWORDS|METH_CLASS, data_State_from_lines__doc__},
+
+static PyObject *
+data_State_from_lines_impl(PyTypeObject *type, PyObject *lines, PyObject *grconfig);
+
+static PyObject *
+data_State_from_lines(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    PyObject *return_value = NULL;
+    static char *_keywords[] = {"lines", "grconfig", NULL};
+    PyObject *lines;
+    PyObject *grconfig = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "O|O:from_lines", _keywords,
+        &lines, &grconfig))
+        goto exit;
+    return_value = data_State_from_lines_impl(type, lines, grconfig);
+
+exit:
+    return return_value;
+}
+
+static PyObject *
+data_State_from_lines_impl(PyTypeObject *type, PyObject *lines, PyObject *grconfig)
+/*[clinic end generated code: output=ff9e41b588a26e6e input=25e59f8b1e69a254]*/
+{
+    Py_buffer view;
+    const char *chars;
+    Py_ssize_t len, count, i;
+    uint8_t *values = NULL;
+    PyObject *config = NULL, *list = NULL, *state;
+
+    chars = puzzle_chars(lines, &view, &len, "from_lines");
+    if (!chars)
+        return NULL;
+    count = parse_puzzle_lines(chars, len, &values);
+    if (count < 0)
+        goto done;
+
+    config = config_lookup(grconfig, "from_lines");
+    if (!config)
+        goto done;
+    list = PyList_New(count);
+    if (!list)
+        goto done;
+    for (i = 0; i < count; i++) {
+        state = state_from_values(type, values + i*GRIDSIZE, config);
+        if (!state) {
+            Py_CLEAR(list);
+            goto done;
+        }
+        PyList_SET_ITEM(list, i, state);
+    }
+
+done:
+    PyMem_Free(values);
+    Py_XDECREF(config);
+    if (view.obj)
+        PyBuffer_Release(&view);
+    return list;
+}
+
+static PyMethodDef State_methods[] = {
+    DATA_STATE_FROM_STRING_METHODDEF
+    DATA_STATE_FROM_LINES_METHODDEF
+    DATA_STATE_TO_BYTES_METHODDEF
+    DATA_STATE_FROM_BYTES_METHODDEF
+    DATA_STATE___REDUCE_EX___METHODDEF
+    DATA_STATE_RESET_METHODDEF
+    DATA_STATE_CLONE_METHODDEF
+    {"__copy__", (PyCFunction)data_State_clone, METH_NOARGS, data_State_clone__doc__},
+    DATA_STATE_CANDIDATE_IN_KEYSET_METHODDEF
+    DATA_STATE_CANDIDATES_FROM_KEYSET_METHODDEF
+    DATA_STATE_ADD_CANDIDATES_METHODDEF
+    DATA_STATE_ELIMINATIONS_METHODDEF
+    DATA_STATE_REMOVE_CANDIDATES_METHODDEF
+    DATA_STATE_CANDIDATE_IN_HOUSES_METHODDEF
+    DATA_STATE_CANDIDATES_FROM_HOUSE_METHODDEF
+    DATA_STATE_DIGIT_POSITIONS_METHODDEF
+    DATA_STATE_KEYS_AT_METHODDEF
+    DATA_STATE_STRONG_LINKS_METHODDEF
+    DATA_STATE_FIND_RECTANGLES_METHODDEF
+    DATA_STATE_SOLVE_NATIVE_METHODDEF
+    DATA_STATE_PROPAGATE_METHODDEF
+    DATA_STATE_MARK_METHODDEF
+    DATA_STATE_ROLLBACK_METHODDEF
+    DATA_STATE_CHANGES_SINCE_METHODDEF
+    DATA_STATE_ORDER_SIMPLE_METHODDEF
+    DATA_STATE_ORDER_SOLVED_METHODDEF
+    DATA_STATE_ORDER_RANDOM_METHODDEF
+    DATA_STATE_ORDER_BY_NUM_CANDIDATES_METHODDEF
+    DATA_STATE_ORDER_BY_NUM_CANDIDATES_REV_METHODDEF
+    DATA_STATE_ORDER_EXACTLY_N_METHODDEF
+    DATA_STATE_FIRST_EXACTLY_N_METHODDEF
+    DATA_STATE_COUNT_EXACTLY_N_METHODDEF
+    DATA_STATE_FEWEST_CANDIDATES_METHODDEF
+    DATA_STATE___SETSTATE___METHODDEF
+    DATA_STATE___REDUCE___METHODDEF
+    {NULL}  /* sentinel */
+};
+
+/* state_candidates and state_clues implementations */
+
+typedef struct {
+    PyObject_HEAD
+    SudokuStateObject *state;
+    PyObject *mp_weakref;
+} SudokuMapObject;
+
+/* shared by both map types, since they have the same layout */
+static SudokuMapObject *map_freelist[MAXFREELIST];
+static int map_numfree = 0;
+
+static void
+data_map_dealloc(SudokuMapObject *self)
+{
+    PyObject_ClearWeakRefs((PyObject *)self);
+    Py_DECREF(self->state);
+    if (map_numfree < MAXFREELIST)
+        map_freelist[map_numfree++] = self;
+    else
+        Py_TYPE(self)->tp_free(self);
+}
+
+static Py_ssize_t
+data_candidates_length(SudokuMapObject *self)
+{
+    return GRIDSIZE - self->state->ss_solved;
+}
+
+static PyObject *
+data_candidates_subscript(SudokuMapObject *self, PyObject *key)
 {
-    KeyIterObject *keyiter;
-    Py_ssize_t size;
+    SudokuStateObject *state = self->state;
 
-    size = GRIDSIZE - self->ss_solved;
-    keyiter = new_keyiter_object(size, self);
-    if (!keyiter)
+    UNPACK_KEY(key, return NULL, "__getitem__");
+    if (CELL_FILLED(state, x, y)) {
+        _PyErr_SetKeyError(key);
         return NULL;
+    }
 
-    keyiter->ki_func = precalculated_keyiterfunc;
-    keyiter->ki_pos = 0;
-
-    return keyiter;
+    return build_set(CELL_CANDS(state, x, y));
 }
 
 static int
-simple_keyiterfunc(KeyIterObject *ki, Py_ssize_t *x, Py_ssize_t *y)
+data_candidates_ass_sub(SudokuMapObject *self, PyObject *key, PyObject *cands)
 {
-    Py_ssize_t i, j;
-    cell_info *grid = ki->ki_state->ss_grid;
+    SudokuStateObject *state = self->state;
+    uint16_t new_set;
+    int need_decref = 0;
+    int return_value = -1;
 
-    for (i = ki->ki_next_x; i < NUMROWS; i++) {
-        for (j = ki->ki_next_y; j < NUMROWS; j++) {
-            if (!CELL_FILLED(grid, i, j)) {
-                *x = ki->ki_next_x = i;
-                *y = j;
-                ki->ki_next_y = j + 1;
-                return 0;
-            }
-        }
-        ki->ki_next_y = 0;
+    /* For deletion, set to the empty CandidateSet */
+    if (!cands) {
+        cands = build_set(0);
+        if (!cands)
+            return -1;
+        need_decref = 1;
     }
 
-    return -1;
-}
+    if (!CandidateSet_Check(cands)) {
+        PyErr_Format(PyExc_TypeError,
+            "__setitem__: Expected CandidateSet, not '%.100s'",
+            Py_TYPE(cands)->tp_name);
+        goto done;
+    }
+    UNPACK_KEY(key, goto done,
+        need_decref ? "__delitem__" : "__setitem__");
 
-/*[clinic input]
-data.State.order_simple
+    if (CELL_FILLED(state, x, y)) {
+        _PyErr_SetKeyError(key);
+        goto done;
+    }
 
-Iterates over every unsolved key in the grid in simple order.
+    new_set = ((CandidateSetObject *)cands)->cs_set;
+    if (cell_update(state, INDEX(x, y), CELL_VALUE(state, x, y), new_set) < 0)
+        goto done;
+    return_value = 0;
 
-In other words, it iterates over the unsolved keys, row by row,
-column by column, starting from the upper left corner, down to
-the lower right corner.
-[clinic start generated code]*/
+done:
+    if (need_decref)
+        Py_DECREF(cands);
+    return return_value;
+}
 
-PyDoc_STRVAR(data_State_order_simple__doc__,
-"order_simple($self, /)\n"
-"--\n"
-"\n"
-"Iterates over every unsolved key in the grid in simple order.\n"
-"\n"
-"In other words, it iterates over the unsolved keys, row by row,\n"
-"column by column, starting from the upper left corner, down to\n"
-"the lower right corner.");
+static int
+data_candidates_contains(SudokuMapObject *self, PyObject *key)
+{
+    Py_ssize_t i = key_lookup(key);
 
-#define DATA_STATE_ORDER_SIMPLE_METHODDEF    \
-    {"order_simple", (PyCFunction)data_State_order_simple, METH_NOARGS, data_State_order_simple__doc__},
+    return i >= 0 && !CELL_FILLED(self->state, ROW(i), COL(i));
+}
 
-static PyObject *
-data_State_order_simple_impl(SudokuStateObject *self);
+static PySequenceMethods candidates_as_sequence = {
+    (lenfunc)data_candidates_length,        /* sq_length */
+    0,                                      /* sq_concat */
+    0,                                      /* sq_repeat */
+    0,                                      /* sq_item */
+    0,                                      /* sq_slice */
+    0,                                      /* sq_ass_item */
+    0,                                      /* sq_ass_slice */
+    (objobjproc)data_candidates_contains,   /* sq_contains */
+    0,                                      /* sq_inplace_concat */
+    0,                                      /* sq_inplace_repeat */
+};
 
-static PyObject *
-data_State_order_simple(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+static PyMappingMethods candidates_as_mapping = {
+    (lenfunc)data_candidates_length,        /*mp_length*/
+    (binaryfunc)data_candidates_subscript,  /*mp_subscript*/
+    (objobjargproc)data_candidates_ass_sub, /*mp_ass_subscript*/
+};
+
+static Py_ssize_t
+data_clues_length(SudokuMapObject *self)
 {
-    return data_State_order_simple_impl(self);
+    return self->state->ss_solved;
 }
 
 static PyObject *
-data_State_order_simple_impl(SudokuStateObject *self)
-/*[clinic end generated code: output=27d373786f84cfdd input=a7c7e0b5ad9b4701]*/
+data_clues_subscript(SudokuMapObject *self, PyObject *key)
 {
-    KeyIterObject *keyiter;
+    SudokuStateObject *state = self->state;
 
-    keyiter = new_keyiter_object(0, self);
-    if (keyiter) {
-        keyiter->ki_func = simple_keyiterfunc;
-        keyiter->ki_next_x = 0;
-        keyiter->ki_next_y = 0;
+    UNPACK_KEY(key, return NULL, "__getitem__");
+
+    if (!CELL_FILLED(state, x, y)) {
+        _PyErr_SetKeyError(key);
+        return NULL;
     }
 
-    return (PyObject *)keyiter;
+    return PyLong_FromLong((long)CELL_VALUE(state, x, y));
 }
 
 static int
-solved_keyiterfunc(KeyIterObject *ki, Py_ssize_t *x, Py_ssize_t *y)
+delete_clue(SudokuStateObject *state, PyObject *key)
 {
-    Py_ssize_t i, j;
-    cell_info *grid = ki->ki_state->ss_grid;
-
-    for (i = ki->ki_next_x; i < NUMROWS; i++) {
-        for (j = ki->ki_next_y; j < NUMROWS; j++) {
-            if (CELL_FILLED(grid, i, j)) {
-                *x = ki->ki_next_x = i;
-                *y = j;
-                ki->ki_next_y = j + 1;
-                return 0;
-            }
-        }
-        ki->ki_next_y = 0;
+    UNPACK_KEY(key, return -1, "__delitem__");
+    if (!CELL_FILLED(state, x, y)) {
+        _PyErr_SetKeyError(key);
+        return -1;
     }
 
-    return -1;
+    return cell_update(state, INDEX(x, y), UNSOLVED, CELL_CANDS(state, x, y));
 }
 
-/*[clinic input]
-data.State.order_solved
-
-Iterate through all solved keys in simple order.
-[clinic start generated code]*/
-
-PyDoc_STRVAR(data_State_order_solved__doc__,
-"order_solved($self, /)\n"
-"--\n"
-"\n"
-"Iterate through all solved keys in simple order.");
-
-#define DATA_STATE_ORDER_SOLVED_METHODDEF    \
-    {"order_solved", (PyCFunction)data_State_order_solved, METH_NOARGS, data_State_order_solved__doc__},
+static int
+assign_clue(SudokuStateObject *state, PyObject *key, Py_ssize_t digit)
+{
+    UNPACK_KEY(key, return -1, "__setitem__");
 
-static PyObject *
-data_State_order_solved_impl(SudokuStateObject *self);
+    if (CELL_FILLED(state, x, y)) {
+        _PyErr_SetKeyError(key);
+        return -1;
+    }
 
-static PyObject *
-data_State_order_solved(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
-{
-    return data_State_order_solved_impl(self);
+    return cell_update(state, INDEX(x, y), (uint8_t)digit, CELL_CANDS(state, x, y));
 }
 
-static PyObject *
-data_State_order_solved_impl(SudokuStateObject *self)
-/*[clinic end generated code: output=c31b4dc27ab34e7c input=8d145a6787d1635c]*/
+static int
+data_clues_ass_sub(SudokuMapObject *self, PyObject* key, PyObject* value)
 {
-    KeyIterObject *keyiter;
+    int return_value = 0;
+    Py_ssize_t digit;
 
-    keyiter = new_keyiter_object(0, self);
-    if (keyiter) {
-        keyiter->ki_func = solved_keyiterfunc;
-        keyiter->ki_next_x = 0;
-        keyiter->ki_next_y = 0;
+    if (value == NULL) {
+        return_value = delete_clue(self->state, key);
+    } else {
+        digit = PyLong_AsSsize_t(value);
+        if (PyErr_Occurred()) {
+            return_value = -1;
+        } else if (digit < 0 || digit >= NUMROWS) {
+            PyErr_Format(PyExc_ValueError,
+                "__setitem__: Expected a digit from 0-%d, got '%ld'",
+                NUMROWS, digit);
+            return_value = -1;
+        } else {
+            return_value = assign_clue(self->state, key, digit);
+        }
     }
 
-    return (PyObject *)keyiter;
+    return return_value;
 }
 
 static int
-exactly_n_keyiterfunc(KeyIterObject *ki, Py_ssize_t *x, Py_ssize_t *y)
+data_clues_contains(SudokuMapObject *self, PyObject *key)
 {
-    Py_ssize_t i, j;
-    cell_info *grid = ki->ki_state->ss_grid;
-
-    for (i = ki->ki_next_x; i < NUMROWS; i++) {
-        for (j = ki->ki_next_y; j < NUMROWS; j++) {
-            if (!CELL_FILLED(grid, i, j)) {
-                if (isizes[(Py_ssize_t)CELL_CANDS(grid, i, j)] == ki->ki_pos) {
-                    *x = ki->ki_next_x = i;
-                    *y = j;
-                    ki->ki_next_y = j + 1;
-                    return 0;
-                }
-            }
-        }
-        ki->ki_next_y = 0;
-    }
+    Py_ssize_t i = key_lookup(key);
 
-    return -1;
+    return i >= 0 && CELL_FILLED(self->state, ROW(i), COL(i));
 }
 
-/*[clinic input]
-data.State.order_exactly_n
+static PySequenceMethods clues_as_sequence = {
+    (lenfunc)data_clues_length,             /* sq_length */
+    0,                                      /* sq_concat */
+    0,                                      /* sq_repeat */
+    0,                                      /* sq_item */
+    0,                                      /* sq_slice */
+    0,                                      /* sq_ass_item */
+    0,                                      /* sq_ass_slice */
+    (objobjproc)data_clues_contains,        /* sq_contains */
+    0,                                      /* sq_inplace_concat */
+    0,                                      /* sq_inplace_repeat */
+};
 
-    count: Py_ssize_t
-        Yield keys with this many candidates.
-    /
+static PyMappingMethods clues_as_mapping = {
+    (lenfunc)data_clues_length,         /*mp_length*/
+    (binaryfunc)data_clues_subscript,   /*mp_subscript*/
+    (objobjargproc)data_clues_ass_sub,  /*mp_ass_subscript*/
+};
 
-Yield keys that have a certain number of candidates.
+static PyMemberDef map_members[] = {
+    {"state",       T_OBJECT, offsetof(SudokuMapObject, state),      READONLY},
+    {"__weakref__", T_OBJECT, offsetof(SudokuMapObject, mp_weakref), READONLY},
+    {NULL}  /* sentinel */
+};
 
-Raises a ValueError if an insane count is given.
+/*[clinic input]
+data.state_candidates.fill
+
+Fill in pencilmarks.
+
+This method fills in all candidates in the grid naively based on the solved
+cells. This doesn't do anything fancy like leave out candidates that are
+eliminated by locked candidates.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_State_order_exactly_n__doc__,
-"order_exactly_n($self, count, /)\n"
+PyDoc_STRVAR(data_state_candidates_fill__doc__,
+"fill($self, /)\n"
 "--\n"
 "\n"
-"Yield keys that have a certain number of candidates.\n"
-"\n"
-"  count\n"
-"    Yield keys with this many candidates.\n"
+"Fill in pencilmarks.\n"
 "\n"
-"Raises a ValueError if an insane count is given.");
+"This method fills in all candidates in the grid naively based on the solved\n"
+"cells. This doesn\'t do anything fancy like leave out candidates that are\n"
+"eliminated by locked candidates.");
 
-#define DATA_STATE_ORDER_EXACTLY_N_METHODDEF    \
-    {"order_exactly_n", (PyCFunction)data_State_order_exactly_n, METH_VARARGS, data_State_order_exactly_n__doc__},
+#define DATA_STATE_CANDIDATES_FILL_METHODDEF    \
+    {"fill", (PyCFunction)data_state_candidates_fill, METH_NOARGS, data_state_candidates_fill__doc__},
 
 static PyObject *
-data_State_order_exactly_n_impl(SudokuStateObject *self, Py_ssize_t count);
+data_state_candidates_fill_impl(SudokuMapObject *self);
 
 static PyObject *
-data_State_order_exactly_n(SudokuStateObject *self, PyObject *args)
+data_state_candidates_fill(SudokuMapObject *self, PyObject *Py_UNUSED(ignored))
 {
-    PyObject *return_value = NULL;
-    Py_ssize_t count;
-
-    if (!PyArg_ParseTuple(args,
-        "n:order_exactly_n",
-        &count))
-        goto exit;
-    return_value = data_State_order_exactly_n_impl(self, count);
-
-exit:
-    return return_value;
+    return data_state_candidates_fill_impl(self);
 }
 
 static PyObject *
-data_State_order_exactly_n_impl(SudokuStateObject *self, Py_ssize_t count)
-/*[clinic end generated code: output=6d3ad1cb29c50356 input=f5d4d02978352105]*/
+data_state_candidates_fill_impl(SudokuMapObject *self)
+/*[clinic end generated code: output=04a7b76d9628e630 input=ee44234cd35a3892]*/
 {
-    KeyIterObject *keyiter;
-
-    if (count < 0 || count >= NUMROWS) {
-        PyErr_Format(PyExc_ValueError,
-            "order_exactly_n: Bad candidate count '%d'", count);
+    if (fill_in_pencilmarks(self->state) < 0)
         return NULL;
-    }
-
-    keyiter = new_keyiter_object(0, self);
-    if (keyiter) {
-        keyiter->ki_func = exactly_n_keyiterfunc;
-        keyiter->ki_next_x = 0;
-        keyiter->ki_next_y = 0;
-        keyiter->ki_pos = count;    /* use pos to store arg */
-    }
-
-    return (PyObject *)keyiter;
+    Py_RETURN_NONE;
 }
 
 /*[clinic input]
-data.State.order_random
+data.state_candidates.clear
 
-Yields unsolved keys in random order.
+Clear all pencilmarks.
 
-Each unsolved key will be given exactly once.
+This method deletes all candidates from the grid, including candidates for
+cells which are solved but were unsolved.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_State_order_random__doc__,
-"order_random($self, /)\n"
+PyDoc_STRVAR(data_state_candidates_clear__doc__,
+"clear($self, /)\n"
 "--\n"
 "\n"
-"Yields unsolved keys in random order.\n"
+"Clear all pencilmarks.\n"
 "\n"
-"Each unsolved key will be given exactly once.");
+"This method deletes all candidates from the grid, including candidates for\n"
+"cells which are solved but were unsolved.");
 
-#define DATA_STATE_ORDER_RANDOM_METHODDEF    \
-    {"order_random", (PyCFunction)data_State_order_random, METH_NOARGS, data_State_order_random__doc__},
+#define DATA_STATE_CANDIDATES_CLEAR_METHODDEF    \
+    {"clear", (PyCFunction)data_state_candidates_clear, METH_NOARGS, data_state_candidates_clear__doc__},
 
 static PyObject *
-data_State_order_random_impl(SudokuStateObject *self);
+data_state_candidates_clear_impl(SudokuMapObject *self);
 
 static PyObject *
-data_State_order_random(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+data_state_candidates_clear(SudokuMapObject *self, PyObject *Py_UNUSED(ignored))
 {
-    return data_State_order_random_impl(self);
+    return data_state_candidates_clear_impl(self);
 }
 
 static PyObject *
-data_State_order_random_impl(SudokuStateObject *self)
-/*[clinic end generated code: output=03fbc0486f11a6cf input=d356deba3306ee04]*/
+data_state_candidates_clear_impl(SudokuMapObject *self)
+/*[clinic end generated code: output=3a74712316627088 input=b38dc96986635a8a]*/
 {
-    KeyIterObject *ki;
-    cell_info *grid;
-    Py_ssize_t seen[GRIDSIZE];
-    Py_ssize_t numtries, i, found = 0, key = 0;
-
-    ki = start_building_precalculated_keyiter(self);
-    if (!ki)
-        return NULL;
-    if (!Py_SIZE(ki))
-        return (PyObject *)ki;
-    numtries = Py_SIZE(ki)/6 + 1;
-
-    uint8_t tries[numtries];
-
-    grid = ki->ki_state->ss_grid;
-    memset(seen, 0, sizeof(Py_ssize_t) * GRIDSIZE);
-    if (_PyOS_URandom((void *)tries, numtries) < 0)
-        return NULL;
-
-    /* First generate keys by trying a few keys randomly. Numbers are generated
-     * by operating system random, such as /dev/urandom.
-     */
-    for (i = 0; i < numtries; i++) {
-        key = (Py_ssize_t)(tries[i] % GRIDSIZE);
-
-        if (seen[key])
-            continue;
-        seen[key] = 1;
-
-        if (!(grid[key].ci_value & ERRORBIT))
-            continue;
-        ki->ki_data[found++] = key;
-        if (found == Py_SIZE(ki))
-            break;
-    }
-
-    /* Then visit the rest of the unsolved keys by walking the grid in a seemingly
-     * random order, inspired by the probe order of dicts.
-     */
-    while (found < Py_SIZE(ki)) {
-        key = ((key << 2) + key + 1) & 127;
-        if (key >= 81)
-            continue;
-
-        if (seen[key])
-            continue;
-        seen[key] = 1;
+    Py_ssize_t i;
+    SudokuStateObject *state = self->state;
 
-        if (!(grid[key].ci_value & ERRORBIT))
-            continue;
-        ki->ki_data[found++] = key;
+    for (i = 0; i < GRIDSIZE; i++) {
+        if (state->ss_cands[i] &&
+            cell_update(state, i, state->ss_values[i], 0) < 0)
+            return NULL;
     }
 
-    return (PyObject *)ki;
+    Py_RETURN_NONE;
 }
 
 /*[clinic input]
-data.State.order_by_num_candidates
+data.state_candidates.getdict
 
-Yields keys based on the size of their candidate sets.
+Get a dictionary of CandidateSets.
 
-That is, keys with one candidate will be yielded, followed by keys with
-two candidates, and so on. Indices with the same number of candidates
-will be ordered the same as order_simple.
+The dictionary contains all candidate sets from unsolved cells
+in the grid.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_State_order_by_num_candidates__doc__,
-"order_by_num_candidates($self, /)\n"
+PyDoc_STRVAR(data_state_candidates_getdict__doc__,
+"getdict($self, /)\n"
 "--\n"
 "\n"
-"Yields keys based on the size of their candidate sets.\n"
+"Get a dictionary of CandidateSets.\n"
 "\n"
-"That is, keys with one candidate will be yielded, followed by keys with\n"
-"two candidates, and so on. Indices with the same number of candidates\n"
-"will be ordered the same as order_simple.");
+"The dictionary contains all candidate sets from unsolved cells\n"
+"in the grid.");
 
-#define DATA_STATE_ORDER_BY_NUM_CANDIDATES_METHODDEF    \
-    {"order_by_num_candidates", (PyCFunction)data_State_order_by_num_candidates, METH_NOARGS, data_State_order_by_num_candidates__doc__},
+#define DATA_STATE_CANDIDATES_GETDICT_METHODDEF    \
+    {"getdict", (PyCFunction)data_state_candidates_getdict, METH_NOARGS, data_state_candidates_getdict__doc__},
 
 static PyObject *
-data_State_order_by_num_candidates_impl(SudokuStateObject *self);
+data_state_candidates_getdict_impl(SudokuMapObject *self);
 
 static PyObject *
-data_State_order_by_num_candidates(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+data_state_candidates_getdict(SudokuMapObject *self, PyObject *Py_UNUSED(ignored))
 {
-    return data_State_order_by_num_candidates_impl(self);
+    return data_state_candidates_getdict_impl(self);
 }
 
 static PyObject *
-data_State_order_by_num_candidates_impl(SudokuStateObject *self)
-/*[clinic end generated code: output=69277346c6c15a8a input=f9364d2884949c99]*/
+data_state_candidates_getdict_impl(SudokuMapObject *self)
+/*[clinic end generated code: output=f5e527202ff59ab1 input=6164e3445e6d6fdb]*/
 {
-    KeyIterObject *ki;
-    Py_ssize_t set_lens[GRIDSIZE];
-    Py_ssize_t i, j;
-    Py_ssize_t sl = NUMROWS + 1;
-    Py_ssize_t size = 0, found = 0;
-    int seen[sl];
-    cell_info *grid;
-
-    ki = start_building_precalculated_keyiter(self);
-    if (!ki)
-        return NULL;
-    grid = ki->ki_state->ss_grid;
-    memset(seen, 0, sizeof(int) * sl);
-
-    /* Populate the set_lens array with the sizes of every candidate set.
-     * Then we make 10 passes through the array to determine the iteration
-     * order of the keys.
-     */
-    for (i = 0; i < NUMROWS; i++) {
-        for (j = 0; j < NUMROWS; j++) {
-            if (CELL_FILLED(grid, i, j)) {
-                set_lens[INDEX(i,j)] = -1;
-            } else {
-                size = isizes[(Py_ssize_t)CELL_CANDS(grid, i, j)];
-                seen[size] = 1;
-                set_lens[INDEX(i,j)] = size;
-            }
-        }
-    }
-
-    for (i = 0; i < sl; i++) {
-        if (seen[i]) {
-            for (j = 0; j < GRIDSIZE; j++) {
-                if (set_lens[j] == i) {
-                    ki->ki_data[found++] = j;
-                }
-            }
-        }
-    }
-
-    return (PyObject *)ki;
+    return build_dict(self->state, CANDS, 0);
 }
 
 /*[clinic input]
-data.State.order_by_num_candidates_rev
+data.state_clues.getdict
 
-Same as order_by_num_candidates but in reverse order.
+Get a dictionary containing values for solved keys.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_State_order_by_num_candidates_rev__doc__,
-"order_by_num_candidates_rev($self, /)\n"
+PyDoc_STRVAR(data_state_clues_getdict__doc__,
+"getdict($self, /)\n"
 "--\n"
 "\n"
-"Same as order_by_num_candidates but in reverse order.");
+"Get a dictionary containing values for solved keys.");
 
-#define DATA_STATE_ORDER_BY_NUM_CANDIDATES_REV_METHODDEF    \
-    {"order_by_num_candidates_rev", (PyCFunction)data_State_order_by_num_candidates_rev, METH_NOARGS, data_State_order_by_num_candidates_rev__doc__},
+#define DATA_STATE_CLUES_GETDICT_METHODDEF    \
+    {"getdict", (PyCFunction)data_state_clues_getdict, METH_NOARGS, data_state_clues_getdict__doc__},
 
 static PyObject *
-data_State_order_by_num_candidates_rev_impl(SudokuStateObject *self);
+data_state_clues_getdict_impl(SudokuMapObject *self);
 
 static PyObject *
-data_State_order_by_num_candidates_rev(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+data_state_clues_getdict(SudokuMapObject *self, PyObject *Py_UNUSED(ignored))
 {
-    return data_State_order_by_num_candidates_rev_impl(self);
+    return data_state_clues_getdict_impl(self);
 }
 
 static PyObject *
-data_State_order_by_num_candidates_rev_impl(SudokuStateObject *self)
-/*[clinic end generated code: output=fca4277364ba9fb5 input=1a0cffd6bf5d4d36]*/
+data_state_clues_getdict_impl(SudokuMapObject *self)
+/*[clinic end generated code: output=4fd506249e462bc7 input=eb62d226626d5704]*/
 {
-    KeyIterObject *ki
-        = (KeyIterObject *)data_State_order_by_num_candidates_impl(self);
-    if (!ki)
-        return NULL;
-    ki->ki_func = reversed_keyiterfunc;
-    ki->ki_pos = Py_SIZE(ki);
-    return (PyObject *)ki;
+    return build_dict(self->state, CLUES, 0);
 }
 
-/* pickle support */
+/* Keys, values and items of the maps. These read the grid directly, with
+ * interned keys and shared values, so walking a whole grid allocates
+ * nothing but the iterator.
+ */
 
-/* Create a dictionary containing either clues or candidates; used by pickle functions
- * and candidates/clues types. 
+/* walks one house; ki_pos is the house, ki_next_x is the next position in
+ * the house, and ki_next_y is 1 to yield solved cells or 0 for unsolved ones
  */
-typedef enum { CLUES, CANDS, } whichdict;
+static int
+house_keyiterfunc(KeyIterObject *ki, Py_ssize_t *x, Py_ssize_t *y)
+{
+    SudokuStateObject *state = ki->ki_state;
+    const uint8_t *cells = state->ss_layout->gl_cells[ki->ki_pos];
+    Py_ssize_t c;
+
+    while (ki->ki_next_x < NUMROWS) {
+        c = cells[ki->ki_next_x++];
+        if ((state->ss_values[c] != UNSOLVED) == ki->ki_next_y) {
+            *x = ROW(c);
+            *y = COL(c);
+            return 0;
+        }
+    }
+    return -1;
+}
 
+/* house is None for the whole grid, or a house index */
 static PyObject *
-build_dict(SudokuStateObject *state, whichdict wd, int hidden)
+map_iter(SudokuMapObject *self, PyObject *house, int solved, int what)
 {
-    Py_ssize_t i, j;
-    PyObject *dict, *key = NULL, *value = NULL;
+    KeyIterObject *keyiter;
+    Py_ssize_t h = -1;
 
-    dict = PyDict_New();
-    if (!dict)
+    if (house != Py_None) {
+        h = PyLong_AsSsize_t(house);
+        if (h == -1 && PyErr_Occurred())
+            return NULL;
+        if (h < 0 || h >= NUMROWS*3) {
+            PyErr_Format(PyExc_ValueError,
+                "Expected a house index in range(0,27), "
+                "but got '%zd'", h);
+            return NULL;
+        }
+    }
+
+    keyiter = new_keyiter_object(0, self->state);
+    if (!keyiter)
         return NULL;
+    keyiter->ki_next_x = 0;
+    if (h >= 0) {
+        keyiter->ki_func = house_keyiterfunc;
+        keyiter->ki_pos = h;
+        keyiter->ki_next_y = solved;
+    } else {
+        keyiter->ki_func = solved ? solved_keyiterfunc : simple_keyiterfunc;
+        keyiter->ki_next_y = 0;
+    }
+    keyiter->ki_yield = what;
+    return (PyObject *)keyiter;
+}
 
-    for (i = 0; i < NUMROWS; i++) {
-        for (j = 0; j < NUMROWS; j++) {
-            key = Py_BuildValue("(nn)", i, j);
-            if (!key)
-                goto error;
+/* A list of 81 items in cell index order; the CandidateSet or the digit
+ * of each cell, or None where the map has no entry.
+ */
+static PyObject *
+build_list(SudokuStateObject *state, whichdict wd)
+{
+    PyObject *list, *value;
+    Py_ssize_t i;
+    int filled;
 
-            switch (wd) {
-            case CLUES:
-                if (CELL_FILLED(state->ss_grid, i, j)) {
-                    value = PyLong_FromLong((long)CELL_VALUE(state->ss_grid, i, j));
-                    break;
-                }
-                goto decref;
-            case CANDS:
-                if (!CELL_FILLED(state->ss_grid, i ,j) ||
-                    (hidden && CELL_CANDS(state->ss_grid, i, j) > 0)) {
-                    value = build_set(CELL_CANDS(state->ss_grid, i, j));
-                    break;
-                }
-                goto decref;
-            default:
-                PyErr_Format(PyExc_SystemError,
-                    "Bad arg to build_dict: '%d'", wd);
-                goto error;
-            }
+    list = PyList_New(GRIDSIZE);
+    if (!list)
+        return NULL;
+    for (i = 0; i < GRIDSIZE; i++) {
+        filled = state->ss_values[i] != UNSOLVED;
+        if (wd == CLUES)
+            value = filled ? idigits[state->ss_values[i]] : Py_None;
+        else
+            value = filled ? Py_None : isets[state->ss_cands[i] & TERMS];
+        Py_INCREF(value);
+        PyList_SET_ITEM(list, i, value);
+    }
+    return list;
+}
 
-            if (!value) {
-                Py_DECREF(key);
-                goto error;
-            }
+/*[clinic input]
+data.state_candidates.keys
+
+    house: object = None
+        A house index from 0 to 26; if given, only cells in that house
+        are included.
+
+Iterate over the unsolved keys.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_state_candidates_keys__doc__,
+"keys($self, /, house=None)\n"
+"--\n"
+"\n"
+"Iterate over the unsolved keys.\n"
+"\n"
+"  house\n"
+"    A house index from 0 to 26; if given, only cells in that house\n"
+"    are included.");
+
+#define DATA_STATE_CANDIDATES_KEYS_METHODDEF    \
+    {"keys", (PyCFunction)data_state_candidates_keys, METH_VARARGS|METH_KEYWORDS, data_state_candidates_keys__doc__},
+
+static PyObject *
+data_state_candidates_keys_impl(SudokuMapObject *self, PyObject *house);
 
-            if (PyDict_SetItem(dict, key, value) < 0) {
-                Py_DECREF(key);
-                Py_DECREF(value);
-                goto error;
-            }
+static PyObject *
+data_state_candidates_keys(SudokuMapObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *return_value = NULL;
+    static char *_keywords[] = {"house", NULL};
+    PyObject *house = Py_None;
 
-            Py_DECREF(value);
-        decref:
-            Py_DECREF(key);
-        }
-    }
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "|O:keys", _keywords,
+        &house))
+        goto exit;
+    return_value = data_state_candidates_keys_impl(self, house);
 
-    return dict;
+exit:
+    return return_value;
+}
 
-error:
-    Py_DECREF(dict);
-    return NULL;
+static PyObject *
+data_state_candidates_keys_impl(SudokuMapObject *self, PyObject *house)
+/*[clinic end generated code: output=642b88ca6ecba26f input=cf22da06c6512ada]*/
+{
+    return map_iter(self, house, 0, YIELD_KEYS);
 }
 
 /*[clinic input]
-data.State.__setstate__
+data.state_candidates.values
 
-    state: object
-        A tuple; the first item is a dictionary that contains
-        CandidateSets for keys with candidate data. The second
-        item is the movehook from the pickled State object. The
-        third is the object's dict in case dynamic attributes were
-        assigned.
-    /
+    house: object = None
+        A house index from 0 to 26; if given, only cells in that house
+        are included.
 
-Unpickle a State.
+Iterate over the CandidateSets of unsolved keys.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_State___setstate____doc__,
-"__setstate__($self, state, /)\n"
+PyDoc_STRVAR(data_state_candidates_values__doc__,
+"values($self, /, house=None)\n"
 "--\n"
 "\n"
-"Unpickle a State.\n"
+"Iterate over the CandidateSets of unsolved keys.\n"
 "\n"
-"  state\n"
-"    A tuple; the first item is a dictionary that contains\n"
-"    CandidateSets for keys with candidate data. The second\n"
-"    item is the movehook from the pickled State object. The\n"
-"    third is the object\'s dict in case dynamic attributes were\n"
-"    assigned.");
+"  house\n"
+"    A house index from 0 to 26; if given, only cells in that house\n"
+"    are included.");
 
-#define DATA_STATE___SETSTATE___METHODDEF    \
-    {"__setstate__", (PyCFunction)data_State___setstate__, METH_O, data_State___setstate____doc__},
+#define DATA_STATE_CANDIDATES_VALUES_METHODDEF    \
+    {"values", (PyCFunction)data_state_candidates_values, METH_VARARGS|METH_KEYWORDS, data_state_candidates_values__doc__},
 
 static PyObject *
-data_State___setstate__(SudokuStateObject *self, PyObject *state)
-/*[clinic end generated code: output=fa2f67e79e613542 input=d79485c6f1f74158]*/
-{
-    PyObject *cands, *key, *value, *hook, *dict;
-    Py_ssize_t i = 0;
-    uint16_t set;
-
-    if (!PyTuple_Check(state) || PyTuple_GET_SIZE(state) != 3) {
-        PyErr_Format(PyExc_TypeError,
-            "__setstate__: Expected tuple, not '%.100s'",
-            Py_TYPE(state)->tp_name);
-        return NULL;
-    }
-    cands = PyTuple_GET_ITEM(state, 0);
-    if (!PyDict_Check(cands)) {
-        PyErr_Format(PyExc_TypeError,
-            "__setstate__: Expected first item to be dict, not '%.100s'",
-            Py_TYPE(cands)->tp_name);
-        return NULL;
-    }
-
-    while (PyDict_Next(cands, &i, &key, &value)) {
-        if (!CandidateSet_Check(value)) {
-            PyErr_Format(PyExc_TypeError,
-                "__setstate__: Expected value to be CandidateSet, not '%.100s'",
-                Py_TYPE(value)->tp_name);
-            return NULL;
-        }
-        set = ((CandidateSetObject *)value)->cs_set;
+data_state_candidates_values_impl(SudokuMapObject *self, PyObject *house);
 
-        UNPACK_KEY(key, return NULL, "__setstate__");
-        CELL_CANDS(self->ss_grid, x, y) = set;
-        if (!CELL_FILLED(self->ss_grid, x, y))
-            house_adjust_cand_count_up(self, x, y, set);
-    }
+static PyObject *
+data_state_candidates_values(SudokuMapObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *return_value = NULL;
+    static char *_keywords[] = {"house", NULL};
+    PyObject *house = Py_None;
 
-    dict = PyTuple_GET_ITEM(state, 2);
-    if (dict != Py_None) {
-        if (!PyDict_Check(dict)) {
-            PyErr_Format(PyExc_TypeError,
-            "__setstate__: Expected third item to be dict, not '%.100s'",
-            Py_TYPE(dict)->tp_name);
-            return NULL;
-        }
-        self->ss_dict = PyDict_New();
-        if (!self->ss_dict)
-            return NULL;
-        i = 0;
-        while (PyDict_Next(dict, &i, &key, &value)) {
-            if (PyDict_SetItem(self->ss_dict, key, value) < 0)
-                return NULL;
-            Py_INCREF(key);
-            Py_INCREF(value);
-        }
-    }
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "|O:values", _keywords,
+        &house))
+        goto exit;
+    return_value = data_state_candidates_values_impl(self, house);
 
-    hook = PyTuple_GET_ITEM(state, 1);
-    if (hook != Py_None) {
-        Py_INCREF(hook);
-        self->ss_movehook = hook;
-    }
+exit:
+    return return_value;
+}
 
-    Py_RETURN_NONE;
+static PyObject *
+data_state_candidates_values_impl(SudokuMapObject *self, PyObject *house)
+/*[clinic end generated code: output=2889466d7df0cc7f input=e77ec1f81b39306b]*/
+{
+    return map_iter(self, house, 0, YIELD_CANDS);
 }
 
 /*[clinic input]
-data.State.__reduce__
+data.state_candidates.items
 
-Pickle support for State objects.
+    house: object = None
+        A house index from 0 to 26; if given, only cells in that house
+        are included.
+
+Iterate over (key, CandidateSet) pairs for unsolved keys.
+
+The pairs are read straight from the grid; a pair tuple is reused when
+the previous one has been released.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_State___reduce____doc__,
-"__reduce__($self, /)\n"
+PyDoc_STRVAR(data_state_candidates_items__doc__,
+"items($self, /, house=None)\n"
 "--\n"
 "\n"
-"Pickle support for State objects.");
+"Iterate over (key, CandidateSet) pairs for unsolved keys.\n"
+"\n"
+"  house\n"
+"    A house index from 0 to 26; if given, only cells in that house\n"
+"    are included.\n"
+"\n"
+"The pairs are read straight from the grid; a pair tuple is reused when\n"
+"the previous one has been released.");
 
-#define DATA_STATE___REDUCE___METHODDEF    \
-    {"__reduce__", (PyCFunction)data_State___reduce__, METH_NOARGS, data_State___reduce____doc__},
+#define DATA_STATE_CANDIDATES_ITEMS_METHODDEF    \
+    {"items", (PyCFunction)data_state_candidates_items, METH_VARARGS|METH_KEYWORDS, data_state_candidates_items__doc__},
 
 static PyObject *
-data_State___reduce___impl(SudokuStateObject *self);
+data_state_candidates_items_impl(SudokuMapObject *self, PyObject *house);
 
 static PyObject *
-data_State___reduce__(SudokuStateObject *self, PyObject *Py_UNUSED(ignored))
+data_state_candidates_items(SudokuMapObject *self, PyObject *args, PyObject *kwargs)
 {
-    return data_State___reduce___impl(self);
+    PyObject *return_value = NULL;
+    static char *_keywords[] = {"house", NULL};
+    PyObject *house = Py_None;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "|O:items", _keywords,
+        &house))
+        goto exit;
+    return_value = data_state_candidates_items_impl(self, house);
+
+exit:
+    return return_value;
 }
 
 static PyObject *
-data_State___reduce___impl(SudokuStateObject *self)
-/*[clinic end generated code: output=45f0bbd5e088a3b2 input=738d173648e54c86]*/
+data_state_candidates_items_impl(SudokuMapObject *self, PyObject *house)
+/*[clinic end generated code: output=ad3faa37862cb5a2 input=b96e5b70a04114d1]*/
 {
-    PyObject *clues, *cands, *reduction;
-    Py_ssize_t len = self->ss_dict ? PyDict_Size(self->ss_dict) : 0;
-    if (len < 0)
-        return NULL;
+    return map_iter(self, house, 0, YIELD_CAND_ITEMS);
+}
 
-    clues = build_dict(self, CLUES, 0);
-    if (!clues)
-        return NULL;
-    cands = build_dict(self, CANDS, 1);
-    if (!cands) {
-        Py_DECREF(clues);
-        return NULL;
-    }
+/*[clinic input]
+data.state_candidates.getlist
 
-    reduction = Py_BuildValue("(O(OOO)(OOO)",
-        Py_TYPE(self),
-        clues,
-        Py_False,   /* causes __init__ to not fill in pencilmarks */
-        self->ss_grconfig == default_grconfig ? Py_None : self->ss_grconfig,
-        cands,
-        self->ss_movehook ? self->ss_movehook : Py_None,
-        len > 0 ? self->ss_dict : Py_None);
-    Py_DECREF(clues);
-    Py_DECREF(cands);
+Get a list of the candidate sets of all 81 cells.
 
-    return reduction;
-}
+The list is in cell index order, with None for solved cells.
+[clinic start generated code]*/
 
-static PyMethodDef State_methods[] = {
-    DATA_STATE_CANDIDATE_IN_KEYSET_METHODDEF
-    DATA_STATE_CANDIDATES_FROM_KEYSET_METHODDEF
-    DATA_STATE_ADD_CANDIDATES_METHODDEF
-    DATA_STATE_REMOVE_CANDIDATES_METHODDEF
-    DATA_STATE_CANDIDATE_IN_HOUSES_METHODDEF
-    DATA_STATE_CANDIDATES_FROM_HOUSE_METHODDEF
-    DATA_STATE_FIND_RECTANGLES_METHODDEF
-    DATA_STATE_ORDER_SIMPLE_METHODDEF
-    DATA_STATE_ORDER_SOLVED_METHODDEF
-    DATA_STATE_ORDER_RANDOM_METHODDEF
-    DATA_STATE_ORDER_BY_NUM_CANDIDATES_METHODDEF
-    DATA_STATE_ORDER_BY_NUM_CANDIDATES_REV_METHODDEF
-    DATA_STATE_ORDER_EXACTLY_N_METHODDEF
-    DATA_STATE___SETSTATE___METHODDEF
-    DATA_STATE___REDUCE___METHODDEF
-    {NULL}  /* sentinel */
-};
+PyDoc_STRVAR(data_state_candidates_getlist__doc__,
+"getlist($self, /)\n"
+"--\n"
+"\n"
+"Get a list of the candidate sets of all 81 cells.\n"
+"\n"
+"The list is in cell index order, with None for solved cells.");
 
-/* state_candidates and state_clues implementations */
+#define DATA_STATE_CANDIDATES_GETLIST_METHODDEF    \
+    {"getlist", (PyCFunction)data_state_candidates_getlist, METH_NOARGS, data_state_candidates_getlist__doc__},
 
-typedef struct {
-    PyObject_HEAD
-    SudokuStateObject *state;
-    PyObject *mp_weakref;
-} SudokuMapObject;
+static PyObject *
+data_state_candidates_getlist_impl(SudokuMapObject *self);
 
-static void
-data_map_dealloc(SudokuMapObject *self)
+static PyObject *
+data_state_candidates_getlist(SudokuMapObject *self, PyObject *Py_UNUSED(ignored))
 {
-    PyObject_ClearWeakRefs((PyObject *)self);
-    Py_DECREF(self->state);
-    Py_TYPE(self)->tp_free(self);
+    return data_state_candidates_getlist_impl(self);
 }
 
-static Py_ssize_t
-data_candidates_length(SudokuMapObject *self)
+static PyObject *
+data_state_candidates_getlist_impl(SudokuMapObject *self)
+/*[clinic end generated code: output=e8ec4734aceca481 input=62bfed855c5028d8]*/
 {
-    return GRIDSIZE - self->state->ss_solved;
+    return build_list(self->state, CANDS);
 }
 
+/*[clinic input]
+data.state_clues.keys
+
+    house: object = None
+        A house index from 0 to 26; if given, only cells in that house
+        are included.
+
+Iterate over the solved keys.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_state_clues_keys__doc__,
+"keys($self, /, house=None)\n"
+"--\n"
+"\n"
+"Iterate over the solved keys.\n"
+"\n"
+"  house\n"
+"    A house index from 0 to 26; if given, only cells in that house\n"
+"    are included.");
+
+#define DATA_STATE_CLUES_KEYS_METHODDEF    \
+    {"keys", (PyCFunction)data_state_clues_keys, METH_VARARGS|METH_KEYWORDS, data_state_clues_keys__doc__},
+
 static PyObject *
-data_candidates_subscript(SudokuMapObject *self, PyObject *key)
+data_state_clues_keys_impl(SudokuMapObject *self, PyObject *house);
+
+static PyObject *
+data_state_clues_keys(SudokuMapObject *self, PyObject *args, PyObject *kwargs)
 {
-    SudokuStateObject *state = self->state;
+    PyObject *return_value = NULL;
+    static char *_keywords[] = {"house", NULL};
+    PyObject *house = Py_None;
 
-    UNPACK_KEY(key, return NULL, "__getitem__");
-    if (CELL_FILLED(state->ss_grid, x, y)) {
-        _PyErr_SetKeyError(key);
-        return NULL;
-    }
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "|O:keys", _keywords,
+        &house))
+        goto exit;
+    return_value = data_state_clues_keys_impl(self, house);
 
-    return build_set(CELL_CANDS(state->ss_grid, x, y));
+exit:
+    return return_value;
 }
 
-static int
-data_candidates_ass_sub(SudokuMapObject *self, PyObject *key, PyObject *cands)
+static PyObject *
+data_state_clues_keys_impl(SudokuMapObject *self, PyObject *house)
+/*[clinic end generated code: output=32d7c6f54801f228 input=3113225a1490618b]*/
 {
-    SudokuStateObject *state = self->state;
-    uint16_t new_set, old_set;
-    int need_decref = 0;
-    int return_value = -1;
+    return map_iter(self, house, 1, YIELD_KEYS);
+}
 
-    /* For deletion, set to the empty CandidateSet */
-    if (!cands) {
-        cands = build_set(0);
-        if (!cands)
-            return -1;
-        need_decref = 1;
-    }
+/*[clinic input]
+data.state_clues.values
 
-    if (!CandidateSet_Check(cands)) {
-        PyErr_Format(PyExc_TypeError,
-            "__setitem__: Expected CandidateSet, not '%.100s'",
-            Py_TYPE(cands)->tp_name);
-        goto done;
-    }
-    UNPACK_KEY(key, goto done,
-        need_decref ? "__delitem__" : "__setitem__");
+    house: object = None
+        A house index from 0 to 26; if given, only cells in that house
+        are included.
 
-    if (CELL_FILLED(state->ss_grid, x, y)) {
-        _PyErr_SetKeyError(key);
-        goto done;
-    }
+Iterate over the digits of solved keys.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_state_clues_values__doc__,
+"values($self, /, house=None)\n"
+"--\n"
+"\n"
+"Iterate over the digits of solved keys.\n"
+"\n"
+"  house\n"
+"    A house index from 0 to 26; if given, only cells in that house\n"
+"    are included.");
 
-    new_set = ((CandidateSetObject *)cands)->cs_set;
-    old_set = CELL_CANDS(state->ss_grid, x, y);
+#define DATA_STATE_CLUES_VALUES_METHODDEF    \
+    {"values", (PyCFunction)data_state_clues_values, METH_VARARGS|METH_KEYWORDS, data_state_clues_values__doc__},
 
-    /* Adjust houses */
-    house_adjust_cand_count_down(state, x, y, old_set);
-    house_adjust_cand_count_up(state, x, y, new_set);
+static PyObject *
+data_state_clues_values_impl(SudokuMapObject *self, PyObject *house);
 
-    CELL_CANDS(state->ss_grid, x, y) = new_set;
-    return_value = 0;
+static PyObject *
+data_state_clues_values(SudokuMapObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *return_value = NULL;
+    static char *_keywords[] = {"house", NULL};
+    PyObject *house = Py_None;
 
-done:
-    if (need_decref)
-        Py_DECREF(cands);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "|O:values", _keywords,
+        &house))
+        goto exit;
+    return_value = data_state_clues_values_impl(self, house);
+
+exit:
     return return_value;
 }
 
-static PyMappingMethods candidates_as_mapping = {
-    (lenfunc)data_candidates_length,        /*mp_length*/
-    (binaryfunc)data_candidates_subscript,  /*mp_subscript*/
-    (objobjargproc)data_candidates_ass_sub, /*mp_ass_subscript*/
-};
-
-static Py_ssize_t
-data_clues_length(SudokuMapObject *self)
+static PyObject *
+data_state_clues_values_impl(SudokuMapObject *self, PyObject *house)
+/*[clinic end generated code: output=ad642d1f70b480e3 input=fefe4189c6c88b36]*/
 {
-    return self->state->ss_solved;
+    return map_iter(self, house, 1, YIELD_VALUES);
 }
 
+/*[clinic input]
+data.state_clues.items
+
+    house: object = None
+        A house index from 0 to 26; if given, only cells in that house
+        are included.
+
+Iterate over (key, digit) pairs for solved keys.
+
+The pairs are read straight from the grid; a pair tuple is reused when
+the previous one has been released.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_state_clues_items__doc__,
+"items($self, /, house=None)\n"
+"--\n"
+"\n"
+"Iterate over (key, digit) pairs for solved keys.\n"
+"\n"
+"  house\n"
+"    A house index from 0 to 26; if given, only cells in that house\n"
+"    are included.\n"
+"\n"
+"The pairs are read straight from the grid; a pair tuple is reused when\n"
+"the previous one has been released.");
+
+#define DATA_STATE_CLUES_ITEMS_METHODDEF    \
+    {"items", (PyCFunction)data_state_clues_items, METH_VARARGS|METH_KEYWORDS, data_state_clues_items__doc__},
+
 static PyObject *
-data_clues_subscript(SudokuMapObject *self, PyObject *key)
-{
-    SudokuStateObject *state = self->state;
+data_state_clues_items_impl(SudokuMapObject *self, PyObject *house);
 
-    UNPACK_KEY(key, return NULL, "__getitem__");
+static PyObject *
+data_state_clues_items(SudokuMapObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *return_value = NULL;
+    static char *_keywords[] = {"house", NULL};
+    PyObject *house = Py_None;
 
-    if (!CELL_FILLED(state->ss_grid, x, y)) {
-        _PyErr_SetKeyError(key);
-        return NULL;
-    }
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "|O:items", _keywords,
+        &house))
+        goto exit;
+    return_value = data_state_clues_items_impl(self, house);
 
-    return PyLong_FromLong((long)CELL_VALUE(state->ss_grid, x, y));
+exit:
+    return return_value;
 }
 
-static int
-delete_clue(SudokuStateObject *state, PyObject *key)
+static PyObject *
+data_state_clues_items_impl(SudokuMapObject *self, PyObject *house)
+/*[clinic end generated code: output=f431299f48352478 input=206f081b441b6409]*/
 {
-    Py_ssize_t cl;
+    return map_iter(self, house, 1, YIELD_CLUE_ITEMS);
+}
 
-    UNPACK_KEY(key, return -1, "__delitem__");
-    if (!CELL_FILLED(state->ss_grid, x, y)) {
-        _PyErr_SetKeyError(key);
-        return -1;
-    }
-    cl = CELL_VALUE(state->ss_grid, x, y);
+/*[clinic input]
+data.state_clues.getlist
 
-    if (PySet_Discard(state->ss_skeys, key) < 0)
-        return -1;
-    state->ss_digits[cl]--;
-    house_adjust_solved_down(state, x, y);
-    house_adjust_cand_count_up(state, x, y, CELL_CANDS(state->ss_grid, x, y));
-    CELL_VALUE(state->ss_grid, x, y) = -1;
-    state->ss_solved--;
+Get a list of the values of all 81 cells.
 
-    return 0;
-}
+The list is in cell index order, with None for unsolved cells.
+[clinic start generated code]*/
 
-static int
-assign_clue(SudokuStateObject *state, PyObject *key, Py_ssize_t digit)
-{
-    UNPACK_KEY(key, return -1, "__setitem__");
+PyDoc_STRVAR(data_state_clues_getlist__doc__,
+"getlist($self, /)\n"
+"--\n"
+"\n"
+"Get a list of the values of all 81 cells.\n"
+"\n"
+"The list is in cell index order, with None for unsolved cells.");
 
-    if (CELL_FILLED(state->ss_grid, x, y)) {
-        _PyErr_SetKeyError(key);
-        return -1;
-    }
-    if (PySet_Add(state->ss_skeys, key) < 0)
-        return -1;
+#define DATA_STATE_CLUES_GETLIST_METHODDEF    \
+    {"getlist", (PyCFunction)data_state_clues_getlist, METH_NOARGS, data_state_clues_getlist__doc__},
 
-    house_adjust_solved_up(state, x, y);
-    house_adjust_cand_count_down(state, x, y, CELL_CANDS(state->ss_grid, x, y));
-    CELL_VALUE(state->ss_grid, x, y) = (uint16_t)digit;
-    state->ss_solved++;
-    state->ss_digits[digit]++;
-    
-    return 0;
+static PyObject *
+data_state_clues_getlist_impl(SudokuMapObject *self);
+
+static PyObject *
+data_state_clues_getlist(SudokuMapObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return data_state_clues_getlist_impl(self);
 }
 
-static int
-data_clues_ass_sub(SudokuMapObject *self, PyObject* key, PyObject* value)
+static PyObject *
+data_state_clues_getlist_impl(SudokuMapObject *self)
+/*[clinic end generated code: output=dc062a60b4c59c64 input=e096ba4c5dc7fc14]*/
 {
-    int return_value = 0;
-    Py_ssize_t digit;
+    return build_list(self->state, CLUES);
+}
 
-    if (value == NULL) {
-        return_value = delete_clue(self->state, key);
-    } else {
-        digit = PyLong_AsSsize_t(value);
-        if (PyErr_Occurred()) {
-            return_value = -1;
-        } else if (digit < 0 || digit >= NUMROWS) {
-            PyErr_Format(PyExc_ValueError,
-                "__setitem__: Expected a digit from 0-%d, got '%ld'",
-                NUMROWS, digit);
-            return_value = -1;
-        } else {
-            return_value = assign_clue(self->state, key, digit);
-        }
-    }
+static PyMethodDef candidates_methods[] = {
+    DATA_STATE_CANDIDATES_FILL_METHODDEF
+    DATA_STATE_CANDIDATES_CLEAR_METHODDEF
+    DATA_STATE_CANDIDATES_GETDICT_METHODDEF
+    DATA_STATE_CANDIDATES_KEYS_METHODDEF
+    DATA_STATE_CANDIDATES_VALUES_METHODDEF
+    DATA_STATE_CANDIDATES_ITEMS_METHODDEF
+    DATA_STATE_CANDIDATES_GETLIST_METHODDEF
+    {NULL}  /* sentinel */
+};
 
-    return return_value;
+static PyMethodDef clues_methods[] = {
+    DATA_STATE_CLUES_GETDICT_METHODDEF
+    DATA_STATE_CLUES_KEYS_METHODDEF
+    DATA_STATE_CLUES_VALUES_METHODDEF
+    DATA_STATE_CLUES_ITEMS_METHODDEF
+    DATA_STATE_CLUES_GETLIST_METHODDEF
+    {NULL}  /* sentinel */
+};
+
+static PyObject *
+data_candidates_iter(SudokuMapObject *self)
+{
+    return data_State_order_simple_impl(self->state);
 }
 
-static PyMappingMethods clues_as_mapping = {
-    (lenfunc)data_clues_length,         /*mp_length*/
-    (binaryfunc)data_clues_subscript,   /*mp_subscript*/
-    (objobjargproc)data_clues_ass_sub,  /*mp_ass_subscript*/
+static PyObject *
+data_clues_iter(SudokuMapObject *self)
+{
+    return data_State_order_solved_impl(self->state);
+}
+
+static PyTypeObject state_candidates_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "data.state_candidates",    /*tp_name*/
+    sizeof(SudokuMapObject),    /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)data_map_dealloc,/*tp_dealloc*/
+    0,                          /*tp_print*/
+    0,                          /*tp_getattr*/
+    0,                          /*tp_setattr*/
+    0,                          /*tp_reserved*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    &candidates_as_sequence,    /*tp_as_sequence*/
+    &candidates_as_mapping,     /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    0,                          /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    offsetof(SudokuMapObject, mp_weakref),/*tp_weaklistoffset*/
+    (getiterfunc)data_candidates_iter,/*tp_iter*/
+    0,                          /*tp_iternext*/
+    candidates_methods,         /*tp_methods*/
+    map_members,                /*tp_members*/
 };
 
-static PyMemberDef map_members[] = {
-    {"state",       T_OBJECT, offsetof(SudokuMapObject, state),      READONLY},
-    {"__weakref__", T_OBJECT, offsetof(SudokuMapObject, mp_weakref), READONLY},
-    {NULL}  /* sentinel */
+static PyTypeObject state_clues_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "data.state_clues",         /*tp_name*/
+    sizeof(SudokuMapObject),    /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)data_map_dealloc,/*tp_dealloc*/
+    0,                          /*tp_print*/
+    0,                          /*tp_getattr*/
+    0,                          /*tp_setattr*/
+    0,                          /*tp_reserved*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    &clues_as_sequence,         /*tp_as_sequence*/
+    &clues_as_mapping,          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    0,                          /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    0,                          /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    offsetof(SudokuMapObject, mp_weakref),/*tp_weaklistoffset*/
+    (getiterfunc)data_clues_iter,/*tp_iter*/
+    0,                          /*tp_iternext*/
+    clues_methods,              /*tp_methods*/
+    map_members,                /*tp_members*/
 };
 
-/*[clinic input]
-data.state_candidates.fill
+/* state_solved_keys; a live, read only, set-like view of the solved keys,
+ * backed by the solved cell mask. It has the same layout as the maps above.
+ * Membership tests and len don't hash or build anything; comparisons and
+ * the set operators work on a snapshot of the view as a set. The module
+ * registers the type with collections.abc.Set.
+ */
 
-Fill in pencilmarks.
+static PyTypeObject state_solved_keys_Type;
 
-This method fills in all candidates in the grid naively based on the solved
-cells. This doesn't do anything fancy like leave out candidates that are
-eliminated by locked candidates.
-[clinic start generated code]*/
+static Py_ssize_t
+data_solved_keys_length(SudokuMapObject *self)
+{
+    return self->state->ss_solved;
+}
 
-PyDoc_STRVAR(data_state_candidates_fill__doc__,
-"fill($self, /)\n"
-"--\n"
-"\n"
-"Fill in pencilmarks.\n"
-"\n"
-"This method fills in all candidates in the grid naively based on the solved\n"
-"cells. This doesn\'t do anything fancy like leave out candidates that are\n"
-"eliminated by locked candidates.");
+static int
+data_solved_keys_contains(SudokuMapObject *self, PyObject *key)
+{
+    Py_ssize_t i = key_lookup(key);
 
-#define DATA_STATE_CANDIDATES_FILL_METHODDEF    \
-    {"fill", (PyCFunction)data_state_candidates_fill, METH_NOARGS, data_state_candidates_fill__doc__},
+    return i >= 0 && CM_TEST(self->state->ss_solvedmask, i);
+}
 
-static PyObject *
-data_state_candidates_fill_impl(SudokuMapObject *self);
+static PySequenceMethods solved_keys_as_sequence = {
+    (lenfunc)data_solved_keys_length,       /* sq_length */
+    0,                                      /* sq_concat */
+    0,                                      /* sq_repeat */
+    0,                                      /* sq_item */
+    0,                                      /* sq_slice */
+    0,                                      /* sq_ass_item */
+    0,                                      /* sq_ass_slice */
+    (objobjproc)data_solved_keys_contains,  /* sq_contains */
+    0,                                      /* sq_inplace_concat */
+    0,                                      /* sq_inplace_repeat */
+};
 
+/* New reference to o, or to a set snapshot of o if it is a view. */
 static PyObject *
-data_state_candidates_fill(SudokuMapObject *self, PyObject *Py_UNUSED(ignored))
+solved_keys_as_set(PyObject *o)
 {
-    return data_state_candidates_fill_impl(self);
+    if (Py_TYPE(o) == &state_solved_keys_Type)
+        return PySet_New(o);
+    Py_INCREF(o);
+    return o;
 }
 
 static PyObject *
-data_state_candidates_fill_impl(SudokuMapObject *self)
-/*[clinic end generated code: output=04a7b76d9628e630 input=ee44234cd35a3892]*/
+solved_keys_binop(PyObject *a, PyObject *b, binaryfunc op)
 {
-    if (fill_in_pencilmarks(self->state) < 0)
+    PyObject *sa, *sb, *result;
+
+    sa = solved_keys_as_set(a);
+    if (!sa)
         return NULL;
-    Py_RETURN_NONE;
+    sb = solved_keys_as_set(b);
+    if (!sb) {
+        Py_DECREF(sa);
+        return NULL;
+    }
+    result = op(sa, sb);
+    Py_DECREF(sa);
+    Py_DECREF(sb);
+    return result;
 }
 
-/*[clinic input]
-data.state_candidates.clear
-
-Clear all pencilmarks.
-
-This method deletes all candidates from the grid, including candidates for
-cells which are solved but were unsolved.
-[clinic start generated code]*/
-
-PyDoc_STRVAR(data_state_candidates_clear__doc__,
-"clear($self, /)\n"
-"--\n"
-"\n"
-"Clear all pencilmarks.\n"
-"\n"
-"This method deletes all candidates from the grid, including candidates for\n"
-"cells which are solved but were unsolved.");
+static PyObject *
+solved_keys_num_subtract(PyObject *a, PyObject *b)
+{
+    return solved_keys_binop(a, b, PyNumber_Subtract);
+}
 
-#define DATA_STATE_CANDIDATES_CLEAR_METHODDEF    \
-    {"clear", (PyCFunction)data_state_candidates_clear, METH_NOARGS, data_state_candidates_clear__doc__},
+static PyObject *
+solved_keys_num_and(PyObject *a, PyObject *b)
+{
+    return solved_keys_binop(a, b, PyNumber_And);
+}
 
 static PyObject *
-data_state_candidates_clear_impl(SudokuMapObject *self);
+solved_keys_num_xor(PyObject *a, PyObject *b)
+{
+    return solved_keys_binop(a, b, PyNumber_Xor);
+}
 
 static PyObject *
-data_state_candidates_clear(SudokuMapObject *self, PyObject *Py_UNUSED(ignored))
+solved_keys_num_or(PyObject *a, PyObject *b)
 {
-    return data_state_candidates_clear_impl(self);
+    return solved_keys_binop(a, b, PyNumber_Or);
 }
 
+static PyNumberMethods solved_keys_as_number = {
+    0,                                  /* nb_add */
+    (binaryfunc)solved_keys_num_subtract,/* nb_subtract */
+    0,                                  /* nb_multiply */
+    0,                                  /* nb_remainder */
+    0,                                  /* nb_divmod */
+    0,                                  /* nb_power */
+    0,                                  /* nb_negative */
+    0,                                  /* nb_positive */
+    0,                                  /* nb_absolute */
+    0,                                  /* nb_bool */
+    0,                                  /* nb_invert */
+    0,                                  /* nb_lshift */
+    0,                                  /* nb_rshift */
+    (binaryfunc)solved_keys_num_and,    /* nb_and */
+    (binaryfunc)solved_keys_num_xor,    /* nb_xor */
+    (binaryfunc)solved_keys_num_or,     /* nb_or */
+};
+
 static PyObject *
-data_state_candidates_clear_impl(SudokuMapObject *self)
-/*[clinic end generated code: output=3a74712316627088 input=b38dc96986635a8a]*/
+data_solved_keys_richcompare(PyObject *self, PyObject *other, int op)
 {
-    Py_ssize_t i, j;
-    uint16_t set;
+    PyObject *sa, *sb, *result;
 
-    for (i = 0; i < NUMROWS; i++) {
-        for (j = 0; j < NUMROWS; j++) {
-            set = CELL_CANDS(self->state->ss_grid, i, j);
-            if (set > 0) {
-                if (!CELL_FILLED(self->state->ss_grid, i, j))
-                    house_adjust_cand_count_down(self->state, i, j, set);
-                CELL_CANDS(self->state->ss_grid, i, j) = 0;
-            }
-        }
+    if (!PyAnySet_Check(other) && Py_TYPE(other) != &state_solved_keys_Type)
+        Py_RETURN_NOTIMPLEMENTED;
+    sa = solved_keys_as_set(self);
+    if (!sa)
+        return NULL;
+    sb = solved_keys_as_set(other);
+    if (!sb) {
+        Py_DECREF(sa);
+        return NULL;
     }
+    result = PyObject_RichCompare(sa, sb, op);
+    Py_DECREF(sa);
+    Py_DECREF(sb);
+    return result;
+}
 
-    Py_RETURN_NONE;
+static PyObject *
+data_solved_keys_repr(PyObject *self)
+{
+    PyObject *set, *result;
+
+    set = PySet_New(self);
+    if (!set)
+        return NULL;
+    result = PyUnicode_FromFormat("%s(%R)", Py_TYPE(self)->tp_name, set);
+    Py_DECREF(set);
+    return result;
 }
 
 /*[clinic input]
-data.state_candidates.getdict
+data.state_solved_keys.isdisjoint
 
-Get a dictionary of CandidateSets.
+    other: object
+    /
 
-The dictionary contains all candidate sets from unsolved cells
-in the grid.
+Return True if the view and other have no keys in common.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_state_candidates_getdict__doc__,
-"getdict($self, /)\n"
+PyDoc_STRVAR(data_state_solved_keys_isdisjoint__doc__,
+"isdisjoint($self, other, /)\n"
 "--\n"
 "\n"
-"Get a dictionary of CandidateSets.\n"
-"\n"
-"The dictionary contains all candidate sets from unsolved cells\n"
-"in the grid.");
-
-#define DATA_STATE_CANDIDATES_GETDICT_METHODDEF    \
-    {"getdict", (PyCFunction)data_state_candidates_getdict, METH_NOARGS, data_state_candidates_getdict__doc__},
+"Return True if the view and other have no keys in common.");
 
-static PyObject *
-data_state_candidates_getdict_impl(SudokuMapObject *self);
+#define DATA_STATE_SOLVED_KEYS_ISDISJOINT_METHODDEF    \
+    {"isdisjoint", (PyCFunction)data_state_solved_keys_isdisjoint, METH_O, data_state_solved_keys_isdisjoint__doc__},
 
 static PyObject *
-data_state_candidates_getdict(SudokuMapObject *self, PyObject *Py_UNUSED(ignored))
+data_state_solved_keys_isdisjoint(SudokuMapObject *self, PyObject *other)
+/*[clinic end generated code: output=29207347a5fabcdb input=6d38fa45eb26625d]*/
 {
-    return data_state_candidates_getdict_impl(self);
-}
+    const cellmask *mine = &self->state->ss_solvedmask, *theirs;
+    PyObject *it, *item;
+    int found = 0;
+
+    if (Py_TYPE(other) == &state_solved_keys_Type) {
+        theirs = &((SudokuMapObject *)other)->state->ss_solvedmask;
+        return PyBool_FromLong(!(mine->cm_bits[0] & theirs->cm_bits[0]) &&
+                               !(mine->cm_bits[1] & theirs->cm_bits[1]));
+    }
 
-static PyObject *
-data_state_candidates_getdict_impl(SudokuMapObject *self)
-/*[clinic end generated code: output=f5e527202ff59ab1 input=6164e3445e6d6fdb]*/
-{
-    return build_dict(self->state, CANDS, 0);
+    it = PyObject_GetIter(other);
+    if (!it)
+        return NULL;
+    while (!found && (item = PyIter_Next(it)) != NULL) {
+        found = data_solved_keys_contains(self, item);
+        Py_DECREF(item);
+    }
+    Py_DECREF(it);
+    if (PyErr_Occurred())
+        return NULL;
+    return PyBool_FromLong(!found);
 }
 
 /*[clinic input]
-data.state_clues.getdict
+data.state_solved_keys.issubset
 
-Get a dictionary containing values for solved keys.
+    other: object
+    /
+
+Return True if every key in the view is also in other.
 [clinic start generated code]*/
 
-PyDoc_STRVAR(data_state_clues_getdict__doc__,
-"getdict($self, /)\n"
+PyDoc_STRVAR(data_state_solved_keys_issubset__doc__,
+"issubset($self, other, /)\n"
 "--\n"
 "\n"
-"Get a dictionary containing values for solved keys.");
-
-#define DATA_STATE_CLUES_GETDICT_METHODDEF    \
-    {"getdict", (PyCFunction)data_state_clues_getdict, METH_NOARGS, data_state_clues_getdict__doc__},
+"Return True if every key in the view is also in other.");
 
-static PyObject *
-data_state_clues_getdict_impl(SudokuMapObject *self);
+#define DATA_STATE_SOLVED_KEYS_ISSUBSET_METHODDEF    \
+    {"issubset", (PyCFunction)data_state_solved_keys_issubset, METH_O, data_state_solved_keys_issubset__doc__},
 
 static PyObject *
-data_state_clues_getdict(SudokuMapObject *self, PyObject *Py_UNUSED(ignored))
+data_state_solved_keys_issubset(SudokuMapObject *self, PyObject *other)
+/*[clinic end generated code: output=bc45f3531167383a input=ace16285466f495e]*/
 {
-    return data_state_clues_getdict_impl(self);
-}
+    const cellmask *mine = &self->state->ss_solvedmask, *theirs;
+    PyObject *set;
+    Py_ssize_t i;
+    int res = 1;
 
-static PyObject *
-data_state_clues_getdict_impl(SudokuMapObject *self)
-/*[clinic end generated code: output=4fd506249e462bc7 input=eb62d226626d5704]*/
-{
-    return build_dict(self->state, CLUES, 0);
+    if (Py_TYPE(other) == &state_solved_keys_Type) {
+        theirs = &((SudokuMapObject *)other)->state->ss_solvedmask;
+        return PyBool_FromLong(!(mine->cm_bits[0] & ~theirs->cm_bits[0]) &&
+                               !(mine->cm_bits[1] & ~theirs->cm_bits[1]));
+    }
+
+    /* like set.issubset, other can be any iterable */
+    if (PyAnySet_Check(other)) {
+        set = other;
+        Py_INCREF(set);
+    } else {
+        set = PySet_New(other);
+        if (!set)
+            return NULL;
+    }
+    for (i = 0; i < GRIDSIZE && res > 0; i++) {
+        if (CM_TEST(*mine, i))
+            res = PySet_Contains(set, ikeys[i]);
+    }
+    Py_DECREF(set);
+    if (res < 0)
+        return NULL;
+    return PyBool_FromLong(res);
 }
 
-static PyMethodDef candidates_methods[] = {
-    DATA_STATE_CANDIDATES_FILL_METHODDEF
-    DATA_STATE_CANDIDATES_CLEAR_METHODDEF
-    DATA_STATE_CANDIDATES_GETDICT_METHODDEF
-    {NULL}  /* sentinel */
-};
+/*[clinic input]
+data.state_solved_keys.copy
 
-static PyMethodDef clues_methods[] = {
-    DATA_STATE_CLUES_GETDICT_METHODDEF
-    {NULL}  /* sentinel */
-};
+Return a frozenset of the solved keys.
+
+The view is live, so this takes a snapshot of it. __copy__ is the same.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_state_solved_keys_copy__doc__,
+"copy($self, /)\n"
+"--\n"
+"\n"
+"Return a frozenset of the solved keys.\n"
+"\n"
+"The view is live, so this takes a snapshot of it. __copy__ is the same.");
+
+#define DATA_STATE_SOLVED_KEYS_COPY_METHODDEF    \
+    {"copy", (PyCFunction)data_state_solved_keys_copy, METH_NOARGS, data_state_solved_keys_copy__doc__},
 
 static PyObject *
-data_candidates_iter(SudokuMapObject *self)
+data_state_solved_keys_copy_impl(SudokuMapObject *self);
+
+static PyObject *
+data_state_solved_keys_copy(SudokuMapObject *self, PyObject *Py_UNUSED(ignored))
 {
-    return data_State_order_simple_impl(self->state);
+    return data_state_solved_keys_copy_impl(self);
 }
 
 static PyObject *
-data_clues_iter(SudokuMapObject *self)
+data_state_solved_keys_copy_impl(SudokuMapObject *self)
+/*[clinic end generated code: output=3888037b816436bb input=3f83a5fb345702de]*/
 {
-    return data_State_order_solved_impl(self->state);
+    return PyFrozenSet_New((PyObject *)self);
 }
 
-static PyTypeObject state_candidates_Type = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "data.state_candidates",    /*tp_name*/
-    sizeof(SudokuMapObject),    /*tp_basicsize*/
-    0,                          /*tp_itemsize*/
-    /* methods */
-    (destructor)data_map_dealloc,/*tp_dealloc*/
-    0,                          /*tp_print*/
-    0,                          /*tp_getattr*/
-    0,                          /*tp_setattr*/
-    0,                          /*tp_reserved*/
-    0,                          /*tp_repr*/
-    0,                          /*tp_as_number*/
-    0,                          /*tp_as_sequence*/
-    &candidates_as_mapping,     /*tp_as_mapping*/
-    0,                          /*tp_hash*/
-    0,                          /*tp_call*/
-    0,                          /*tp_str*/
-    0,                          /*tp_getattro*/
-    0,                          /*tp_setattro*/
-    0,                          /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
-    0,                          /*tp_doc*/
-    0,                          /*tp_traverse*/
-    0,                          /*tp_clear*/
-    0,                          /*tp_richcompare*/
-    offsetof(SudokuMapObject, mp_weakref),/*tp_weaklistoffset*/
-    (getiterfunc)data_candidates_iter,/*tp_iter*/
-    0,                          /*tp_iternext*/
-    candidates_methods,         /*tp_methods*/
-    map_members,                /*tp_members*/
+static PyMethodDef solved_keys_methods[] = {
+    DATA_STATE_SOLVED_KEYS_ISDISJOINT_METHODDEF
+    DATA_STATE_SOLVED_KEYS_ISSUBSET_METHODDEF
+    DATA_STATE_SOLVED_KEYS_COPY_METHODDEF
+    {"__copy__", (PyCFunction)data_state_solved_keys_copy, METH_NOARGS, data_state_solved_keys_copy__doc__},
+    {NULL}  /* sentinel */
 };
 
-static PyTypeObject state_clues_Type = {
+static PyTypeObject state_solved_keys_Type = {
     PyVarObject_HEAD_INIT(NULL, 0)
-    "data.state_clues",         /*tp_name*/
+    "data.state_solved_keys",   /*tp_name*/
     sizeof(SudokuMapObject),    /*tp_basicsize*/
     0,                          /*tp_itemsize*/
     /* methods */
@@ -2946,10 +7594,10 @@ static PyTypeObject state_clues_Type = {
     0,                          /*tp_getattr*/
     0,                          /*tp_setattr*/
     0,                          /*tp_reserved*/
-    0,                          /*tp_repr*/
-    0,                          /*tp_as_number*/
-    0,                          /*tp_as_sequence*/
-    &clues_as_mapping,          /*tp_as_mapping*/
+    (reprfunc)data_solved_keys_repr,/*tp_repr*/
+    &solved_keys_as_number,     /*tp_as_number*/
+    &solved_keys_as_sequence,   /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
     0,                          /*tp_hash*/
     0,                          /*tp_call*/
     0,                          /*tp_str*/
@@ -2960,11 +7608,11 @@ static PyTypeObject state_clues_Type = {
     0,                          /*tp_doc*/
     0,                          /*tp_traverse*/
     0,                          /*tp_clear*/
-    0,                          /*tp_richcompare*/
+    (richcmpfunc)data_solved_keys_richcompare,/*tp_richcompare*/
     offsetof(SudokuMapObject, mp_weakref),/*tp_weaklistoffset*/
     (getiterfunc)data_clues_iter,/*tp_iter*/
     0,                          /*tp_iternext*/
-    clues_methods,              /*tp_methods*/
+    solved_keys_methods,        /*tp_methods*/
     map_members,                /*tp_members*/
 };
 
@@ -3002,9 +7650,16 @@ data_State_movehook_setter(SudokuStateObject *self, PyObject *move)
 static PyObject *
 new_sudoku_map(SudokuStateObject *state, PyTypeObject *type)
 {
-    SudokuMapObject *self = PyObject_New(SudokuMapObject, type);
-    if (!self)
-        return NULL;
+    SudokuMapObject *self;
+
+    if (map_numfree) {
+        self = map_freelist[--map_numfree];
+        PyObject_Init((PyObject *)self, type);
+    } else {
+        self = PyObject_New(SudokuMapObject, type);
+        if (!self)
+            return NULL;
+    }
     Py_INCREF(state);
     self->state = state;
     self->mp_weakref = NULL;
@@ -3029,6 +7684,17 @@ data_State_clues_getter(SudokuStateObject *self)
     return new_sudoku_map(self, &state_clues_Type);
 }
 
+PyDoc_STRVAR(data_State_solved_keys_doc,
+"A live, read only view of the solved keys. It supports len, iteration,\n\
+membership tests, comparison with sets and the set operators &, |, - and\n\
+^, which return sets.");
+
+static PyObject *
+data_State_solved_keys_getter(SudokuStateObject *self)
+{
+    return new_sudoku_map(self, &state_solved_keys_Type);
+}
+
 PyDoc_STRVAR(data_State_row_subgroups_doc,
 "Dictionary of row subgroups; each key maps to a subgroup.\n\
 A row subgroup is the intersection between a row and a group.");
@@ -3085,93 +7751,341 @@ data_State_num_remaining_getter(SudokuStateObject *self)
     return PyLong_FromSsize_t(GRIDSIZE - self->ss_solved);
 }
 
+PyDoc_STRVAR(data_State_epoch_doc,
+"A counter that increases every time a cell changes. Pass a value of\n\
+this to changes_since to find out what has changed since then.");
+
+static PyObject *
+data_State_epoch_getter(SudokuStateObject *self)
+{
+    return PyLong_FromSsize_t(self->ss_epoch);
+}
+
 PyDoc_STRVAR(data_State_num_values_doc,
 "A tuple containing the number of times that each clue appears in\n\
 the grid. For example, num_values[4] tells you how many cells in the\n\
 grid are set to 4.");
 
-static PyObject *
-data_State_num_values_getter(SudokuStateObject *self)
+static PyObject *
+data_State_num_values_getter(SudokuStateObject *self)
+{
+    PyObject *values, *integer;
+    Py_ssize_t i;
+
+    values = PyTuple_New(NUMROWS);
+    if (!values)
+        return NULL;
+    for (i = 0; i < NUMROWS; i++) {
+        integer = PyLong_FromSsize_t(self->ss_digits[i]);
+        if (!integer) {
+            Py_DECREF(values);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(values, i, integer);
+    }
+
+    return values;
+}
+
+static PyObject *
+housekey_get(SudokuStateObject *self, Py_ssize_t n)
+{
+    PyObject *v = PyTuple_GET_ITEM(self->ss_housekeys, n);
+
+    Py_INCREF(v);
+    return v;
+}
+
+PyDoc_STRVAR(data_State_rows_doc,
+"Keysets for each row.");
+
+static PyObject *
+data_State_rows_getter(SudokuStateObject *self)
+{
+    return housekey_get(self, 0);
+}
+
+PyDoc_STRVAR(data_State_cols_doc,
+"Keysets for each column.");
+
+static PyObject *
+data_State_cols_getter(SudokuStateObject *self)
+{
+    return housekey_get(self, 1);
+}
+
+PyDoc_STRVAR(data_State_houses_doc,
+"Keysets for every house, starting with groups, then columns, then rows.");
+
+static PyObject *
+data_State_houses_getter(SudokuStateObject *self)
+{
+    return housekey_get(self, 2);
+}
+
+PyDoc_STRVAR(data_State_house_indices_doc,
+"Cell indices for every house, in the same order as houses. Each\n\
+house is a tuple of ints in simple order.");
+
+static PyObject *
+data_State_house_indices_getter(SudokuStateObject *self)
+{
+    PyObject *houses, *house, *index;
+    Py_ssize_t filled[NUMROWS*3];
+    Py_ssize_t h, i, k;
+
+    houses = PyTuple_New(NUMROWS*3);
+    if (!houses)
+        return NULL;
+    for (h = 0; h < NUMROWS*3; h++) {
+        house = PyTuple_New(NUMROWS);
+        if (!house)
+            goto error;
+        PyTuple_SET_ITEM(houses, h, house);
+        filled[h] = 0;
+    }
+
+    for (i = 0; i < GRIDSIZE; i++) {
+        Py_ssize_t hs[3] = {
+            self->ss_layout->gl_houses[i][0],
+            COLOFFSET + COL(i),
+            ROWOFFSET + ROW(i)
+        };
+        for (k = 0; k < 3; k++) {
+            house = PyTuple_GET_ITEM(houses, hs[k]);
+            if (filled[hs[k]] == NUMROWS) {
+                PyErr_SetString(PyExc_SystemError,
+                    "house_indices: Bad group configuration");
+                goto error;
+            }
+            index = PyLong_FromSsize_t(i);
+            if (!index)
+                goto error;
+            PyTuple_SET_ITEM(house, filled[hs[k]]++, index);
+        }
+    }
+
+    return houses;
+
+error:
+    Py_DECREF(houses);
+    return NULL;
+}
+
+PyDoc_STRVAR(data_State_has_default_config_doc,
+"True if the State has a default group configuration, meaning\n\
+that the groups are 3x3 boxes arranged in the normal way.");
+
+static PyObject *
+data_State_has_default_config_getter(SudokuStateObject *self)
+{
+    PyObject *v = self->ss_config == default_config ? Py_True : Py_False;
+
+    Py_INCREF(v);
+    return v;
+}
+
+/* grid_buffer; exports one of the State's flat arrays through the
+ * buffer protocol, so that the arrays can be read through a memoryview (or
+ * by numpy) without building any objects. The export is read only, since
+ * writing to the arrays would bypass the house bookkeeping.
+ */
+
+typedef struct {
+    PyObject_HEAD
+    SudokuStateObject *gb_state;    /* keeps the memory alive */
+    char *gb_data;                  /* points into gb_state */
+    char *gb_format;                /* struct module format of an item */
+    Py_ssize_t gb_itemsize;
+    int gb_ndim;
+    Py_ssize_t gb_shape[2];
+    Py_ssize_t gb_strides[2];
+} GridBufferObject;
+
+static PyTypeObject grid_buffer_Type;
+
+static void
+data_grid_buffer_dealloc(GridBufferObject *self)
+{
+    Py_DECREF(self->gb_state);
+    PyObject_Del((PyObject *)self);
+}
+
+static int
+data_grid_buffer_getbuffer(GridBufferObject *self, Py_buffer *view, int flags)
 {
-    PyObject *values, *integer;
-    Py_ssize_t i;
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError,
+            "State arrays are read only");
+        view->obj = NULL;
+        return -1;
+    }
 
-    values = PyTuple_New(NUMROWS);
-    if (!values)
-        return NULL;
-    for (i = 0; i < NUMROWS; i++) {
-        integer = PyLong_FromSsize_t(self->ss_digits[i]);
-        if (!integer) {
-            Py_DECREF(values);
-            return NULL;
-        }
-        PyTuple_SET_ITEM(values, i, integer);
+    if (!(flags & PyBUF_STRIDES) && self->gb_ndim == 2 &&
+        self->gb_strides[0] != self->gb_shape[1] * self->gb_itemsize) {
+        PyErr_SetString(PyExc_BufferError,
+            "State array is not contiguous");
+        view->obj = NULL;
+        return -1;
     }
 
-    return values;
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->buf = self->gb_data;
+    view->len = self->gb_shape[0] * self->gb_itemsize;
+    if (self->gb_ndim == 2)
+        view->len *= self->gb_shape[1];
+    view->readonly = 1;
+    view->itemsize = self->gb_itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? self->gb_format : NULL;
+    /* Without PyBUF_ND the consumer gets the array as one contiguous run
+     * of bytes, like PyBuffer_FillInfo gives.
+     */
+    if (flags & PyBUF_ND) {
+        view->ndim = self->gb_ndim;
+        view->shape = self->gb_shape;
+    } else {
+        view->ndim = 1;
+        view->shape = NULL;
+    }
+    view->strides = (flags & PyBUF_STRIDES) ? self->gb_strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
 }
 
+static PyBufferProcs grid_buffer_as_buffer = {
+    (getbufferproc)data_grid_buffer_getbuffer,  /*bf_getbuffer*/
+    0,                                          /*bf_releasebuffer*/
+};
+
+static PyTypeObject grid_buffer_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "sudoku.data.grid_buffer",  /*tp_name*/
+    sizeof(GridBufferObject),   /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    /* methods */
+    (destructor)data_grid_buffer_dealloc,/*tp_dealloc*/
+    0,                          /*tp_print*/
+    0,                          /*tp_getattr*/
+    0,                          /*tp_setattr*/
+    0,                          /*tp_reserved*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    0,                          /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    0,                          /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    &grid_buffer_as_buffer,     /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+};
+
+/* Return a read only memoryview over data, which has rows rows of cols
+ * items, each row starting stride items after the previous one; rows is 0
+ * for a one dimensional view.
+ */
 static PyObject *
-housekey_get(SudokuStateObject *self, Py_ssize_t n)
+grid_memoryview(SudokuStateObject *state, void *data, char *format,
+    Py_ssize_t itemsize, Py_ssize_t rows, Py_ssize_t cols, Py_ssize_t stride)
 {
-    PyObject *v = PyTuple_GET_ITEM(self->ss_housekeys, n);
+    GridBufferObject *gb;
+    PyObject *view;
 
-    Py_INCREF(v);
-    return v;
+    gb = PyObject_New(GridBufferObject, &grid_buffer_Type);
+    if (!gb)
+        return NULL;
+    Py_INCREF(state);
+    gb->gb_state = state;
+    gb->gb_data = (char *)data;
+    gb->gb_format = format;
+    gb->gb_itemsize = itemsize;
+    if (rows) {
+        gb->gb_ndim = 2;
+        gb->gb_shape[0] = rows;
+        gb->gb_shape[1] = cols;
+        gb->gb_strides[0] = stride * itemsize;
+        gb->gb_strides[1] = itemsize;
+    } else {
+        gb->gb_ndim = 1;
+        gb->gb_shape[0] = cols;
+        gb->gb_strides[0] = itemsize;
+    }
+
+    view = PyMemoryView_FromObject((PyObject *)gb);
+    Py_DECREF(gb);
+    return view;
 }
 
-PyDoc_STRVAR(data_State_rows_doc,
-"Keysets for each row.");
+PyDoc_STRVAR(data_State_cell_values_doc,
+"Read only memoryview of 81 uint8 values, indexed by cell index. Solved\n\
+cells hold their digit (0-8); unsolved cells hold 255. The view is live;\n\
+it reflects later changes to the State.");
 
 static PyObject *
-data_State_rows_getter(SudokuStateObject *self)
+data_State_cell_values_getter(SudokuStateObject *self)
 {
-    return housekey_get(self, 0);
+    return grid_memoryview(self, self->ss_values, "B", sizeof(uint8_t),
+                           0, GRIDSIZE, 0);
 }
 
-PyDoc_STRVAR(data_State_cols_doc,
-"Keysets for each column.");
+PyDoc_STRVAR(data_State_cell_candidates_doc,
+"Read only memoryview of 81 uint16 candidate masks, indexed by cell\n\
+index. Bit n is set if n is a candidate. Masks of solved cells are\n\
+whatever they were when the cell was solved. The view is live.");
 
 static PyObject *
-data_State_cols_getter(SudokuStateObject *self)
+data_State_cell_candidates_getter(SudokuStateObject *self)
 {
-    return housekey_get(self, 1);
+    return grid_memoryview(self, self->ss_cands, "H", sizeof(uint16_t),
+                           0, GRIDSIZE, 0);
 }
 
-PyDoc_STRVAR(data_State_houses_doc,
-"Keysets for every house, starting with groups, then columns, then rows.");
+PyDoc_STRVAR(data_State_house_counts_doc,
+"Read only 27x9 memoryview of uint8 counts; house_counts[h][n] is the\n\
+number of unsolved cells in house h that have n as a candidate. Houses\n\
+are ordered like houses. The view is live.");
 
 static PyObject *
-data_State_houses_getter(SudokuStateObject *self)
+data_State_house_counts_getter(SudokuStateObject *self)
 {
-    return housekey_get(self, 2);
+    return grid_memoryview(self, &self->ss_counts[0][0], "B", sizeof(uint8_t),
+                           NUMROWS*3, NUMROWS, COUNTROW);
 }
 
-PyDoc_STRVAR(data_State_has_default_config_doc,
-"True if the State has a default group configuration, meaning\n\
-that the groups are 3x3 boxes arranged in the normal way.");
+PyDoc_STRVAR(data_State_position_masks_doc,
+"Read only 27x9 memoryview of uint16 masks; position_masks[h][n] has bit\n\
+k set if houses[h][k] is unsolved and has n as a candidate. For groups\n\
+this follows the grconfig lists, not house_indices. The view is live.");
 
 static PyObject *
-data_State_has_default_config_getter(SudokuStateObject *self)
+data_State_position_masks_getter(SudokuStateObject *self)
 {
-    PyObject *v = self->ss_grconfig == default_grconfig ? Py_True : Py_False;
-
-    Py_INCREF(v);
-    return v;
+    return grid_memoryview(self, &self->ss_positions[0][0], "H",
+                           sizeof(uint16_t), NUMROWS*3, NUMROWS, NUMROWS);
 }
 
 static PyGetSetDef State_getsets[] = {
     {"movehook",      (getter)data_State_movehook_getter, (setter)data_State_movehook_setter, data_State_movehook_doc},
     {"candidates",    (getter)data_State_candidates_getter,    NULL, data_State_candidates_doc},
     {"clues",         (getter)data_State_clues_getter,         NULL, data_State_clues_doc},
+    {"solved_keys",   (getter)data_State_solved_keys_getter,   NULL, data_State_solved_keys_doc},
     {"row_subgroups", (getter)data_State_row_subgroups_getter, NULL, data_State_row_subgroups_doc},
     {"col_subgroups", (getter)data_State_col_subgroups_getter, NULL, data_State_col_subgroups_doc},
     {"done",          (getter)data_State_done_getter,          NULL, data_State_done_doc},
     {"num_remaining", (getter)data_State_num_remaining_getter, NULL, data_State_num_remaining_doc},
+    {"epoch", (getter)data_State_epoch_getter, NULL, data_State_epoch_doc},
     {"num_values",    (getter)data_State_num_values_getter,    NULL, data_State_num_values_doc},
     {"rows",          (getter)data_State_rows_getter,          NULL, data_State_rows_doc},
     {"cols",          (getter)data_State_cols_getter,          NULL, data_State_cols_doc},
     {"houses",        (getter)data_State_houses_getter,        NULL, data_State_houses_doc},
+    {"house_indices", (getter)data_State_house_indices_getter, NULL, data_State_house_indices_doc},
+    {"cell_values",   (getter)data_State_cell_values_getter,   NULL, data_State_cell_values_doc},
+    {"cell_candidates", (getter)data_State_cell_candidates_getter, NULL, data_State_cell_candidates_doc},
+    {"house_counts",  (getter)data_State_house_counts_getter,  NULL, data_State_house_counts_doc},
+    {"position_masks", (getter)data_State_position_masks_getter, NULL, data_State_position_masks_doc},
     {"has_default_config", (getter)data_State_has_default_config_getter, NULL, data_State_has_default_config_doc},
     {"__dict__", PyObject_GenericGetDict, NULL, NULL},
     {NULL}  /* sentinel */
@@ -3180,8 +8094,8 @@ static PyGetSetDef State_getsets[] = {
 static PyMemberDef State_members[] = {
     {"peers",       T_OBJECT,   offsetof(SudokuStateObject, ss_peers),      READONLY},
     {"grconfig",    T_OBJECT,   offsetof(SudokuStateObject, ss_grconfig),   READONLY},
-    {"num_solved",  T_INT,      offsetof(SudokuStateObject, ss_solved),     READONLY},
-    {"solved_keys", T_OBJECT,   offsetof(SudokuStateObject, ss_skeys),      READONLY},
+    {"config",      T_OBJECT,   offsetof(SudokuStateObject, ss_config),     READONLY},
+    {"num_solved",  T_UBYTE,    offsetof(SudokuStateObject, ss_solved),     READONLY},
     {"oneset",      T_OBJECT,   offsetof(SudokuStateObject, ss_oneset),     READONLY},
     {"__weakref__", T_OBJECT,   offsetof(SudokuStateObject, ss_weakref),    READONLY},
     {NULL}  /* sentinel */
@@ -3322,24 +8236,419 @@ static PyTypeObject SudokuState_Type = {
     0,                          /*tp_descr_set*/
     offsetof(SudokuStateObject, ss_dict),/*tp_dictoffset*/
     data_State___init__,        /*tp_init*/
-    0,                          /*tp_alloc*/
-    PyType_GenericNew,          /*tp_new*/
+    data_State_alloc,           /*tp_alloc*/
+    data_State_new,             /*tp_new*/
     PyObject_GC_Del,            /*tp_free*/
     0,                          /*tp_is_gc*/
 };
 
+/* Batch solving. Puzzles are parsed while holding the GIL, then solved by
+ * native threads with the GIL released, using the solver engine from above
+ * on the default group layout.
+ */
+
+static void
+build_default_layout(grid_layout *layout)
+{
+    uint8_t groups[GRIDSIZE];
+    Py_ssize_t i;
+
+    for (i = 0; i < GRIDSIZE; i++)
+        groups[i] = (uint8_t)((ROW(i)/3)*3 + COL(i)/3 + GROFFSET);
+    layout_build(layout, groups, NULL);
+}
+
+/* Solve one puzzle given as 81 values, where 0 is a blank and 1-9 are
+ * digits. Writes 81 characters to out; all '.' if there is no solution.
+ */
+static void
+solve_values(const grid_layout *layout, const uint8_t *values, char *out)
+{
+    solve_board b;
+    solve_stats stats = {0, 0};
+    Py_ssize_t i, k;
+    uint16_t bit;
+
+    memset(&b, 0, sizeof(solve_board));
+    b.sb_remaining = GRIDSIZE;
+    for (i = 0; i < GRIDSIZE; i++)
+        b.sb_cands[i] = TERMS;
+    for (i = 0; i < GRIDSIZE; i++) {
+        if (!values[i])
+            continue;
+        bit = 1 << (values[i] - 1);
+        if (!(b.sb_cands[i] & bit))
+            goto fail;
+        b.sb_cands[i] = bit;
+        b.sb_solved[i] = 1;
+        b.sb_remaining--;
+        for (k = 0; k < 3; k++) {
+            Py_ssize_t h = layout->gl_houses[i][k], n, c;
+
+            if (b.sb_placed[h] & bit)
+                goto fail;
+            b.sb_placed[h] |= bit;
+            for (n = 0; n < NUMROWS; n++) {
+                c = layout->gl_cells[h][n];
+                if (!b.sb_solved[c])
+                    b.sb_cands[c] &= ~bit;
+            }
+        }
+    }
+    for (i = 0; i < GRIDSIZE; i++) {
+        if (!b.sb_solved[i] && !b.sb_cands[i])
+            goto fail;
+    }
+
+    if (board_search(&b, layout, &stats) < 0)
+        goto fail;
+    for (i = 0; i < GRIDSIZE; i++)
+        out[i] = (char)('1' + lowest_digit(b.sb_cands[i]));
+    return;
+
+fail:
+    memset(out, '.', GRIDSIZE);
+}
+
+typedef struct {
+    const uint8_t *bw_values;   /* GRIDSIZE values for each puzzle */
+    char *bw_out;               /* GRIDSIZE characters for each puzzle */
+    Py_ssize_t bw_count;        /* number of puzzles */
+    Py_ssize_t bw_start;        /* first puzzle for this worker */
+    Py_ssize_t bw_step;         /* number of workers */
+} batch_work;
+
+static void *
+batch_worker(void *arg)
+{
+    batch_work *work = (batch_work *)arg;
+    Py_ssize_t i;
+
+    /* Workers take every bw_step'th puzzle, so that runs of hard puzzles
+     * in a file are spread out between threads.
+     */
+    for (i = work->bw_start; i < work->bw_count; i += work->bw_step) {
+        solve_values(&default_layout, work->bw_values + i*GRIDSIZE,
+            work->bw_out + i*GRIDSIZE);
+    }
+    return NULL;
+}
+
+/* Parse an 81 character puzzle line into values. Returns -1 on error. */
+static int
+parse_puzzle(const char *line, Py_ssize_t len, uint8_t *values, Py_ssize_t n)
+{
+    Py_ssize_t i;
+    unsigned char c;
+    char shown[5];
+
+    if (len != GRIDSIZE) {
+        PyErr_Format(PyExc_ValueError,
+            "Puzzle %zd: Expected %d characters, got %zd", n, GRIDSIZE, len);
+        return -1;
+    }
+    for (i = 0; i < GRIDSIZE; i++) {
+        c = (unsigned char)line[i];
+        if (c >= '1' && c <= '9') {
+            values[i] = (uint8_t)(c - '0');
+        } else if (c == '.' || c == '0') {
+            values[i] = 0;
+        } else {
+            /* only printable ascii is shown as itself */
+            if (c >= 0x20 && c < 0x7f)
+                PyOS_snprintf(shown, sizeof(shown), "%c", c);
+            else
+                PyOS_snprintf(shown, sizeof(shown), "\\x%02x", c);
+            PyErr_Format(PyExc_ValueError,
+                "Puzzle %zd: Bad character '%s' at position %zd", n, shown, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Parse a buffer of newline separated puzzles. Blank lines are skipped.
+ * Returns the number of puzzles, or -1 on error.
+ */
+static Py_ssize_t
+parse_puzzle_lines(const char *buf, Py_ssize_t size, uint8_t **values)
+{
+    Py_ssize_t count = 0, pos, end, len;
+
+    /* every puzzle takes at least GRIDSIZE bytes */
+    *values = PyMem_Malloc((size/GRIDSIZE + 1) * GRIDSIZE);
+    if (!*values) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    for (pos = 0; pos < size; pos = end + 1) {
+        for (end = pos; end < size && buf[end] != '\n'; end++)
+            ;
+        len = end - pos;
+        if (len && buf[pos + len - 1] == '\r')
+            len--;
+        if (!len)
+            continue;
+        if (parse_puzzle(buf + pos, len, *values + count*GRIDSIZE, count) < 0)
+            return -1;
+        count++;
+    }
+
+    return count;
+}
+
+static Py_ssize_t
+parse_puzzle_sequence(PyObject *seq, uint8_t **values)
+{
+    Py_ssize_t count, i, len;
+    PyObject *item;
+    const char *line;
+
+    count = PySequence_Fast_GET_SIZE(seq);
+    *values = PyMem_Malloc((count + 1) * GRIDSIZE);
+    if (!*values) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        item = PySequence_Fast_GET_ITEM(seq, i);
+        if (PyUnicode_Check(item)) {
+            line = PyUnicode_AsUTF8AndSize(item, &len);
+            if (!line)
+                return -1;
+        } else if (PyBytes_Check(item)) {
+            line = PyBytes_AS_STRING(item);
+            len = PyBytes_GET_SIZE(item);
+        } else {
+            PyErr_Format(PyExc_TypeError,
+                "solve_batch: Expected str or bytes, not '%.100s'",
+                Py_TYPE(item)->tp_name);
+            return -1;
+        }
+        if (parse_puzzle(line, len, *values + i*GRIDSIZE, i) < 0)
+            return -1;
+    }
+
+    return count;
+}
+
+/*[clinic input]
+data.solve_batch
+
+    puzzles: object
+        Either a sequence of puzzle strings (str or bytes), or a bytes-like
+        object containing puzzles separated by newlines.
+
+    threads: Py_ssize_t = 0
+        Number of threads to solve with. If this is 0, use one thread per
+        processor.
+
+Solve many puzzles at once with native threads.
+
+Puzzles use the one line format of puzzles.txt; 81 characters, with '.'
+or '0' for blanks. Every puzzle uses the default group configuration.
+The GIL is released while solving.
+
+Returns a bytes object containing the solutions in order, each taking
+81 characters with no separators. A puzzle with no solution gives 81
+'.' characters.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_solve_batch__doc__,
+"solve_batch($module, /, puzzles, threads=0)\n"
+"--\n"
+"\n"
+"Solve many puzzles at once with native threads.\n"
+"\n"
+"  puzzles\n"
+"    Either a sequence of puzzle strings (str or bytes), or a bytes-like\n"
+"    object containing puzzles separated by newlines.\n"
+"  threads\n"
+"    Number of threads to solve with. If this is 0, use one thread per\n"
+"    processor.\n"
+"\n"
+"Puzzles use the one line format of puzzles.txt; 81 characters, with \'.\'\n"
+"or \'0\' for blanks. Every puzzle uses the default group configuration.\n"
+"The GIL is released while solving.\n"
+"\n"
+"Returns a bytes object containing the solutions in order, each taking\n"
+"81 characters with no separators. A puzzle with no solution gives 81\n"
+"\'.\' characters.");
+
+#define DATA_SOLVE_BATCH_METHODDEF    \
+    {"solve_batch", (PyCFunction)data_solve_batch, METH_VARARGS|METH_KEYWORDS, data_solve_batch__doc__},
+
+static PyObject *
+data_solve_batch_impl(PyModuleDef *module, PyObject *puzzles, Py_ssize_t threads);
+
+static PyObject *
+data_solve_batch(PyModuleDef *module, PyObject *args, PyObject *kwargs)
+{
+    PyObject *return_value = NULL;
+    static char *_keywords[] = {"puzzles", "threads", NULL};
+    PyObject *puzzles;
+    Py_ssize_t threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+        "O|n:solve_batch", _keywords,
+        &puzzles, &threads))
+        goto exit;
+    return_value = data_solve_batch_impl(module, puzzles, threads);
+
+exit:
+    return return_value;
+}
+
+/* upper limit on worker threads */
+#define MAXTHREADS 64
+
+static PyObject *
+data_solve_batch_impl(PyModuleDef *module, PyObject *puzzles, Py_ssize_t threads)
+/*[clinic end generated code: output=218fa0e7135660d5 input=fcef9254931d3482]*/
+{
+    pthread_t tids[MAXTHREADS];
+    batch_work work[MAXTHREADS];
+    int started[MAXTHREADS];
+    uint8_t *values = NULL;
+    Py_ssize_t count, i;
+    PyObject *seq, *result = NULL;
+    Py_buffer view;
+
+    if (threads < 0) {
+        PyErr_Format(PyExc_ValueError,
+            "solve_batch: Bad thread count '%zd'", threads);
+        return NULL;
+    }
+    if (!threads)
+        threads = (Py_ssize_t)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAXTHREADS)
+        threads = MAXTHREADS;
+
+    if (PyObject_CheckBuffer(puzzles)) {
+        if (PyObject_GetBuffer(puzzles, &view, PyBUF_SIMPLE) < 0)
+            return NULL;
+        count = parse_puzzle_lines((const char *)view.buf, view.len, &values);
+        PyBuffer_Release(&view);
+    } else {
+        seq = PySequence_Fast(puzzles,
+            "solve_batch: Expected a sequence or a bytes-like object");
+        if (!seq)
+            return NULL;
+        count = parse_puzzle_sequence(seq, &values);
+        Py_DECREF(seq);
+    }
+    if (count < 0)
+        goto done;
+
+    result = PyBytes_FromStringAndSize(NULL, count*GRIDSIZE);
+    if (!result)
+        goto done;
+    if (threads > count)
+        threads = count ? count : 1;
+
+    for (i = 0; i < threads; i++) {
+        work[i].bw_values = values;
+        work[i].bw_out = PyBytes_AS_STRING(result);
+        work[i].bw_count = count;
+        work[i].bw_start = i;
+        work[i].bw_step = threads;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    /* The calling thread does the first share of the work itself. */
+    for (i = 1; i < threads; i++)
+        started[i] = pthread_create(&tids[i], NULL, batch_worker, &work[i]) == 0;
+    batch_worker(&work[0]);
+    for (i = 1; i < threads; i++) {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+        else
+            batch_worker(&work[i]);
+    }
+    Py_END_ALLOW_THREADS
+
+done:
+    PyMem_Free(values);
+    return result;
+}
+
+/*[clinic input]
+data.compile_config
+
+    grconfig: object
+        A dictionary that maps each cell to a list of keys, as accepted by
+        State. May also be None for the default configuration.
+    /
+
+Compile a group configuration for sharing between States.
+
+The result can be passed to State as grconfig. Compiled configs are cached
+by layout, so compiling an equal grconfig again, or passing an equal
+grconfig dict to State, returns the same object without redoing any work.
+The config keeps its own copy of grconfig, so later changes to the dict or
+its lists don't affect it.
+[clinic start generated code]*/
+
+PyDoc_STRVAR(data_compile_config__doc__,
+"compile_config($module, grconfig, /)\n"
+"--\n"
+"\n"
+"Compile a group configuration for sharing between States.\n"
+"\n"
+"  grconfig\n"
+"    A dictionary that maps each cell to a list of keys, as accepted by\n"
+"    State. May also be None for the default configuration.\n"
+"\n"
+"The result can be passed to State as grconfig. Compiled configs are cached\n"
+"by layout, so compiling an equal grconfig again, or passing an equal\n"
+"grconfig dict to State, returns the same object without redoing any work.\n"
+"The config keeps its own copy of grconfig, so later changes to the dict or\n"
+"its lists don\'t affect it.");
+
+#define DATA_COMPILE_CONFIG_METHODDEF    \
+    {"compile_config", (PyCFunction)data_compile_config, METH_O, data_compile_config__doc__},
+
+static PyObject *
+data_compile_config(PyModuleDef *module, PyObject *grconfig)
+/*[clinic end generated code: output=c81d5130d298e158 input=a9ded14159fa0564]*/
+{
+    return config_lookup(grconfig, "compile_config");
+}
+
+static PyMethodDef data_methods[] = {
+    DATA_SOLVE_BATCH_METHODDEF
+    DATA_COMPILE_CONFIG_METHODDEF
+    {NULL}  /* sentinel */
+};
+
 /* Module level stuff */
 
 void
 data_free(void *m)
 {
+    Py_ssize_t i;
+
     Py_XDECREF(ContradictionError);
     Py_XDECREF(config_module);
     Py_XDECREF(default_grconfig);
-    Py_XDECREF(default_peers);
-    Py_XDECREF(default_subgroups);
-    Py_XDECREF(default_housekeys);
-    Py_XDECREF(default_oneset);
+    Py_XDECREF(default_config);
+    Py_XDECREF(config_cache);
+    while (state_numfree)
+        PyObject_GC_Del(state_freelist[--state_numfree]);
+    while (keyiter_numfree)
+        PyObject_Del(keyiter_freelist[--keyiter_numfree]);
+    while (map_numfree)
+        PyObject_Del(map_freelist[--map_numfree]);
+    for (i = 0; i < 512; i++)
+        Py_CLEAR(isets[i]);
+    for (i = 0; i < GRIDSIZE; i++)
+        Py_CLEAR(ikeys[i]);
+    for (i = 0; i < NUMROWS; i++)
+        Py_CLEAR(idigits[i]);
     /*printf("num allocs: %d, num deallocs %d\n", num_allocs, num_deallocs);*/
 }
 
@@ -3348,7 +8657,7 @@ static struct PyModuleDef datamodule = {
     "sudoku.data",
     module_doc,
     -1,
-    NULL,
+    data_methods,
     NULL,
     NULL,
     NULL,
@@ -3359,8 +8668,10 @@ PyMODINIT_FUNC
 PyInit_data(void)
 {
     _Py_IDENTIFIER(ContradictionError);
+    _Py_IDENTIFIER(Set);
+    _Py_IDENTIFIER(register);
     
-    PyObject *m = NULL, *err_mod, *con_mod, *err_dict;
+    PyObject *m = NULL, *err_mod, *con_mod, *abc_mod = NULL, *err_dict, *set_abc, *res;
     Py_ssize_t i;
     
     /* Get globals */
@@ -3377,51 +8688,88 @@ PyInit_data(void)
     }
     Py_INCREF(ContradictionError);
 
-    /* Default state attributes */
-    default_grconfig = do_default_build_config();
-    if (!default_grconfig)
-        goto fail;
-    default_peers = do_calculate_peers(default_grconfig);
-    if (!default_peers)
-        goto fail;
-    default_subgroups = do_calculate_subgroups(default_peers);
-    if (!default_subgroups)
-        goto fail;
-    default_housekeys = do_calculate_housekeys(default_grconfig);
-    if (!default_housekeys)
-        goto fail;
-    default_oneset = do_calculate_oneset(default_peers);
-    if (!default_oneset)
-        goto fail;
-    
+    /* Intern keys */
+    for (i = 0; i < NUMROWS; i++) {
+        idigits[i] = PyLong_FromSsize_t(i);
+        if (!idigits[i])
+            goto fail;
+    }
+    for (i = 0; i < GRIDSIZE; i++) {
+        ikeys[i] = PyTuple_Pack(2, idigits[ROW(i)], idigits[COL(i)]);
+        if (!ikeys[i])
+            goto fail;
+    }
+
     /* Prepare types */
     if (PyType_Ready(&SudokuState_Type)      < 0 ||
         PyType_Ready(&CandidateSet_Type)     < 0 ||
+        PyType_Ready(&ChangeSet_Type)        < 0 ||
+        PyType_Ready(&CandidateSetIter_Type) < 0 ||
+        PyType_Ready(&CompiledConfig_Type)   < 0 ||
+        PyType_Ready(&grid_buffer_Type)      < 0 ||
         PyType_Ready(&state_iterator_Type)   < 0 ||
         PyType_Ready(&state_candidates_Type) < 0 ||
-        PyType_Ready(&state_clues_Type)      < 0   )
+        PyType_Ready(&state_clues_Type)      < 0 ||
+        PyType_Ready(&state_solved_keys_Type) < 0  )
         goto fail;
     m = PyModule_Create(&datamodule);
     if (!m)
         goto fail;
     Py_INCREF(&SudokuState_Type);
     Py_INCREF(&CandidateSet_Type);
+    Py_INCREF(&ChangeSet_Type);
     PyModule_AddObject(m, "State", (PyObject *)&SudokuState_Type);
     PyModule_AddObject(m, "CandidateSet", (PyObject *)&CandidateSet_Type);
+    PyModule_AddObject(m, "ChangeSet", (PyObject *)&ChangeSet_Type);
+
+    /* Intern candidate set sizes and the sets themselves */
+    for (i = 0; i < 512; i++) {
+        Py_ssize_t d;
 
-    /* Intern candidate set sizes */
-    for (i = 0; i < 512; i++)
         isizes[i] = (Py_ssize_t)count_ones((int)i);
+        for (d = 0; d < NUMROWS; d++)
+            mask_expand[i][d] = (i >> d) & 1;
+    }
+    if (intern_sets() < 0)
+        goto fail;
+
+    build_default_layout(&default_layout);
+
+    /* Default group configuration */
+    default_grconfig = do_default_build_config();
+    if (!default_grconfig)
+        goto fail;
+    if ((config_cache = PyDict_New()) == NULL)
+        goto fail;
+    default_config = config_compile(default_grconfig, "PyInit_data");
+    if (!default_config)
+        goto fail;
+
+    /* The solved keys view passes isinstance(view, collections.abc.Set) */
+    abc_mod = PyImport_ImportModule("collections.abc");
+    if (!abc_mod)
+        goto fail;
+    set_abc = _PyObject_GetAttrId(abc_mod, &PyId_Set);
+    if (!set_abc)
+        goto fail;
+    res = _PyObject_CallMethodId(set_abc, &PyId_register, "O",
+                                 (PyObject *)&state_solved_keys_Type);
+    Py_DECREF(set_abc);
+    if (!res)
+        goto fail;
+    Py_DECREF(res);
 
     /* Done */
     Py_DECREF(con_mod);
     Py_DECREF(err_mod);
+    Py_DECREF(abc_mod);
    /* printf("%lu\n", sizeof(SudokuStateObject));*/
     return m;
 
 fail:
     Py_XDECREF(con_mod);
     Py_XDECREF(err_mod);
+    Py_XDECREF(abc_mod);
     Py_XDECREF(m);
     return NULL;
 }
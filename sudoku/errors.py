@@ -6,7 +6,20 @@ class SudokuError(Exception):
 class ContradictionError(SudokuError):
     """Raised when a contradiction is found in the sudoku grid, such as
     an empty candidate set or a failed call to integrity_check.
+
+    Errors raised by the State say where the grid is dead. The kind
+    attribute is 'cell' for a cell with no candidates left, 'house' for
+    a digit with no place left in a house, or 'duplicate' for two cells
+    of a house that can only be the same digit. The key, house and digit
+    attributes give the cell, house index and digit involved; attributes
+    that don't apply, and all four for errors raised elsewhere, are None.
     """
+    def __init__(self, *args, kind=None, key=None, house=None, digit=None):
+        super().__init__(*args)
+        self.kind = kind
+        self.key = key
+        self.house = house
+        self.digit = digit
 
 class NoNextMoveError(SudokuError):
     """Raised when a solver fails to find another move. This could happen
@@ -47,8 +47,8 @@ class Move:#(metaclass=ABCMeta):
 
 class CandidateMutator(Move):
     """This is the parent class for any Move that eliminates candidates
-    from cells in the state. Keeps a dictionary that maps keys to
-    sets of candidates.
+    from cells in the state. Keeps a ChangeSet (or a dictionary) that maps
+    keys to sets of candidates.
     """
     def __init__(self, state, *, change=None, **kwargs):
         # Allow the change dict to be passed into the constructor or
@@ -82,13 +82,9 @@ class EliminationMove(CandidateMutator):
         self.digit = digit
         super().__init__(state, **kwargs)
         if self.change is None:
-            change_set = CandidateSet(self.digit)
-            self.change = {
-                key: change_set
-                    for key in self.state.candidate_in_keyset(
-                        self.digit, self.state.oneset[self.key]
-                    )
-            }
+            self.change = self.state.eliminations(
+                self.state.oneset[self.key], CandidateSet(self.digit)
+            )
 
     def do(self):
         """Set the position in the grid to the given digit."""
@@ -316,8 +312,9 @@ class GuessElimination(CandidateMutator):
         )
 
 class Backtrack(Move):
-    """This move represents a backtrack to a guess. It calls undo on a list of
-    moves and eliminates the bad guess.
+    """This move represents a backtrack to a guess. It rewinds the state to
+    the trail mark taken by the guess and eliminates the bad guess. The list
+    of moves being undone is kept for redo and for repr.
     """
     def __init__(self, state, *, stack=None, why=None, **kwargs):
         if stack is None:
@@ -339,11 +336,13 @@ class Backtrack(Move):
         raise NoNextMoveError
 
     def do(self):
-        """Undo each move in the undo list."""
-        for move in self.undos:
-            move.undo()
-        # Eliminate the bad guess from the candidates grid.
+        """Roll the state back to just before the bad guess was made. This
+        does the same thing as undoing each move in the undo list, but in
+        one call to the state.
+        """
         badguess = self.undos[-1]
+        self.state.rollback(badguess.mark)
+        # Eliminate the bad guess from the candidates grid.
         self.state.movehook = GuessElimination(self.state,
                                 change={badguess.key: CandidateSet(badguess.digit)})
 
@@ -368,8 +367,16 @@ class Guess(EliminationMove):
         if remaining is None:
             raise MoveArgError('remaining')
         self.remaining = remaining
+        self.mark = None
         super().__init__(state, **kwargs)
 
+    def do(self):
+        """Mark the state's trail so that a Backtrack can rewind to this
+        point, then make the guess.
+        """
+        self.mark = self.state.mark()
+        super().do()
+
     #@abstractmethod
     def __repr__(self):
         return ': key={}, digit={}, {} other {}>'.format(
@@ -24,7 +24,7 @@ from .moves import (EliminationMove, Backtrack, Guess, SimpleGuess,
                     HiddenPairMove, HiddenTripleMove, HiddenQuadMove,
                     UniqueRectangleMove, XWingMove, FinnedXWingMove,
                     SashimiXWingMove, BUGMove)
-from .data import State, CandidateSet
+from .data import State, CandidateSet, ChangeSet
 
 ##
 ## Base Classes
@@ -235,6 +235,21 @@ class CachingAlgorithm(Algorithm):
         for cache in self.cache_list:
             cache.clear()
 
+    def clean_houses(self, cache, tag):
+        """Return the set of houses that were recorded under tag as having
+        nothing to find, less the houses that have changed since then (see
+        State.changes_since). cache is a dict from the cache list. The caller
+        adds houses to the returned set as it finds them clean.
+        """
+        entry = cache.get(tag)
+        if entry is None:
+            clean = set()
+        else:
+            token, clean = entry
+            clean.difference_update(self.state.changes_since(token)[0])
+        cache[tag] = (self.state.epoch, clean)
+        return clean
+
     def apply(self, move):
         if self.cache_on_apply:
             self.cache_on_apply.add(self.cache_on_apply_value)
@@ -247,26 +262,36 @@ class Elimination(Algorithm):
     This algorithm will succeed more often than any other.
     """
     def nextmove(self):
-        for key in self.state.order_exactly_n(1):
+        key = self.state.first_exactly_n(1)
+        if key is not None:
             cands = self.state.candidates[key]
             return EliminationMove(
-                self.state, key=key, digit=next(cands)
+                self.state, key=key, digit=next(iter(cands))
             )
         return super().nextmove()
 
-class HiddenSingles(Algorithm):
+class HiddenSingles(CachingAlgorithm):
     """Search the grid for hidden singles. A hidden single is the only appearence
     of a candidate in a row, column, or group.
     """
+    def __init__(self, **kwargs):
+        self.hidden_singles_cache = {}
+        super().__init__(**kwargs)
+        self.cache_list.append(self.hidden_singles_cache)
+
     def nextmove(self):
-        for house, house_keys in enumerate(self.state.houses):
-            for digit, count in enumerate(self.state.candidates_from_house(house)):
-                if count == 1:
+        clean = self.clean_houses(self.hidden_singles_cache, 1)
+        for house in range(27):
+            if house in clean:
+                continue
+            for digit, mask in enumerate(self.state.digit_positions(house)):
+                if mask and not mask & (mask - 1):
                     mark = house // 9
-                    key = next(iter(self.state.candidate_in_keyset(digit, house_keys)))
+                    key = self.state.keys_at(house, mask)[0]
                     return HiddenSingleMove(
                         self.state, mark=mark, key=key, digit=digit
                     )
+            clean.add(house)
         return super().nextmove()
 
 class LockedCandidates(Algorithm):
@@ -280,20 +305,21 @@ class LockedCandidates(Algorithm):
         for subgroup in chain(set(self.state.row_subgroups.values()),
                               set(self.state.col_subgroups.values())):
             for digit in self.state.candidates_from_keyset(subgroup[0]):
-                in_row_or_col = self.state.candidate_in_keyset(digit, subgroup[1])
-                in_group = self.state.candidate_in_keyset(digit, subgroup[2])
+                cs = CandidateSet(digit)
+                in_row_or_col = self.state.eliminations(subgroup[1], cs)
+                in_group = self.state.eliminations(subgroup[2], cs)
                 if in_row_or_col:
                     if not in_group:
                         return LockedCandidateMove(
                             self.state, mark=0, digit=digit, subgroup=subgroup[0],
-                            change={key: CandidateSet(digit) for key in in_row_or_col}
+                            change=in_row_or_col
                         )
                     continue
                 else:
                     if in_group:
                         return LockedCandidateMove(
                             self.state, mark=1, digit=digit, subgroup=subgroup[0],
-                            change={key: CandidateSet(digit) for key in in_group}
+                            change=in_group
                         )
         return super().nextmove()
 
@@ -380,13 +406,8 @@ class NakedSets(CachingAlgorithm):
                     search_set = subgro[0]|subgro[1]|subgro[2]
                 search_set -= set(keyset)
 
-                # Calculate change dictionary to pass into move constructor
-                change = {}
-                for key in search_set:
-                    if key not in self.state.solved_keys:
-                        elim = digits & self.state.candidates[key]
-                        if elim:
-                            change[key] = elim
+                # Calculate change set to pass into move constructor
+                change = self.state.eliminations(search_set, digits)
                 if change:
                     self.cache_on_apply = self.naked_keyset_cache
                     self.cache_on_apply_value = keyset
@@ -400,19 +421,29 @@ class NakedSetsNextAttempt(CachingAlgorithm):
     """
     def __init__(self, **kwargs):
         self.naked_keyset_cache = set()
+        self.naked_houses_cache = {}
         super().__init__(**kwargs)
         self.cache_list.append(self.naked_keyset_cache)
+        self.cache_list.append(self.naked_houses_cache)
 
     def naked_find(self, count):
         """Do the actual work for the algorithm. If count is 2, search for naked
         pairs, if 3, search for naked triples, etc.
         """
         assert count > 1
+        solved = self.state.solved_keys
         houses = [
-            {key for key in house if key not in self.state.solved_keys}
+            {key for key in house if key not in solved}
                 for house in self.state.houses
         ]
+        # A house is clean when none of its keysets gives a move. A naked set
+        # in a group that also lies in one row or column can eliminate from
+        # that line outside the group, but the line is a house of its own, so
+        # those eliminations are still found when the line changes.
+        clean = self.clean_houses(self.naked_houses_cache, count)
         for house, house_keys in enumerate(houses):
+            if house in clean:
+                continue
             for keyset in combinations(house_keys, count):
                 if keyset in self.naked_keyset_cache:
                     continue
@@ -458,20 +489,15 @@ class NakedSetsNextAttempt(CachingAlgorithm):
                         search_set = subgro[0]|subgro[1]|subgro[2]
                     search_set -= set(keyset)
 
-                    # XXX This code is hella WET
-                    # Calculate change dictionary to pass into move constructor
-                    change = {}
-                    for key in search_set:
-                        if key not in self.state.solved_keys:
-                            elim = digits & self.state.candidates[key]
-                            if elim:
-                                change[key] = elim
+                    # Calculate change set to pass into move constructor
+                    change = self.state.eliminations(search_set, digits)
                     if change:
                         self.cache_on_apply = self.naked_keyset_cache
                         self.cache_on_apply_value = keyset
                         return mark, keyset, digits, change
                     self.naked_keyset_cache.add(keyset)
                 del keyset
+            clean.add(house)
 
 class NakedPairs(NakedSets):
     """Search for naked pairs. We use the broken version of NakedSets because the
@@ -511,12 +537,17 @@ class NakedQuads(NakedSetsNextAttempt):
             )
         return super().nextmove()
 
-class HiddenSets(Algorithm):
+class HiddenSets(CachingAlgorithm):
     """Base algorithm for algorithms that search for hidden sets. For example,
     if there are a pair of candidates that appear in only two cells in a row,
     we can eliminate other candidates from those two cells. Then these cells
     are called hidden pairs.
     """
+    def __init__(self, **kwargs):
+        self.hidden_houses_cache = {}
+        super().__init__(**kwargs)
+        self.cache_list.append(self.hidden_houses_cache)
+
     def hidden_find(self, count):
         """Search for hidden sets of size count. If count is 2, search for
         hidden pairs, etc.
@@ -524,30 +555,31 @@ class HiddenSets(Algorithm):
         assert count > 1
 
         # search for candidates that appear a certain amount of times in a house
-        for house, house_keys in enumerate(self.state.houses):
+        clean = self.clean_houses(self.hidden_houses_cache, count)
+        for house in range(27):
+            if house in clean:
+                continue
             cand_counts = self.state.candidates_from_house(house)
+            positions = self.state.digit_positions(house)
             possibles = tuple(
                 n for n,k in enumerate(cand_counts)
                     if k <= count and k > 0
             )
             for poset in combinations(possibles, count):
-                keyset = set(self.state.candidate_in_keyset(poset[0], house_keys))
-                for cand in poset[1:]:
-                    keyset |= set(self.state.candidate_in_keyset(cand, house_keys))
-                if len(keyset) != count:
+                mask = 0
+                for cand in poset:
+                    mask |= positions[cand]
+                if bin(mask).count('1') != count:
                     continue
+                keyset = set(self.state.keys_at(house, mask))
 
                 # We've found a set; make sure it isn't naked
                 digits = CandidateSet(*poset)
-                change = {}
-                for key in keyset:
-                    cands = self.state.candidates[key]
-                    elim = cands - digits
-                    if elim:
-                        change[key] = elim
+                change = self.state.eliminations(keyset, ~digits)
                 if change:
                     return house // 9, keyset, digits, change
                 del poset
+            clean.add(house)
 
 class HiddenPairs(HiddenSets):
     """Search for hidden pairs."""
@@ -646,53 +678,66 @@ class SimpleXWings(CachingAlgorithm):
     """
     def __init__(self, **kwargs):
         self.simple_xwings_cache = set()
+        self.simple_xwings_scanned = None
         super().__init__(**kwargs)
         self.cache_list.append(self.simple_xwings_cache)
 
-    def nextmove(self):
-        # TODO: clean this method up; i can barely follow this and i just wrote it
-        for rectangle in self.state.find_rectangles():
-            if rectangle in self.simple_xwings_cache:
-                continue
-            cands, rect_keys = rectangle
+    def clear_caches(self):
+        self.simple_xwings_scanned = None
+        super().clear_caches()
 
+    def nextmove(self):
+        # Rectangles only lose candidates until the caches are cleared, so
+        # every (rectangle, digit) pair placed before the last one looked at
+        # has already been checked and can be skipped. A place sorts like the
+        # rectangles do, so this holds for the rectangles that the xwing filter
+        # leaves out too; those have no candidate locked into both rows or both
+        # columns, and can't give a move.
+        #
+        # Position masks follow the houses lists, which hold a row's cells by
+        # column and a column's cells by row, so masking out the rectangle
+        # leaves the cells to eliminate from.
+        scanned = self.simple_xwings_scanned
+        if scanned is True:
+            return super().nextmove()
+        counts = self.state.house_counts
+        masks = self.state.position_masks
+        for cands, rect_keys in self.state.find_rectangles(xwing=True):
             # k1: upper left
             # k2: upper right
             # k3: lower right
             # k4: lower left
             k1, k2, k3, k4 = rect_keys
-            col1_cands = self.state.candidates_from_house(k1[1] + 9)
-            col2_cands = self.state.candidates_from_house(k3[1] + 9)
-            row1_cands = self.state.candidates_from_house(k1[0] + 18)
-            row2_cands = self.state.candidates_from_house(k3[0] + 18)
+            row1, row2 = k1[0] + 18, k3[0] + 18
+            col1, col2 = k1[1] + 9, k3[1] + 9
 
             for cand in cands:
-                cs = CandidateSet(cand)
-                if (cs, rect_keys) in self.simple_xwings_cache:
+                place = (k1, k2[1], k3[0], cand)
+                if scanned is not None and place < scanned:
+                    continue
+                if place in self.simple_xwings_cache:
                     continue
                 elim = None
-                if col1_cands[cand] == 2 and col2_cands[cand] == 2:
-                    if row1_cands[cand] > 2 or row2_cands[cand] > 2:
-                        elim = (set(
-                            self.state.candidate_in_keyset(cand, self.state.houses[k1[0] + 18])) |
-                                set(
-                            self.state.candidate_in_keyset(cand, self.state.houses[k3[0] + 18]))
-                               ) - set(rect_keys)
-                if row1_cands[cand] == 2 and row2_cands[cand] == 2:
-                    if col1_cands[cand] > 2 and col2_cands[cand] > 2:
-                        elim = (set(
-                            self.state.candidate_in_keyset(cand, self.state.houses[k1[1] + 9])) |
-                                set(
-                            self.state.candidate_in_keyset(cand, self.state.houses[k3[1] + 9]))
-                               ) - set(rect_keys)
+                if counts[col1, cand] == 2 and counts[col2, cand] == 2:
+                    if counts[row1, cand] > 2 or counts[row2, cand] > 2:
+                        rect = ~(1 << k1[1] | 1 << k3[1])
+                        elim = (self.state.keys_at(row1, masks[row1, cand] & rect) +
+                                self.state.keys_at(row2, masks[row2, cand] & rect))
+                if counts[row1, cand] == 2 and counts[row2, cand] == 2:
+                    if counts[col1, cand] > 2 and counts[col2, cand] > 2:
+                        rect = ~(1 << k1[0] | 1 << k3[0])
+                        elim = (self.state.keys_at(col1, masks[col1, cand] & rect) +
+                                self.state.keys_at(col2, masks[col2, cand] & rect))
                 if elim:
+                    self.simple_xwings_scanned = place
                     self.cache_on_apply = self.simple_xwings_cache
-                    self.cache_on_apply_value = (cs, rect_keys)
+                    self.cache_on_apply_value = place
                     return XWingMove(
                         self.state, digit=cand, fish=rect_keys,
-                        change={key: cs for key in elim}
+                        change=ChangeSet.fromkeys(elim, CandidateSet(cand))
                     )
-                self.simple_xwings_cache.add((cs, rect_keys))
+        # every place has been looked at
+        self.simple_xwings_scanned = True
         return super().nextmove()
 
 class BUGPlusOne(Algorithm):
@@ -706,10 +751,10 @@ class BUGPlusOne(Algorithm):
     found. As such, it should always come after HiddenSingles in a solver mro.
     """
     def nextmove(self):
-        keys_with_2_candidates = set(self.state.order_exactly_n(2))
-        difference = self.state.num_remaining - len(keys_with_2_candidates)
+        difference = self.state.num_remaining - self.state.count_exactly_n(2)
         if difference == 1:
-            key = next(iter(set(self.state.order_simple()) - keys_with_2_candidates))
+            key = next(self.state.first_exactly_n(n) for n in range(10)
+                       if n != 2 and self.state.count_exactly_n(n))
             noelim = CandidateSet()
             cands = self.state.candidates[key]
             for cand in cands:
@@ -726,18 +771,10 @@ class UniqueRectangles(Algorithm):
     we may be able to eliminate candidates to avoid this pattern.
     """
     def nextmove(self):
-        for cs,rectangle in self.state.find_rectangles():
-            # need at least one key with only two candidates.
-            if len(cs) != 2:
-                continue
-            # For unique rectangle techniques to apply, all four keys must be
-            # contained in only two groups.
-            groups = set()
-            for key in rectangle:
-                groups.add(id(self.state.grconfig[key]))
-            if len(groups) > 2:
-                continue
-
+        # need at least one key with only two candidates, and for unique
+        # rectangle techniques to apply, all four keys must be contained in
+        # only two groups.
+        for cs,rectangle in self.state.find_rectangles(bivalue=True, two_groups=True):
             # Ok, we found a potential rectangle. We need to check for various
             # conditions that will allow us to eliminate candidates.
             #k1, k2, k3, k4 = rectangle
@@ -804,7 +841,7 @@ class Sledgehammer(BasicGuesser):
     candidate set.
     """
     def nextmove(self):
-        key = next(self.state.order_by_num_candidates())
+        key = self.state.fewest_candidates()
         cands = self.state.candidates[key]
         return self.makeguess(key, next(iter(cands)), cands, SimpleGuess)
 
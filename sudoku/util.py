@@ -24,7 +24,7 @@ import sudoku
 #       useful functions here.
 
 def solve(puzzle):
-    s = MS(string_to_grid(puzzle))
+    s = MS(State.from_string(puzzle))
     s.solve()
     print_grid(s.state.grid)
 
@@ -72,16 +72,12 @@ def newpuke(solver):
         count += 1
         print(count)
         print()
-        for i in range(9):
-            for j in range(9):
-                key = i,j
-                if key not in self.state.solved_keys:
-                    cands = solver.state.candidates[key]
-                    if isinstance(cands, set):
-                        r = set_repr(cands)
-                    else:
-                        r = repr(cands)
-                    print(key, '        ', r)
+        for key, cands in solver.state.candidates.items():
+            if isinstance(cands, set):
+                r = set_repr(cands)
+            else:
+                r = repr(cands)
+            print(key, '        ', r)
         print()
         print_grid(solver.state.grid)
         print()
@@ -217,6 +213,8 @@ class CheckHouses(Solver):
 
     def from_candidates(self):
         res = []
+        # Rebuilt from per-cell lookups, so this doesn't read the house
+        # indexes that it checks
         for keyset in self.state.houses:
             sets = [
                 self.state.candidates[key] for key in keyset